@@ -0,0 +1,414 @@
+// CPU microbenchmarks for the input pipeline: make bench
+//
+// Builds the core of main.c headless (no Wayland/EGL/GL) and times the hot functions
+// on synthetic data, for layouts from today's 15 widgets up to hundreds.
+// uinput writes go to /dev/null and D() output through the logger thread to /dev/null
+// (unless -v), so syscall and logging costs are included the way they are paid on a device.
+//
+// Usage: bench/bench [-v] [-t seconds_per_case]
+
+#define WLR_GAMEPAD_HEADLESS
+#include "../main.c"
+
+#define BENCH_SCREEN_W 1080
+#define BENCH_SCREEN_H 2340
+
+typedef void (*BenchFn)(void *ctx, uint64_t iterations);
+
+static double gBenchMinSeconds = 0.2;
+static volatile float gBenchSink;
+
+static const int kBenchWidgetCounts[] = {15, 64, 256, 512};
+static const int kNumBenchWidgetCounts = sizeof(kBenchWidgetCounts) / sizeof(kBenchWidgetCounts[0]);
+static const int kBenchFingerCounts[] = {1, 5, 10, 20}; // 20: tablet with more slots than a phone
+static const int kNumBenchFingerCounts = sizeof(kBenchFingerCounts) / sizeof(kBenchFingerCounts[0]);
+
+// Run fn in growing batches until it has taken at least gBenchMinSeconds; returns ns per iteration
+static double Bench_Run(BenchFn fn, void *ctx, uint64_t *outIterations) {
+    uint64_t batch = 16, total = 0, elapsed = 0;
+    fn(ctx, batch); // Warm up caches and branch predictors
+    while (elapsed < (uint64_t)(gBenchMinSeconds * 1e9)) {
+        uint64_t start = clock_ns(CLOCK_MONOTONIC);
+        fn(ctx, batch);
+        elapsed += clock_ns(CLOCK_MONOTONIC) - start;
+        total += batch;
+        if (batch < (1u << 20)) batch *= 2;
+    }
+    *outIterations = total;
+    return (double)elapsed / (double)total;
+}
+
+// Print one result row. eventsPerOp > 0 adds an evdev events/sec column.
+static void Bench_Report(const char *name, int numWidgets, double nsPerOp, int eventsPerOp) {
+    printf("%-36s %7d %11.1f %13.0f", name, numWidgets, nsPerOp, 1e9 / nsPerOp);
+    if (eventsPerOp > 0) printf(" %13.0f", eventsPerOp * 1e9 / nsPerOp);
+    printf("\n");
+}
+
+// --- Synthetic Layouts ---
+
+// numWidgets widgets cycling through all types, on a non-overlapping grid
+static void Bench_SetupLayout(int numWidgets) {
+    ResetTouchState();
+    InputState_Reset();
+    gNumWidgets = 0;
+    gAppState = APP_STATE_RUNNING;
+
+    int cols = (int)ceilf(sqrtf((float)numWidgets));
+    float cell = 1.0f / cols;
+    for (int i = 0; i < numWidgets; ++i) {
+        Vec2 center = {(i % cols + 0.5f) * cell, (i / cols + 0.5f) * cell};
+        CreateWidget((WidgetType)(i % WIDGET_MAX), center, cell * 0.2f);
+    }
+}
+
+// numWidgets widgets stacked on MAX_MT_SLOTS spots, each held by the contact on its spot:
+// every joystick deflected, every dpad pointing and every button pressed
+static void Bench_SetupLiveLayout(int numWidgets) {
+    Bench_SetupLayout(0);
+    const int cols = 8;
+    float cell = 1.0f / cols;
+    for (int i = 0; i < numWidgets; ++i) {
+        int s = i % MAX_MT_SLOTS;
+        Vec2 center = {(s % cols + 0.5f) * cell, (s / cols + 0.5f) * cell};
+        CreateWidget((WidgetType)(i % WIDGET_MAX), center, cell * 0.2f);
+    }
+    for (int i = 0; i < numWidgets; ++i) {
+        int s = i % MAX_MT_SLOTS;
+        const Widget *w = &gWidgets[i];
+        if (i < MAX_MT_SLOTS) {
+            mt_slots[s].active = true;
+            mt_slots[s].x = w->absCenter.x + w->absRadius * 0.5f;
+            mt_slots[s].y = w->absCenter.y;
+        }
+        Widget_SetFinger(i, s);
+    }
+}
+
+// --- Synthetic evdev Frames ---
+
+#define MAX_FRAME_EVENTS (MAX_MT_SLOTS * 4 + 1)
+
+typedef struct {
+    struct input_event ev[MAX_FRAME_EVENTS];
+    int count;
+} EvdevFrame;
+
+static void Frame_Push(EvdevFrame *f, int type, int code, int value) {
+    f->ev[f->count++] = (struct input_event){.type = type, .code = code, .value = value};
+}
+
+// One frame with `fingers` contacts circling the centers of the first widgets.
+// down/up add ABS_MT_TRACKING_ID events; phase moves the contacts between frames.
+static void Frame_Build(EvdevFrame *f, int fingers, bool down, bool up, float phase) {
+    f->count = 0;
+    for (int s = 0; s < fingers; ++s) {
+        const Widget *w = &gWidgets[s % gNumWidgets];
+        float r = w->absRadius * 0.8f;
+        Frame_Push(f, EV_ABS, ABS_MT_SLOT, s);
+        if (down) Frame_Push(f, EV_ABS, ABS_MT_TRACKING_ID, s);
+        if (up) {
+            Frame_Push(f, EV_ABS, ABS_MT_TRACKING_ID, -1);
+            continue;
+        }
+        Frame_Push(f, EV_ABS, ABS_MT_POSITION_X, (int)(w->absCenter.x + cosf(phase + s) * r));
+        Frame_Push(f, EV_ABS, ABS_MT_POSITION_Y, (int)(w->absCenter.y + sinf(phase + s) * r));
+    }
+    Frame_Push(f, EV_SYN, SYN_REPORT, 0);
+}
+
+static void Frame_Feed(const EvdevFrame *f) {
+    for (int i = 0; i < f->count; ++i) handle_evdev_event(&f->ev[i]);
+}
+
+// --- Benchmarked Operations ---
+
+#define NUM_MOVE_FRAMES 64
+
+typedef struct {
+    EvdevFrame moves[NUM_MOVE_FRAMES];
+    EvdevFrame down, up;
+    int fingers;
+} EvdevCtx;
+
+static void Bench_EvdevMove(void *ctx, uint64_t n) {
+    EvdevCtx *c = ctx;
+    for (uint64_t i = 0; i < n; ++i) Frame_Feed(&c->moves[i % NUM_MOVE_FRAMES]);
+}
+
+// Same frames through everything the main loop runs per wakeup, minus rendering
+static void Bench_Pipeline(void *ctx, uint64_t n) {
+    EvdevCtx *c = ctx;
+    for (uint64_t i = 0; i < n; ++i) {
+        Frame_Feed(&c->moves[i % NUM_MOVE_FRAMES]);
+        ProcessAllWidgetsInput();
+        InputState_Update();
+        InputState_Flush();
+    }
+}
+
+// Alternating touch-down and lift-off frames: hit-testing, slot mode changes, widget release
+static void Bench_EvdevTap(void *ctx, uint64_t n) {
+    EvdevCtx *c = ctx;
+    for (uint64_t i = 0; i < n; ++i) {
+        Frame_Feed((i & 1) ? &c->up : &c->down);
+        ProcessAllWidgetsInput();
+        InputState_Update();
+        InputState_Flush();
+    }
+}
+
+#define NUM_HIT_POINTS 1024
+
+typedef struct {
+    Vec2 points[NUM_HIT_POINTS];
+} HitCtx;
+
+// The touch-down scan in handle_evdev_event: first widget containing the point
+static void Bench_HitTest(void *ctx, uint64_t n) {
+    HitCtx *c = ctx;
+    int hits = 0;
+    for (uint64_t i = 0; i < n; ++i) {
+        Vec2 p = c->points[i % NUM_HIT_POINTS];
+        for (int w = 0; w < gNumWidgets; ++w) {
+            if (Widget_IsInside(&gWidgets[w], p)) { hits++; break; }
+        }
+    }
+    gBenchSink = (float)hits;
+}
+
+typedef struct {
+    WidgetType type;
+    bool toggle; // Move the finger across the widget edge every call
+} ProcessCtx;
+
+// Every widget of one type driven by slot 0; ns/op is per process call
+static void Bench_Process(void *ctx, uint64_t n) {
+    ProcessCtx *c = ctx;
+    for (uint64_t i = 0; i < n; ++i) {
+        for (int w = 0; w < gNumWidgets; ++w) {
+            Widget *wd = &gWidgets[w];
+            if (wd->type != c->type) continue;
+            bool outside = c->toggle && (i & 1);
+            mt_slots[0].x = wd->absCenter.x + (outside ? wd->absRadius * 2.0f : wd->absRadius * 0.5f);
+            mt_slots[0].y = wd->absCenter.y;
+            Widget_SetFinger(w, 0);
+            Widget_Process(w);
+        }
+        InputState_DiscardEvents();
+    }
+}
+
+// Every widget, as after a resize or leaving edit mode, with the contacts already set up
+static void Bench_FullPass(void *ctx, uint64_t n) {
+    for (uint64_t i = 0; i < n; ++i) {
+        gProcessAllWidgets = true;
+        ProcessAllWidgetsInput();
+        InputState_DiscardEvents();
+    }
+}
+
+static int Bench_CountType(WidgetType type) {
+    int n = 0;
+    for (int w = 0; w < gNumWidgets; ++w) n += (gWidgets[w].type == type);
+    return n;
+}
+
+// Analog outputs flip direction every call (toggle) or stay put
+static void Bench_InputStateUpdate(void *ctx, uint64_t n) {
+    bool toggle = *(bool *)ctx;
+    for (uint64_t i = 0; i < n; ++i) {
+        float v = (toggle && (i & 1)) ? -1.0f : 1.0f;
+        for (int w = 0; w < gNumWidgets; ++w) {
+            gWidgets[w].controllingFinger = 0;
+            gWidgets[w].outputValue = (Vec2){v, 0.0f};
+        }
+        InputState_Update();
+        InputState_DiscardEvents();
+    }
+}
+
+static void Bench_GridLayout(void *ctx, uint64_t n) {
+    GridLayout layout;
+    for (uint64_t i = 0; i < n; ++i) {
+        CalculateGridLayout(BENCH_SCREEN_W - (int)(i & 63), BENCH_SCREEN_H, kKeyPages[KEY_PAGE_MAIN].numKeys,
+                            kKeyGridCols, kKeyButtonSize, kKeyButtonSpacing, 86.0f, &layout);
+        gBenchSink = layout.cellSize;
+    }
+}
+
+// --- Software Rasterizer ---
+
+// What joystick_draw, dpad_draw and button_draw issue, through the Sw_ primitives
+static void Bench_SwDrawWidget(SwCanvas *c, const Widget *w) {
+    Color idle = {200, 200, 200, 127}, white = {255, 255, 255, 127};
+    Vec2 p = w->absCenter;
+    float r = w->absRadius;
+    switch (w->type) {
+        case WIDGET_JOYSTICK:
+            Sw_DrawCircle(c, p.x, p.y, r, kOutlineThickness, idle);
+            Sw_DrawFilledCircle(c, p.x + w->outputValue.x * r, p.y + w->outputValue.y * r, r * 0.3f, white);
+            break;
+        case WIDGET_DPAD:
+            for (int d = 0; d < 4; ++d) {
+                float sx = (d == 2) ? -1.0f : (d == 3) ? 1.0f : 0.0f, sy = (d == 0) ? -1.0f : (d == 1) ? 1.0f : 0.0f;
+                float a = r * 0.667f;
+                Vec2 tip = {p.x + sx * r, p.y + sy * r};
+                Vec2 base = {tip.x - sx * a, tip.y - sy * a};
+                Sw_DrawTriangle(c, tip, (Vec2){base.x - sy * a * 0.5f, base.y - sx * a * 0.5f},
+                                (Vec2){base.x + sy * a * 0.5f, base.y + sx * a * 0.5f}, idle, kOutlineThickness);
+            }
+            break;
+        default:
+            Sw_DrawOutlinedRect(c, w->absTopLeft.x, w->absTopLeft.y, w->absSize, w->absSize, kOutlineThickness, idle);
+            Sw_RenderText(c, "A", p.x - 3.0f * r * 0.2f, p.y - 4.0f * r * 0.2f, r * 0.2f, white);
+            break;
+    }
+}
+
+typedef struct {
+    SwCanvas canvas;
+    DamageRect clip; // Whole screen, or one joystick's draw bounds
+} SwCtx;
+
+static void Bench_SwFrame(void *ctx, uint64_t n) {
+    SwCtx *s = ctx;
+    for (uint64_t i = 0; i < n; ++i) {
+        Sw_SetClip(&s->canvas, s->clip);
+        Sw_Clear(&s->canvas);
+        for (int w = 0; w < gNumWidgets; ++w) {
+            DamageRect b = {gWidgets[w].absCenter.x - gWidgets[w].absRadius * 1.3f - 4.0f,
+                            gWidgets[w].absCenter.y - gWidgets[w].absRadius * 1.3f - 4.0f,
+                            gWidgets[w].absCenter.x + gWidgets[w].absRadius * 1.3f + 4.0f,
+                            gWidgets[w].absCenter.y + gWidgets[w].absRadius * 1.3f + 4.0f};
+            if (b.x0 < s->clip.x1 && s->clip.x0 < b.x1 && b.y0 < s->clip.y1 && s->clip.y0 < b.y1) {
+                Bench_SwDrawWidget(&s->canvas, &gWidgets[w]);
+            }
+        }
+        gWidgets[0].outputValue.x = (i & 1) ? 0.5f : -0.5f;
+    }
+    gBenchSink = (float)s->canvas.pixels[0];
+}
+
+// Full-screen software frame, and the partial repaint of one moving joystick
+static void Bench_SwCases(int numWidgets) {
+    static uint32_t pixels[BENCH_SCREEN_W * BENCH_SCREEN_H];
+    static SwCtx ctx;
+    uint64_t iters;
+    Bench_SetupLayout(numWidgets);
+    ctx.canvas = (SwCanvas){.pixels = pixels, .width = BENCH_SCREEN_W, .height = BENCH_SCREEN_H, .stride = BENCH_SCREEN_W, .scale = 1.0f};
+    ctx.clip = (DamageRect){0, 0, BENCH_SCREEN_W, BENCH_SCREEN_H};
+    Bench_Report("Sw full frame", numWidgets, Bench_Run(Bench_SwFrame, &ctx, &iters), 0);
+    SwCanvas full = ctx.canvas;
+    ctx.canvas = (SwCanvas){.pixels = pixels, .width = BENCH_SCREEN_W / 2, .height = BENCH_SCREEN_H / 2, .stride = BENCH_SCREEN_W / 2, .scale = 0.5f};
+    Bench_Report("Sw full frame, render scale 0.5", numWidgets, Bench_Run(Bench_SwFrame, &ctx, &iters), 0);
+    ctx.canvas = full;
+    const Widget *j = &gWidgets[0]; // WIDGET_JOYSTICK, see Bench_SetupLayout
+    float r = j->absRadius * 1.3f + 4.0f;
+    ctx.clip = (DamageRect){j->absCenter.x - r, j->absCenter.y - r, j->absCenter.x + r, j->absCenter.y + r};
+    Bench_Report("Sw joystick damage repaint", numWidgets, Bench_Run(Bench_SwFrame, &ctx, &iters), 0);
+}
+
+// --- Driver ---
+
+static void Bench_EvdevCases(int numWidgets) {
+    static EvdevCtx ctx;
+    for (int f = 0; f < kNumBenchFingerCounts; ++f) {
+        int fingers = kBenchFingerCounts[f];
+        char name[64];
+        uint64_t iters;
+
+        gNumTouchSlots = MAX(fingers, DEFAULT_MT_SLOTS); // As read from ABS_MT_SLOT
+        Bench_SetupLayout(numWidgets);
+        ctx.fingers = fingers;
+        Frame_Build(&ctx.down, fingers, true, false, 0.0f);
+        Frame_Build(&ctx.up, fingers, false, true, 0.0f);
+        for (int i = 0; i < NUM_MOVE_FRAMES; ++i) {
+            Frame_Build(&ctx.moves[i], fingers, false, false, i * (2.0f * M_PI / NUM_MOVE_FRAMES));
+        }
+
+        Frame_Feed(&ctx.down); // Fingers stay down on their widgets for the move cases
+        snprintf(name, sizeof(name), "handle_evdev_event %d finger move", fingers);
+        Bench_Report(name, numWidgets, Bench_Run(Bench_EvdevMove, &ctx, &iters), ctx.moves[0].count);
+        snprintf(name, sizeof(name), "pipeline %d finger move", fingers);
+        Bench_Report(name, numWidgets, Bench_Run(Bench_Pipeline, &ctx, &iters), ctx.moves[0].count);
+        Frame_Feed(&ctx.up);
+
+        snprintf(name, sizeof(name), "pipeline %d finger down/up", fingers);
+        double ns = Bench_Run(Bench_EvdevTap, &ctx, &iters);
+        Bench_Report(name, numWidgets, ns, (ctx.down.count + ctx.up.count) / 2);
+    }
+}
+
+int main(int argc, char **argv) {
+    bool verbose = false;
+    uint64_t iters;
+    int opt;
+    while ((opt = getopt(argc, argv, "vt:")) != -1) {
+        switch (opt) {
+            case 'v': verbose = true; break;
+            case 't': gBenchMinSeconds = atof(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-v] [-t seconds_per_case]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    width = BENCH_SCREEN_W;
+    height = BENCH_SCREEN_H;
+    touch_min_x = 0; touch_max_x = BENCH_SCREEN_W;
+    touch_min_y = 0; touch_max_y = BENCH_SCREEN_H;
+    uinput_fd = open("/dev/null", O_WRONLY);
+    if (!verbose) {
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull >= 0) dup2(devnull, STDERR_FILENO);
+    }
+    if (Log_Start()) atexit(Log_Stop);
+
+    printf("%-36s %7s %11s %13s %13s\n", "benchmark", "widgets", "ns/op", "ops/s", "events/s");
+    for (int wc = 0; wc < kNumBenchWidgetCounts; ++wc) {
+        int numWidgets = kBenchWidgetCounts[wc];
+
+        Bench_EvdevCases(numWidgets);
+
+        Bench_SetupLayout(numWidgets);
+        static HitCtx hit;
+        srand(1);
+        for (int i = 0; i < NUM_HIT_POINTS; ++i) {
+            hit.points[i] = (Vec2){(float)(rand() % BENCH_SCREEN_W), (float)(rand() % BENCH_SCREEN_H)};
+        }
+        Bench_Report("Widget_IsInside hit-test scan", numWidgets, Bench_Run(Bench_HitTest, &hit, &iters), 0);
+
+        mt_slots[0].active = true;
+        mt_slots[0].x = gWidgets[0].absCenter.x;
+        mt_slots[0].y = gWidgets[0].absCenter.y;
+        Widget_SetFinger(0, 0);
+        Bench_Report("ProcessAllWidgetsInput 1 held", numWidgets, Bench_Run(Bench_FullPass, NULL, &iters), 0);
+        for (int t = 0; t < WIDGET_MAX; ++t) {
+            for (int toggle = 0; toggle < 2; ++toggle) {
+                ProcessCtx pc = {(WidgetType)t, toggle};
+                char name[64];
+                snprintf(name, sizeof(name), "%s_process%s", kWidgetTypeNames[t], toggle ? " enter/leave" : "");
+                double ns = Bench_Run(Bench_Process, &pc, &iters) / MAX(1, Bench_CountType((WidgetType)t));
+                Bench_Report(name, numWidgets, ns, 0);
+            }
+        }
+
+        Bench_SetupLiveLayout(numWidgets);
+        Bench_Report("ProcessAllWidgetsInput all held", numWidgets, Bench_Run(Bench_FullPass, NULL, &iters), 0);
+        for (int s = 0; s < MAX_MT_SLOTS; ++s) mt_slots[s].active = false;
+
+        for (int toggle = 0; toggle < 2; ++toggle) {
+            bool tg = toggle;
+            Bench_SetupLayout(numWidgets);
+            mt_slots[0].active = true;
+            Bench_Report(toggle ? "InputState_Update changing" : "InputState_Update steady", numWidgets,
+                         Bench_Run(Bench_InputStateUpdate, &tg, &iters), 0);
+        }
+        mt_slots[0].active = false;
+
+        Bench_SwCases(numWidgets);
+    }
+    Bench_Report("CalculateGridLayout", kKeyPages[KEY_PAGE_MAIN].numKeys, Bench_Run(Bench_GridLayout, NULL, &iters), 0);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,708 @@
+// Synthetic multi-touch load generator: make loadgen
+//
+// Produces realistic evdev streams (up to 64 simultaneous contacts at 240/480 Hz: joystick
+// circles, button mashing, edit-mode drags) and either
+//   - feeds them to the headless input pipeline of main.c (default), modelling the kernel
+//     evdev client buffer and a per-wakeup render/swap cost, or
+//   - writes them to a virtual uinput touchscreen (--uinput) that a live daemon reads when
+//     started with --touch /dev/input/eventN; results come from its control socket.
+// Reports dropped SYN_REPORTs, SYN_DROPPED, event queue behaviour and output latency.
+//
+// Usage: bench/loadgen [options], see usage() below.
+
+#define WLR_GAMEPAD_HEADLESS
+#include "../main.c"
+#include <limits.h>
+
+#define LOADGEN_SCREEN_W 1080
+#define LOADGEN_SCREEN_H 2340
+#define LOADGEN_DEV_MAX 4095     // Virtual touchscreen axis range 0..LOADGEN_DEV_MAX
+#define LOADGEN_MAX_TARGETS 512
+
+// --- Scenario Model ---
+
+typedef enum {
+    ROLE_JOYSTICK, // Stays down, circling a joystick/dpad
+    ROLE_MASH,     // Rapid taps on a button
+    ROLE_DRAG      // Edit mode: select a widget, drag it around in a circle, release
+} ContactRole;
+
+typedef struct {
+    WidgetType type;
+    Vec2 center;     // Normalized
+    Vec2 radius;     // Normalized per axis (widgets are square in pixels)
+} Target;
+
+typedef struct {
+    ContactRole role;
+    const Target *target;
+    bool down;
+    bool emittedDown;
+    int trackingId;
+    float orbit;          // Circle radius as a fraction of the target radius
+    float phase, speed;   // Radians, radians per second
+    double nextToggle;    // Mash/drag: time of the next down/up transition
+    int dragStep;         // Drag: 0 tap edit button, 1 drag widget
+    int x, y;             // Device coordinates
+    int emittedX, emittedY;
+} Contact;
+
+typedef struct {
+    const char *scenario;
+    int contacts;
+    int rate;
+    double duration;
+    int renderUs;
+    int evdevBuffer;
+    bool flood;
+    bool live;
+    int waitSec;
+    const char *profile;
+    const char *socketPath;
+} LoadgenOptions;
+
+static Target gTargets[LOADGEN_MAX_TARGETS];
+static int gNumTargets = 0;
+static Contact gContacts[MAX_MT_SLOTS];
+static int gNumContacts = 0;
+static int gNextTrackingId = 1;
+static int gScreenW = LOADGEN_SCREEN_W, gScreenH = LOADGEN_SCREEN_H;
+
+// Slots of the simulated touchscreen: a phone's 10, or more for a tablet with more contacts
+static int Loadgen_Slots(const LoadgenOptions *o) {
+    return MAX(o->contacts, DEFAULT_MT_SLOTS);
+}
+
+static double rand_range(double lo, double hi) {
+    return lo + (hi - lo) * (rand() / (double)RAND_MAX);
+}
+
+static void Target_Add(WidgetType type, Vec2 center, float normHalfSize) {
+    if (gNumTargets >= LOADGEN_MAX_TARGETS) return;
+    float minDim = (float)MIN(gScreenW, gScreenH);
+    gTargets[gNumTargets++] = (Target){
+        type, center, {normHalfSize * minDim / gScreenW, normHalfSize * minDim / gScreenH}
+    };
+}
+
+// Random target of one of the given types, or NULL
+static const Target *Target_Pick(bool analog) {
+    int candidates[LOADGEN_MAX_TARGETS], n = 0;
+    for (int i = 0; i < gNumTargets; ++i) {
+        bool isAnalog = gTargets[i].type != WIDGET_BUTTON;
+        if (isAnalog == analog) candidates[n++] = i;
+    }
+    return n ? &gTargets[candidates[rand() % n]] : NULL;
+}
+
+static void Contacts_Setup(const LoadgenOptions *o) {
+    bool drag = strcmp(o->scenario, "drag") == 0;
+    gNumContacts = drag ? 1 : o->contacts; // Edit mode is driven by a single finger
+    for (int i = 0; i < gNumContacts; ++i) {
+        Contact *c = &gContacts[i];
+        *c = (Contact){.emittedX = -1, .emittedY = -1};
+        if (drag) c->role = ROLE_DRAG;
+        else if (strcmp(o->scenario, "joystick") == 0) c->role = ROLE_JOYSTICK;
+        else if (strcmp(o->scenario, "mash") == 0) c->role = ROLE_MASH;
+        else c->role = (i < 2) ? ROLE_JOYSTICK : ROLE_MASH; // mixed: two thumbs on sticks, rest mashing
+        c->target = Target_Pick(c->role != ROLE_MASH);
+        c->orbit = (float)rand_range(0.3, 1.0);
+        c->phase = (float)rand_range(0.0, 2.0 * M_PI);
+        c->speed = (float)rand_range(2.0, 8.0);
+        c->nextToggle = rand_range(0.0, 0.05);
+    }
+}
+
+// Inverse of the axis mapping in handle_evdev_event
+static void Contact_SetPos(Contact *c, float nx, float ny) {
+    nx = clampf(nx, 0.0f, 1.0f);
+    ny = clampf(ny, 0.0f, 1.0f);
+    c->x = (int)((gLandscapeMode ? 1.0f - ny : nx) * LOADGEN_DEV_MAX);
+    c->y = (int)((gLandscapeMode ? nx : ny) * LOADGEN_DEV_MAX);
+}
+
+// Advance one contact to time t (seconds since start)
+static void Contact_Step(Contact *c, double t) {
+    Vec2 center = c->target ? c->target->center : (Vec2){0.5f, 0.5f};
+    Vec2 radius = c->target ? c->target->radius : (Vec2){0.1f, 0.05f};
+    switch (c->role) {
+        case ROLE_JOYSTICK:
+            c->down = true;
+            Contact_SetPos(c, center.x + cosf(c->phase + c->speed * t) * radius.x * c->orbit,
+                              center.y + sinf(c->phase + c->speed * t) * radius.y * c->orbit);
+            break;
+        case ROLE_MASH:
+            if (t >= c->nextToggle) {
+                c->down = !c->down;
+                c->nextToggle = t + (c->down ? rand_range(0.03, 0.12) : rand_range(0.02, 0.10));
+            }
+            // Fingers are never perfectly still: +-1 unit of sensor noise every frame
+            Contact_SetPos(c, center.x + radius.x * 0.3f, center.y);
+            c->x += rand() % 3 - 1;
+            c->y += rand() % 3 - 1;
+            break;
+        case ROLE_DRAG:
+            if (t >= c->nextToggle) {
+                c->down = !c->down;
+                if (!c->down) {
+                    c->dragStep = !c->dragStep;
+                    if (c->dragStep == 1) c->target = Target_Pick(rand() & 1) ? : Target_Pick(false);
+                }
+                c->nextToggle = t + (c->dragStep == 0 ? 0.05 : (c->down ? 1.0 : 0.1));
+            }
+            if (c->dragStep == 0) {
+                // Edit/cancel button toggles edit mode
+                Contact_SetPos(c, (kEditButtonX + kEditButtonW * 0.5f) / gScreenW,
+                                  (kEditButtonY + kEditButtonH * 0.5f) / gScreenH);
+            } else {
+                float r = c->down ? 0.1f : 0.0f;
+                Contact_SetPos(c, center.x + (cosf(c->speed * t) - 1.0f) * r, center.y + sinf(c->speed * t) * r);
+            }
+            break;
+    }
+}
+
+// --- evdev Frames ---
+
+#define MAX_FRAME_EVENTS (MAX_MT_SLOTS * 4 + 1)
+
+typedef struct {
+    struct input_event ev[MAX_FRAME_EVENTS];
+    int count;
+} EvdevFrame;
+
+static void Frame_Push(EvdevFrame *f, int type, int code, int value, uint64_t ts) {
+    struct input_event *ev = &f->ev[f->count++];
+    *ev = (struct input_event){.type = type, .code = code, .value = value};
+    ev->input_event_sec = ts / 1000000000ULL;
+    ev->input_event_usec = (ts % 1000000000ULL) / 1000;
+}
+
+// Next frame at time t; returns false if no contact changed (devices don't send empty frames)
+static bool Frame_Generate(EvdevFrame *f, double t, uint64_t ts) {
+    f->count = 0;
+    for (int s = 0; s < gNumContacts; ++s) {
+        Contact *c = &gContacts[s];
+        Contact_Step(c, t);
+        bool changed = c->down != c->emittedDown || (c->down && (c->x != c->emittedX || c->y != c->emittedY));
+        if (!changed) continue;
+        Frame_Push(f, EV_ABS, ABS_MT_SLOT, s, ts);
+        if (c->down != c->emittedDown) {
+            if (c->down) c->trackingId = gNextTrackingId++ & 0xffff;
+            Frame_Push(f, EV_ABS, ABS_MT_TRACKING_ID, c->down ? c->trackingId : -1, ts);
+        }
+        if (c->down) {
+            Frame_Push(f, EV_ABS, ABS_MT_POSITION_X, c->x, ts);
+            Frame_Push(f, EV_ABS, ABS_MT_POSITION_Y, c->y, ts);
+        }
+        c->emittedDown = c->down;
+        c->emittedX = c->x;
+        c->emittedY = c->y;
+    }
+    if (f->count == 0) return false;
+    Frame_Push(f, EV_SYN, SYN_REPORT, 0, ts);
+    return true;
+}
+
+// Lift every contact that is still down
+static bool Frame_ReleaseAll(EvdevFrame *f, uint64_t ts) {
+    f->count = 0;
+    for (int s = 0; s < gNumContacts; ++s) {
+        if (!gContacts[s].emittedDown) continue;
+        Frame_Push(f, EV_ABS, ABS_MT_SLOT, s, ts);
+        Frame_Push(f, EV_ABS, ABS_MT_TRACKING_ID, -1, ts);
+        gContacts[s].emittedDown = gContacts[s].down = false;
+    }
+    if (f->count == 0) return false;
+    Frame_Push(f, EV_SYN, SYN_REPORT, 0, ts);
+    return true;
+}
+
+// --- Results ---
+
+// Distance between a joystick's dot and the modelled contact, pixels
+typedef struct {
+    double sum, max;
+    uint64_t samples;
+} DotError;
+
+typedef struct {
+    uint64_t framesGenerated;
+    uint64_t eventsGenerated;
+    uint64_t *latencies; // Per processed frame, ns
+    uint64_t numLatencies;
+    uint64_t capLatencies;
+    uint64_t maxSendLagNs; // Live: how far the sender fell behind its schedule
+    double elapsed;
+    uint64_t startNs;      // Headless: time 0 of the contact model
+    DotError dotFresh, dotStale; // Headless: joystick dots as produced, and just before replaced
+} LoadgenResult;
+
+static void Result_AddLatency(LoadgenResult *r, uint64_t ns) {
+    if (r->numLatencies < r->capLatencies) r->latencies[r->numLatencies++] = ns;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void Result_PrintLatency(const char *label, LoadgenResult *r) {
+    if (r->numLatencies == 0) {
+        printf("%s: no samples\n", label);
+        return;
+    }
+    qsort(r->latencies, r->numLatencies, sizeof(uint64_t), cmp_u64);
+    uint64_t n = r->numLatencies;
+    printf("%s: p50 %.1fus, p90 %.1fus, p99 %.1fus, max %.1fus (%llu frames)\n", label,
+           r->latencies[n / 2] / 1e3, r->latencies[n * 9 / 10] / 1e3, r->latencies[n * 99 / 100] / 1e3,
+           r->latencies[n - 1] / 1e3, (unsigned long long)n);
+}
+
+// --- Headless Pipeline ---
+// The kernel side is modelled as an evdev client buffer of evdevBuffer events. Like
+// evdev's __pass_event, an overflow discards everything queued and leaves SYN_DROPPED
+// followed by the newest event. The daemon side drains the buffer per wakeup, runs the
+// same calls as the main loop, then spends renderUs in "RenderFrame/eglSwapBuffers".
+
+typedef struct {
+    struct input_event *ev;
+    uint64_t *sched; // Scheduled time for SYN_REPORT entries, 0 otherwise
+    int cap, head, tail; // cap is a power of two
+} EvdevBuffer;
+
+static int EvdevBuffer_Count(const EvdevBuffer *b) { return (b->head - b->tail) & (b->cap - 1); }
+
+static void EvdevBuffer_Pass(EvdevBuffer *b, const struct input_event *ev, uint64_t sched) {
+    b->ev[b->head] = *ev;
+    b->sched[b->head] = (ev->type == EV_SYN && ev->code == SYN_REPORT) ? sched : 0;
+    b->head = (b->head + 1) & (b->cap - 1);
+    if (b->head == b->tail) {
+        // Buffer full: drop all but the newest event and report SYN_DROPPED
+        b->tail = (b->head - 2) & (b->cap - 1);
+        b->ev[b->tail] = (struct input_event){.type = EV_SYN, .code = SYN_DROPPED};
+        b->sched[b->tail] = 0;
+    }
+}
+
+// Where each joystick's dot is drawn against where its contact really is at time now.
+// Sampled when an output is produced and again just before the next batch replaces it,
+// when a lagging dot is furthest behind.
+static void Headless_MeasureDots(DotError *e, const LoadgenResult *r, uint64_t now) {
+    double t = (now - r->startNs) / 1e9;
+    for (int s = 0; s < gNumContacts; ++s) {
+        const Contact *c = &gContacts[s];
+        if (c->role != ROLE_JOYSTICK || !c->target || !mt_slots[s].active) continue;
+        int i = mt_slots[s].widgetIndex;
+        if (i < 0 || gWidgets[i].type != WIDGET_JOYSTICK || gWidgets[i].controllingFinger != s) continue;
+        const Widget *w = &gWidgets[i];
+        float x = (c->target->center.x + cosf(c->phase + c->speed * t) * c->target->radius.x * c->orbit) * width;
+        float y = (c->target->center.y + sinf(c->phase + c->speed * t) * c->target->radius.y * c->orbit) * height;
+        double err = dist((Vec2){x, y}, (Vec2){w->absCenter.x + w->outputValue.x * w->absRadius,
+                                               w->absCenter.y + w->outputValue.y * w->absRadius});
+        e->sum += err;
+        if (err > e->max) e->max = err;
+        e->samples++;
+    }
+}
+
+static void Headless_Drain(EvdevBuffer *b, LoadgenResult *r) {
+    uint64_t pendingSched[1024];
+    int numPending = 0;
+    Headless_MeasureDots(&r->dotStale, r, clock_ns(CLOCK_MONOTONIC));
+    while (b->tail != b->head) {
+        const struct input_event *ev = &b->ev[b->tail];
+        PERF_INC(evdevEvents);
+        handle_evdev_event(ev);
+        if (b->sched[b->tail] && numPending < 1024) pendingSched[numPending++] = b->sched[b->tail];
+        b->tail = (b->tail + 1) & (b->cap - 1);
+    }
+    SlotHistory_BeginBatch();
+    ProcessAllWidgetsInput();
+    InputState_Update();
+    InputState_Flush();
+    gPendingTouchNs = 0;
+    uint64_t done = clock_ns(CLOCK_MONOTONIC);
+    for (int i = 0; i < numPending; ++i) Result_AddLatency(r, done - pendingSched[i]);
+    Headless_MeasureDots(&r->dotFresh, r, done);
+}
+
+static void sleep_until(uint64_t ns) {
+    struct timespec ts = {ns / 1000000000ULL, ns % 1000000000ULL};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+}
+
+static void Headless_Run(const LoadgenOptions *o, LoadgenResult *r) {
+    int cap = 64;
+    while (cap < o->evdevBuffer) cap *= 2;
+    EvdevBuffer buf = {malloc(cap * sizeof(struct input_event)), malloc(cap * sizeof(uint64_t)), cap, 0, 0};
+    uint64_t total = (uint64_t)(o->duration * o->rate);
+    uint64_t period = 1000000000ULL / o->rate;
+    uint64_t start = clock_ns(CLOCK_MONOTONIC);
+    EvdevFrame f;
+    r->startNs = start;
+    gNumTouchSlots = Loadgen_Slots(o); // What init_touch_device reads from ABS_MT_SLOT
+
+    for (uint64_t k = 0; k < total; ) {
+        uint64_t sched = start + k * period;
+        if (o->flood) {
+            // Throughput ceiling: one frame per wakeup, back to back
+            if (Frame_Generate(&f, (double)k / o->rate, sched)) {
+                r->framesGenerated++;
+                r->eventsGenerated += f.count;
+                for (int i = 0; i < f.count; ++i) EvdevBuffer_Pass(&buf, &f.ev[i], clock_ns(CLOCK_MONOTONIC));
+                Headless_Drain(&buf, r);
+            }
+            k++;
+            continue;
+        }
+        uint64_t now = clock_ns(CLOCK_MONOTONIC);
+        if (sched > now && EvdevBuffer_Count(&buf) == 0) {
+            sleep_until(sched); // Idle in poll() until the touchscreen reports
+            continue;
+        }
+        // Everything the touchscreen produced while we were busy lands in the kernel buffer
+        for (; k < total && start + k * period <= now; ++k) {
+            uint64_t ts = start + k * period;
+            if (!Frame_Generate(&f, (double)k / o->rate, ts)) continue;
+            r->framesGenerated++;
+            r->eventsGenerated += f.count;
+            for (int i = 0; i < f.count; ++i) EvdevBuffer_Pass(&buf, &f.ev[i], ts);
+        }
+        Headless_Drain(&buf, r);
+        if (o->renderUs > 0) sleep_until(clock_ns(CLOCK_MONOTONIC) + o->renderUs * 1000ULL);
+    }
+    if (Frame_ReleaseAll(&f, clock_ns(CLOCK_MONOTONIC))) {
+        r->framesGenerated++;
+        r->eventsGenerated += f.count;
+        for (int i = 0; i < f.count; ++i) EvdevBuffer_Pass(&buf, &f.ev[i], clock_ns(CLOCK_MONOTONIC));
+        Headless_Drain(&buf, r);
+    }
+    r->elapsed = (clock_ns(CLOCK_MONOTONIC) - start) / 1e9;
+    free(buf.ev);
+    free(buf.sched);
+}
+
+// --- Live Daemon over uinput ---
+
+static int Live_CreateTouchscreen(char *eventPath, size_t len, int slots) {
+    int fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+    if (fd < 0) { perror("open /dev/uinput"); return -1; }
+
+    ioctl(fd, UI_SET_EVBIT, EV_SYN);
+    ioctl(fd, UI_SET_EVBIT, EV_KEY);
+    ioctl(fd, UI_SET_KEYBIT, BTN_TOUCH);
+    ioctl(fd, UI_SET_EVBIT, EV_ABS);
+    ioctl(fd, UI_SET_PROPBIT, INPUT_PROP_DIRECT);
+    const int axes[] = {ABS_MT_SLOT, ABS_MT_TRACKING_ID, ABS_MT_POSITION_X, ABS_MT_POSITION_Y};
+    for (size_t i = 0; i < sizeof(axes) / sizeof(axes[0]); ++i) ioctl(fd, UI_SET_ABSBIT, axes[i]);
+
+    struct uinput_user_dev uidev;
+    memset(&uidev, 0, sizeof(uidev));
+    snprintf(uidev.name, UINPUT_MAX_NAME_SIZE, "wlr_gamepad_loadgen");
+    uidev.id.bustype = BUS_VIRTUAL;
+    uidev.id.vendor = 0x1234;
+    uidev.id.product = 0x5679;
+    uidev.absmax[ABS_MT_SLOT] = slots - 1;
+    uidev.absmax[ABS_MT_TRACKING_ID] = 0xffff;
+    uidev.absmax[ABS_MT_POSITION_X] = LOADGEN_DEV_MAX;
+    uidev.absmax[ABS_MT_POSITION_Y] = LOADGEN_DEV_MAX;
+    if (write(fd, &uidev, sizeof(uidev)) < 0 || ioctl(fd, UI_DEV_CREATE) < 0) {
+        perror("create virtual touchscreen");
+        close(fd);
+        return -1;
+    }
+
+    char sysname[64];
+    eventPath[0] = '\0';
+    if (ioctl(fd, UI_GET_SYSNAME(sizeof(sysname)), sysname) >= 0) {
+        char dir[128];
+        snprintf(dir, sizeof(dir), "/sys/devices/virtual/input/%s", sysname);
+        for (int i = 0; i < 64 && !eventPath[0]; ++i) {
+            char probe[192];
+            snprintf(probe, sizeof(probe), "%s/event%d", dir, i);
+            if (access(probe, F_OK) == 0) snprintf(eventPath, len, "/dev/input/event%d", i);
+        }
+    }
+    return fd;
+}
+
+// Send a command and collect its reply up to the final "ok"/"error" line
+static bool Live_Query(int fd, const char *cmd, char *reply, size_t len) {
+    if (write(fd, cmd, strlen(cmd)) < 0) return false;
+    size_t off = 0;
+    reply[0] = '\0';
+    while (off + 1 < len) {
+        ssize_t n = read(fd, reply + off, len - off - 1);
+        if (n <= 0) return false;
+        off += (size_t)n;
+        reply[off] = '\0';
+        char *last = reply + off - 1;
+        if (*last != '\n') continue;
+        char *lineStart = last;
+        while (lineStart > reply && lineStart[-1] != '\n') lineStart--;
+        if (strncmp(lineStart, "ok", 2) == 0) return true;
+        if (strncmp(lineStart, "error", 5) == 0) { fprintf(stderr, "%s -> %s", cmd, lineStart); return false; }
+    }
+    return false;
+}
+
+static uint64_t Live_Counter(const char *reply, const char *name) {
+    const char *p = strstr(reply, name);
+    return p ? strtoull(p + strlen(name), NULL, 10) : 0;
+}
+
+static int Live_Connect(const char *path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror(path);
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Mirror the daemon's layout as targets
+static void Live_LoadTargets(int ctl) {
+    static char reply[CONTROL_OUT_SIZE];
+    if (Live_Query(ctl, "status\n", reply, sizeof(reply))) {
+        const char *size = strstr(reply, "size ");
+        if (size) sscanf(size, "size %d %d", &gScreenW, &gScreenH);
+        gLandscapeMode = strstr(reply, "orientation landscape") != NULL;
+    }
+    if (!Live_Query(ctl, "widgets\n", reply, sizeof(reply))) return;
+    char *save = NULL;
+    for (char *line = strtok_r(reply, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        int id;
+        char type[32];
+        Vec2 c;
+        float hs;
+        if (sscanf(line, "%d %31s %f %f %f", &id, type, &c.x, &c.y, &hs) != 5) continue;
+        for (int t = 0; t < WIDGET_MAX; ++t) {
+            if (strcmp(type, kWidgetTypeNames[t]) == 0) Target_Add((WidgetType)t, c, hs);
+        }
+    }
+}
+
+static int Live_Run(const LoadgenOptions *o, LoadgenResult *r, char *before, char *after, size_t len) {
+    char eventPath[64];
+    int dev = Live_CreateTouchscreen(eventPath, sizeof(eventPath), Loadgen_Slots(o));
+    if (dev < 0) return -1;
+    printf("virtual touchscreen %s: start the daemon with --touch %s\n", eventPath, eventPath);
+    printf("starting in %d s...\n", o->waitSec);
+    fflush(stdout);
+    sleep(o->waitSec);
+
+    int ctl = Live_Connect(o->socketPath);
+    if (ctl < 0) { close(dev); return -1; }
+    if (o->profile) {
+        char cmd[PATH_MAX + 16], abs[PATH_MAX];
+        snprintf(cmd, sizeof(cmd), "load %s\n", realpath(o->profile, abs) ? abs : o->profile);
+        if (!Live_Query(ctl, cmd, before, len)) { close(ctl); close(dev); return -1; }
+    }
+    Live_LoadTargets(ctl);
+    Contacts_Setup(o);
+    Live_Query(ctl, "counters\n", before, len);
+
+    uint64_t total = (uint64_t)(o->duration * o->rate);
+    uint64_t period = 1000000000ULL / o->rate;
+    uint64_t start = clock_ns(CLOCK_MONOTONIC);
+    EvdevFrame f;
+    for (uint64_t k = 0; k < total; ++k) {
+        uint64_t sched = start + k * period;
+        sleep_until(sched);
+        uint64_t lag = clock_ns(CLOCK_MONOTONIC) - sched;
+        if (lag > r->maxSendLagNs) r->maxSendLagNs = lag;
+        if (!Frame_Generate(&f, (double)k / o->rate, sched)) continue;
+        // One write per frame, like a touchscreen driver reporting a whole packet
+        if (write(dev, f.ev, f.count * sizeof(struct input_event)) < 0) perror("write uinput");
+        r->framesGenerated++;
+        r->eventsGenerated += f.count;
+    }
+    if (Frame_ReleaseAll(&f, 0)) {
+        if (write(dev, f.ev, f.count * sizeof(struct input_event)) < 0) perror("write uinput");
+        r->framesGenerated++;
+        r->eventsGenerated += f.count;
+    }
+    r->elapsed = (clock_ns(CLOCK_MONOTONIC) - start) / 1e9;
+
+    usleep(500 * 1000); // Let the daemon drain its queue before the final snapshot
+    Live_Query(ctl, "counters\n", after, len);
+    close(ctl);
+    ioctl(dev, UI_DEV_DESTROY);
+    close(dev);
+    return 0;
+}
+
+// --- Driver ---
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -s, --scenario NAME    mixed (default), joystick, mash or drag\n"
+            "  -c, --contacts N       simultaneous contacts, 1..%d (default %d)\n"
+            "  -r, --rate HZ          touch sampling rate (default 240)\n"
+            "  -d, --duration SEC     run time (default 10)\n"
+            "  -p, --profile PATH     widget layout (default: 2 joysticks, 1 dpad, 8 buttons)\n"
+            "  -v, --verbose          show the pipeline's debug output\n"
+            "headless pipeline (default):\n"
+            "  -R, --render-us US     simulated RenderFrame+eglSwapBuffers per wakeup (default 0)\n"
+            "  -b, --evdev-buffer N   kernel evdev client buffer in events (default 512)\n"
+            "  -f, --flood            ignore the rate, measure the throughput ceiling\n"
+            "  -P, --predict MS       joystick prediction horizon, as the daemon's --predict (default 0)\n"
+            "live daemon:\n"
+            "  -u, --uinput           feed a running daemon through a virtual touchscreen\n"
+            "  -S, --socket PATH      its control socket (default $XDG_RUNTIME_DIR/wlr_gamepad.sock)\n"
+            "  -w, --wait SEC         delay before sending, to start the daemon (default 3)\n",
+            argv0, MAX_MT_SLOTS, DEFAULT_MT_SLOTS);
+}
+
+static void Headless_DefaultLayout(void) {
+    CreateWidget(WIDGET_JOYSTICK, (Vec2){0.20f, 0.75f}, 0.12f);
+    CreateWidget(WIDGET_JOYSTICK, (Vec2){0.80f, 0.45f}, 0.10f);
+    CreateWidget(WIDGET_DPAD, (Vec2){0.20f, 0.45f}, 0.10f);
+    for (int i = 0; i < 8; ++i) {
+        CreateWidget(WIDGET_BUTTON, (Vec2){0.55f + (i % 4) * 0.12f, 0.70f + (i / 4) * 0.08f}, 0.05f);
+    }
+}
+
+int main(int argc, char **argv) {
+    char defaultSocket[108];
+    const char *runtimeDir = getenv("XDG_RUNTIME_DIR");
+    snprintf(defaultSocket, sizeof(defaultSocket), "%s/wlr_gamepad.sock", runtimeDir ? runtimeDir : "/tmp");
+    LoadgenOptions o = {
+        .scenario = "mixed", .contacts = DEFAULT_MT_SLOTS, .rate = 240, .duration = 10.0,
+        .evdevBuffer = 512, .waitSec = 3, .socketPath = defaultSocket,
+    };
+    bool verbose = false;
+
+    static const struct option longOptions[] = {
+        {"scenario",     required_argument, NULL, 's'},
+        {"contacts",     required_argument, NULL, 'c'},
+        {"rate",         required_argument, NULL, 'r'},
+        {"duration",     required_argument, NULL, 'd'},
+        {"profile",      required_argument, NULL, 'p'},
+        {"verbose",      no_argument,       NULL, 'v'},
+        {"render-us",    required_argument, NULL, 'R'},
+        {"evdev-buffer", required_argument, NULL, 'b'},
+        {"flood",        no_argument,       NULL, 'f'},
+        {"predict",      required_argument, NULL, 'P'},
+        {"uinput",       no_argument,       NULL, 'u'},
+        {"socket",       required_argument, NULL, 'S'},
+        {"wait",         required_argument, NULL, 'w'},
+        {"help",         no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "s:c:r:d:p:vR:b:fP:uS:w:h", longOptions, NULL)) != -1) {
+        switch (opt) {
+            case 's': o.scenario = optarg; break;
+            case 'c': o.contacts = atoi(optarg); break;
+            case 'r': o.rate = atoi(optarg); break;
+            case 'd': o.duration = atof(optarg); break;
+            case 'p': o.profile = optarg; break;
+            case 'v': verbose = true; break;
+            case 'R': o.renderUs = atoi(optarg); break;
+            case 'b': o.evdevBuffer = atoi(optarg); break;
+            case 'f': o.flood = true; break;
+            case 'P': gPredictNs = (uint64_t)atoi(optarg) * 1000000ULL; break;
+            case 'u': o.live = true; break;
+            case 'S': o.socketPath = optarg; break;
+            case 'w': o.waitSec = atoi(optarg); break;
+            case 'h': usage(argv[0]); return EXIT_SUCCESS;
+            default:  usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+    const char *scenarios[] = {"mixed", "joystick", "mash", "drag"};
+    bool knownScenario = false;
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); ++i) {
+        knownScenario |= strcmp(o.scenario, scenarios[i]) == 0;
+    }
+    if (!knownScenario || o.contacts < 1 || o.contacts > MAX_MT_SLOTS || o.rate <= 0 || o.duration <= 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    srand(1);
+
+    LoadgenResult r = {0};
+    r.capLatencies = (uint64_t)(o.duration * o.rate) + 16;
+    r.latencies = malloc(r.capLatencies * sizeof(uint64_t));
+
+    if (o.live) {
+        static char before[CONTROL_OUT_SIZE], after[CONTROL_OUT_SIZE];
+        if (Live_Run(&o, &r, before, after, sizeof(before)) < 0) return EXIT_FAILURE;
+
+        uint64_t processed = Live_Counter(after, "syn_reports ") - Live_Counter(before, "syn_reports ");
+        uint64_t latCount = Live_Counter(after, "touch_uinput_count ") - Live_Counter(before, "touch_uinput_count ");
+        uint64_t latSum = Live_Counter(after, "touch_uinput_sum_ns ") - Live_Counter(before, "touch_uinput_sum_ns ");
+        printf("scenario %s, %d contacts, %d Hz, %.1f s, live daemon via uinput\n",
+               o.scenario, gNumContacts, o.rate, r.elapsed);
+        printf("frames sent %llu (%.1f/s), events %llu, sender max lag %.1fus\n",
+               (unsigned long long)r.framesGenerated, r.framesGenerated / r.elapsed,
+               (unsigned long long)r.eventsGenerated, r.maxSendLagNs / 1e3);
+        printf("frames processed by daemon %llu, dropped SYN_REPORTs %lld, SYN_DROPPED %llu\n",
+               (unsigned long long)processed, (long long)(r.framesGenerated - processed),
+               (unsigned long long)(Live_Counter(after, "syn_dropped ") - Live_Counter(before, "syn_dropped ")));
+        printf("event queue early flushes %llu, high water %llu (since daemon start), coalesced %llu\n",
+               (unsigned long long)(Live_Counter(after, "queue_overflows ") - Live_Counter(before, "queue_overflows ")),
+               (unsigned long long)Live_Counter(after, "queue_high_water "),
+               (unsigned long long)(Live_Counter(after, "events_coalesced ") - Live_Counter(before, "events_coalesced ")));
+        printf("uinput writes %llu\n",
+               (unsigned long long)(Live_Counter(after, "uinput_writes ") - Live_Counter(before, "uinput_writes ")));
+        printf("daemon touch->uinput latency: avg %.1fus (%llu samples), max since daemon start %.1fus\n",
+               latCount ? latSum / 1e3 / latCount : 0.0, (unsigned long long)latCount,
+               Live_Counter(after, "touch_uinput_max_ns ") / 1e3);
+        return EXIT_SUCCESS;
+    }
+
+    width = gScreenW;
+    height = gScreenH;
+    touch_min_x = 0; touch_max_x = LOADGEN_DEV_MAX;
+    touch_min_y = 0; touch_max_y = LOADGEN_DEV_MAX;
+    uinput_fd = open("/dev/null", O_WRONLY);
+    if (!verbose) {
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull >= 0) dup2(devnull, STDERR_FILENO);
+    }
+    if (Log_Start()) atexit(Log_Stop);
+    if (o.profile) {
+        char err[256];
+        if (!Profile_Load(o.profile, err, sizeof(err))) { printf("%s\n", err); return EXIT_FAILURE; }
+        Input_ProcessCommands(); // No input thread here: apply the queued profile directly
+    } else {
+        Headless_DefaultLayout();
+    }
+    for (int i = 0; i < gNumWidgets; ++i) Target_Add(gWidgets[i].type, gWidgets[i].normCenter, gWidgets[i].normHalfSize);
+    Contacts_Setup(&o);
+
+    PerfCounters start, end;
+    PerfCounters_Read(&start);
+    Headless_Run(&o, &r);
+    PerfCounters_Read(&end);
+    const PerfCounters *c = &end;
+
+    printf("scenario %s, %d contacts, %d Hz, %.3f s, headless pipeline, ", o.scenario, gNumContacts, o.rate, r.elapsed);
+    if (o.flood) printf("flood\n");
+    else printf("render %dus/wakeup, evdev buffer %d events\n", o.renderUs, o.evdevBuffer);
+    printf("frames generated %llu (%.1f/s), events %llu (%.1f/s)\n",
+           (unsigned long long)r.framesGenerated, r.framesGenerated / r.elapsed,
+           (unsigned long long)r.eventsGenerated, r.eventsGenerated / r.elapsed);
+    printf("frames processed %llu, dropped SYN_REPORTs %lld, SYN_DROPPED %llu\n",
+           (unsigned long long)(c->synReports - start.synReports),
+           (long long)(r.framesGenerated - (c->synReports - start.synReports)),
+           (unsigned long long)(c->synDropped - start.synDropped));
+    printf("event queue early flushes %llu, high water %llu, coalesced %llu\n",
+           (unsigned long long)(c->queueOverflows - start.queueOverflows), (unsigned long long)c->queueHighWater,
+           (unsigned long long)(c->eventsCoalesced - start.eventsCoalesced));
+    printf("uinput writes %llu\n",
+           (unsigned long long)(c->uinputWrites - start.uinputWrites));
+    Result_PrintLatency("frame latency (touch -> uinput flushed)", &r);
+    if (r.dotFresh.samples && r.dotStale.samples) {
+        printf("joystick dot vs modelled contact (predict %llums): produced avg %.2fpx, max %.2fpx; "
+               "before replaced avg %.2fpx, max %.2fpx\n", (unsigned long long)(gPredictNs / 1000000),
+               r.dotFresh.sum / r.dotFresh.samples, r.dotFresh.max, r.dotStale.sum / r.dotStale.samples, r.dotStale.max);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,392 @@
+// Real-time path check: make rtcheck (part of make all)
+//
+// Runs the input thread of main.c in --realtime mode, with D() enabled, on a scripted
+// touch stream fed through a pipe: gameplay with 5 fingers, trackpad, SYN_DROPPED and a
+// full edit mode session (select, move, resize, add a widget, remap a key, toggle the
+// HUD), then commands from the main thread and a lift and touch-down in one read. Fails if, inside the gInRtPath section, anything
+// allocates (malloc and friends are replaced below, which also catches allocations made
+// inside libc) or calls one of the blocking libc functions wrapped with -Wl,--wrap
+// (see RTCHECK_WRAP in the Makefile), with --trace recording. Also checks that the script had its effect.
+//
+// Usage: bench/rtcheck [-v]
+
+#define WLR_GAMEPAD_HEADLESS
+#include "../main.c"
+
+#define RTCHECK_SCREEN_W 1080
+#define RTCHECK_SCREEN_H 2340
+#define RTCHECK_DEV_MAX 4095
+
+// --- Forbidden Calls ---
+
+#define RTCHECK_CALL_LIST \
+  X(malloc)  X(calloc)  X(realloc)  X(free)  X(memalign)  X(posix_memalign) X(aligned_alloc) \
+  X(fprintf) X(printf)  X(vfprintf) X(fputs) X(fputc)     X(fwrite)         X(puts)          \
+  X(putchar) X(perror)  X(fflush)   X(fopen) X(fclose)                                       \
+  X(usleep)  X(nanosleep) X(clock_nanosleep) X(sleep) X(select)                              \
+  X(pthread_mutex_lock) X(pthread_cond_wait) X(open) X(close) X(ioctl) X(fsync)
+
+typedef enum {
+  #define X(name) CALL_##name,
+    RTCHECK_CALL_LIST
+  #undef X
+  CALL_MAX
+} RtCheckCall;
+
+static const char *kRtCheckCallNames[CALL_MAX] = {
+  #define X(name) #name,
+    RTCHECK_CALL_LIST
+  #undef X
+};
+
+static atomic_uint gViolations[CALL_MAX];
+static void *gFirstViolationCaller[CALL_MAX];
+
+static inline void RtCheck_Call(RtCheckCall call, void *caller) {
+    if (!gInRtPath) return;
+    if (atomic_fetch_add(&gViolations[call], 1) == 0) gFirstViolationCaller[call] = caller;
+}
+
+// Allocator: replacing the symbols catches every allocation, including libc internal ones
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+extern void __libc_free(void *);
+extern void *__libc_memalign(size_t, size_t);
+
+void *malloc(size_t n) { RtCheck_Call(CALL_malloc, __builtin_return_address(0)); return __libc_malloc(n); }
+void *calloc(size_t n, size_t sz) { RtCheck_Call(CALL_calloc, __builtin_return_address(0)); return __libc_calloc(n, sz); }
+void *realloc(void *p, size_t n) { RtCheck_Call(CALL_realloc, __builtin_return_address(0)); return __libc_realloc(p, n); }
+void free(void *p) { RtCheck_Call(CALL_free, __builtin_return_address(0)); __libc_free(p); }
+void *memalign(size_t align, size_t n) { RtCheck_Call(CALL_memalign, __builtin_return_address(0)); return __libc_memalign(align, n); }
+void *aligned_alloc(size_t align, size_t n) { RtCheck_Call(CALL_aligned_alloc, __builtin_return_address(0)); return __libc_memalign(align, n); }
+int posix_memalign(void **out, size_t align, size_t n) {
+    RtCheck_Call(CALL_posix_memalign, __builtin_return_address(0));
+    *out = __libc_memalign(align, n);
+    return *out ? 0 : ENOMEM;
+}
+
+// Blocking calls made from main.c: -Wl,--wrap=name routes them to __wrap_name
+#define RTCHECK_WRAP(ret, name, params, args) \
+    ret __real_##name params; \
+    ret __wrap_##name params { RtCheck_Call(CALL_##name, __builtin_return_address(0)); return __real_##name args; }
+
+RTCHECK_WRAP(int, vfprintf, (FILE *f, const char *fmt, va_list ap), (f, fmt, ap))
+RTCHECK_WRAP(int, fputs, (const char *str, FILE *f), (str, f))
+RTCHECK_WRAP(int, fputc, (int ch, FILE *f), (ch, f))
+RTCHECK_WRAP(size_t, fwrite, (const void *p, size_t sz, size_t n, FILE *f), (p, sz, n, f))
+RTCHECK_WRAP(int, puts, (const char *str), (str))
+RTCHECK_WRAP(int, putchar, (int ch), (ch))
+RTCHECK_WRAP(void, perror, (const char *str), (str))
+RTCHECK_WRAP(int, fflush, (FILE *f), (f))
+RTCHECK_WRAP(FILE *, fopen, (const char *path, const char *mode), (path, mode))
+RTCHECK_WRAP(int, fclose, (FILE *f), (f))
+RTCHECK_WRAP(int, usleep, (useconds_t us), (us))
+RTCHECK_WRAP(int, nanosleep, (const struct timespec *req, struct timespec *rem), (req, rem))
+RTCHECK_WRAP(int, clock_nanosleep, (clockid_t clk, int flags, const struct timespec *req, struct timespec *rem), (clk, flags, req, rem))
+RTCHECK_WRAP(unsigned, sleep, (unsigned s), (s))
+RTCHECK_WRAP(int, select, (int n, fd_set *r, fd_set *w, fd_set *e, struct timeval *t), (n, r, w, e, t))
+RTCHECK_WRAP(int, pthread_mutex_lock, (pthread_mutex_t *m), (m))
+RTCHECK_WRAP(int, pthread_cond_wait, (pthread_cond_t *c, pthread_mutex_t *m), (c, m))
+RTCHECK_WRAP(int, close, (int fd), (fd))
+RTCHECK_WRAP(int, fsync, (int fd), (fd))
+
+int __real_vfprintf(FILE *f, const char *fmt, va_list ap);
+int __wrap_fprintf(FILE *f, const char *fmt, ...) {
+    RtCheck_Call(CALL_fprintf, __builtin_return_address(0));
+    va_list ap;
+    va_start(ap, fmt);
+    int n = __real_vfprintf(f, fmt, ap);
+    va_end(ap);
+    return n;
+}
+int __wrap_printf(const char *fmt, ...) {
+    RtCheck_Call(CALL_printf, __builtin_return_address(0));
+    va_list ap;
+    va_start(ap, fmt);
+    int n = __real_vfprintf(stdout, fmt, ap);
+    va_end(ap);
+    return n;
+}
+int __real_open(const char *path, int flags, ...);
+int __wrap_open(const char *path, int flags, ...) {
+    RtCheck_Call(CALL_open, __builtin_return_address(0));
+    va_list ap;
+    va_start(ap, flags);
+    mode_t mode = (flags & O_CREAT) ? va_arg(ap, mode_t) : 0;
+    va_end(ap);
+    return __real_open(path, flags, mode);
+}
+int __real_ioctl(int fd, unsigned long request, ...);
+int __wrap_ioctl(int fd, unsigned long request, ...) {
+    // Reading evdev state (EVIOCGMTSLOTS after SYN_DROPPED) only copies from the kernel
+    if (_IOC_TYPE(request) != 'E' || _IOC_DIR(request) != _IOC_READ) RtCheck_Call(CALL_ioctl, __builtin_return_address(0));
+    va_list ap;
+    va_start(ap, request);
+    void *arg = va_arg(ap, void *);
+    va_end(ap);
+    return __real_ioctl(fd, request, arg);
+}
+
+// --- Touch Script ---
+
+static bool Script_WaitDrained(void);
+
+static int gScriptFd = -1;
+static uint64_t gScriptEvents = 0;
+// Between Script_BeginRead and Script_EndRead events are held back and written at once,
+// so the input thread gets them all in one read
+static struct input_event gScriptHeld[INPUT_READ_BATCH];
+static int gScriptNumHeld = -1;
+
+static void Script_Event(int type, int code, int value) {
+    struct input_event ev = {.type = type, .code = code, .value = value};
+    uint64_t now = clock_ns(CLOCK_MONOTONIC);
+    ev.input_event_sec = now / 1000000000ULL;
+    ev.input_event_usec = (now % 1000000000ULL) / 1000;
+    gScriptEvents++;
+    if (gScriptNumHeld >= 0 && gScriptNumHeld < INPUT_READ_BATCH) {
+        gScriptHeld[gScriptNumHeld++] = ev;
+        return;
+    }
+    if (write(gScriptFd, &ev, sizeof(ev)) != sizeof(ev)) { perror("write script"); exit(EXIT_FAILURE); }
+}
+
+static void Script_BeginRead(void) { gScriptNumHeld = 0; }
+
+static void Script_EndRead(void) {
+    ssize_t len = (ssize_t)(gScriptNumHeld * sizeof(struct input_event));
+    if (write(gScriptFd, gScriptHeld, len) != len) { perror("write script"); exit(EXIT_FAILURE); }
+    gScriptNumHeld = -1;
+}
+
+static void Script_Syn(void) { Script_Event(EV_SYN, SYN_REPORT, 0); }
+
+static int gScriptTrackingId = 100;
+
+// Screen pixels to device units, portrait
+static void Script_Pos(int slot, float x, float y) {
+    Script_Event(EV_ABS, ABS_MT_SLOT, slot);
+    Script_Event(EV_ABS, ABS_MT_POSITION_X, (int)(x / RTCHECK_SCREEN_W * RTCHECK_DEV_MAX + 0.5f));
+    Script_Event(EV_ABS, ABS_MT_POSITION_Y, (int)(y / RTCHECK_SCREEN_H * RTCHECK_DEV_MAX + 0.5f));
+}
+
+static void Script_Down(int slot, float x, float y) {
+    Script_Event(EV_ABS, ABS_MT_SLOT, slot);
+    Script_Event(EV_ABS, ABS_MT_TRACKING_ID, gScriptTrackingId++);
+    Script_Pos(slot, x, y);
+}
+
+static void Script_Up(int slot) {
+    Script_Event(EV_ABS, ABS_MT_SLOT, slot);
+    Script_Event(EV_ABS, ABS_MT_TRACKING_ID, -1);
+}
+
+static void Script_Tap(float x, float y) {
+    Script_Down(0, x, y); Script_Syn();
+    Script_Up(0); Script_Syn();
+}
+
+// Finger in slot 0 from (x0, y0) to (x1, y1) in steps frames
+static void Script_Drag(float x0, float y0, float x1, float y1, int steps) {
+    Script_Down(0, x0, y0); Script_Syn();
+    for (int i = 1; i <= steps; ++i) {
+        Script_Pos(0, x0 + (x1 - x0) * i / steps, y0 + (y1 - y0) * i / steps);
+        Script_Syn();
+    }
+    Script_Up(0); Script_Syn();
+}
+
+// Center of item i of a menu laid out like DrawGenericMenu
+static Vec2 Script_MenuItem(int i, int numItems) {
+    float totalMenuHeight = (kMenuButtonH + kMenuButtonSpacing) * numItems - kMenuButtonSpacing;
+    float startY = (RTCHECK_SCREEN_H - totalMenuHeight) * 0.5f;
+    return (Vec2){RTCHECK_SCREEN_W * 0.5f, startY + i * (kMenuButtonH + kMenuButtonSpacing) + kMenuButtonH * 0.5f};
+}
+
+// Gameplay: five fingers on joystick, dpad and buttons, a trackpad drag and a trackpad tap
+static void Script_Gameplay(int rounds) {
+    for (int r = 0; r < rounds; ++r) {
+        Script_Down(0, 270, 1755);  // Joystick
+        Script_Down(1, 270, 1053);  // Dpad
+        Script_Down(2, 810, 1755);  // Button
+        Script_Down(3, 918, 1404);  // Button
+        Script_Down(4, 600, 500);   // Trackpad
+        Script_Syn();
+        for (int i = 0; i < 32; ++i) {
+            float a = i * 0.4f;
+            Script_Pos(0, 270 + cosf(a) * 120, 1755 + sinf(a) * 120);
+            Script_Pos(1, 270 + (i & 4 ? 100 : -100), 1053);
+            Script_Pos(4, 600 + i * 8, 500 + i * 3);
+            Script_Syn();
+        }
+        for (int s = 0; s < 5; ++s) Script_Up(s);
+        Script_Syn();
+        Script_Tap(700, 400); // Trackpad click
+    }
+    // Overflow in the middle of a frame, then a clean frame
+    Script_Down(0, 270, 1755);
+    Script_Event(EV_SYN, SYN_DROPPED, 0);
+    Script_Pos(0, 300, 1700);
+    Script_Syn();
+    Script_Up(0); Script_Syn();
+}
+
+// Joystick held to the right, then in one read its contact lifts and the slot comes
+// down again on empty space, as with kernel slot reuse or a Touch_Resync replay
+static void Script_LiftAndRedown(void) {
+    Script_Down(0, 370, 1755); Script_Syn();
+    Script_WaitDrained();
+    Script_BeginRead();
+    Script_Up(0); Script_Syn();
+    Script_Down(0, 600, 500); Script_Syn();
+    Script_EndRead();
+    for (int i = 1; i <= 5; ++i) { Script_Pos(0, 600 + i * 8, 500); Script_Syn(); }
+}
+
+// Edit mode: select, move and resize button 4, toggle the HUD, add a button and remap
+// button 4 to the first key of the grid
+static void Script_EditSession(const GridLayout *grid) {
+    float editX = kEditButtonX + kEditButtonW * 0.5f, editY = kEditButtonY + kEditButtonH * 0.5f;
+    Script_Tap(editX, editY);
+    Script_Drag(918, 1404, 900, 1300, 10);  // Select, move
+    Script_Drag(900, 1300, 880, 1280, 10);  // Move the selected widget
+    Script_Drag(935, 1335, 960, 1360, 10);  // Resize handle, bottom right corner
+    Script_Tap(kHudButtonX + kHudButtonW * 0.5f, kHudButtonY + kHudButtonH * 0.5f);
+    Script_Tap(kAddButtonX + kAddButtonW * 0.5f, kAddButtonY + kAddButtonH * 0.5f);
+    Vec2 item = Script_MenuItem(2, numAvailableWidgetTypes); // Button
+    Script_Tap(item.x, item.y);
+    Script_Tap(880, 1280);                  // Select button 4 again
+    Script_Tap(kPropsButtonX + kPropsButtonW * 0.5f, kPropsButtonY + kPropsButtonH * 0.5f);
+    item = Script_MenuItem(0, numAvailablePropertyActions); // Remap
+    Script_Tap(item.x, item.y);
+    float pagerY = grid->startY - grid->cellSpacing - grid->cellSize * 0.5f;
+    Script_Tap(grid->startX + grid->totalWidth - grid->cellSize * 0.5f, pagerY); // Next page
+    Script_Tap(grid->startX + grid->cellSize * 0.5f, pagerY);                    // and back
+    Script_Tap(grid->startX + grid->cellSize * 0.5f, grid->startY + grid->cellSize * 0.5f);
+    Script_Tap(editX, editY);
+}
+
+// Wait until the input thread has read everything written so far
+static bool Script_WaitDrained(void) {
+    uint64_t deadline = clock_ns(CLOCK_MONOTONIC) + 5000000000ULL;
+    while (__atomic_load_n(&gPerfThreads[PERF_THREAD_INPUT].evdevEvents, __ATOMIC_RELAXED) < gScriptEvents) {
+        if (clock_ns(CLOCK_MONOTONIC) > deadline) return false;
+        struct timespec ts = {0, 1000000};
+        nanosleep(&ts, NULL);
+    }
+    return true;
+}
+
+// Wait until the input thread has applied the command with sequence number seq
+static bool Script_WaitCommand(unsigned seq) {
+    uint64_t deadline = clock_ns(CLOCK_MONOTONIC) + 5000000000ULL;
+    while ((int)(atomic_load(&gInputCmdTail) - seq) < 0) {
+        if (clock_ns(CLOCK_MONOTONIC) > deadline) return false;
+        struct timespec ts = {0, 1000000};
+        nanosleep(&ts, NULL);
+    }
+    return true;
+}
+
+static int gFailures = 0;
+
+static void Check(bool ok, const char *what) {
+    printf("%-48s %s\n", what, ok ? "ok" : "FAIL");
+    if (!ok) gFailures++;
+}
+
+int main(int argc, char **argv) {
+    bool verbose = argc > 1 && strcmp(argv[1], "-v") == 0;
+    if (!verbose) freopen("/dev/null", "w", stderr);
+    if (Log_Start()) atexit(Log_Stop);
+
+    uinput_fd = open("/dev/null", O_WRONLY);
+    touch_min_x = touch_min_y = 0;
+    touch_max_x = touch_max_y = RTCHECK_DEV_MAX;
+    gRealtimeInput = true;
+    gRealtimePriority = sched_get_priority_min(SCHED_FIFO);
+    if (!Trace_Init("/dev/null")) return EXIT_FAILURE; // Tracing is on the checked path too
+    gPredictNs = 8000000; // And joystick prediction
+    if (!SharedView_Create()) return EXIT_FAILURE; // And the --input-daemon's view, with an overlay attached
+    atomic_store(&gViewerAttached, true);
+
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) < 0) { perror("pipe"); return EXIT_FAILURE; }
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    gTouchDevFd = fds[0];
+    gScriptFd = fds[1];
+
+    CreateWidget(WIDGET_JOYSTICK, (Vec2){0.25f, 0.75f}, 0.12f);
+    CreateWidget(WIDGET_DPAD, (Vec2){0.25f, 0.45f}, 0.1f);
+    CreateWidget(WIDGET_BUTTON, (Vec2){0.75f, 0.75f}, 0.06f);
+    Widget *b = CreateWidget(WIDGET_BUTTON, (Vec2){0.85f, 0.6f}, 0.06f);
+    int remapId = b->id;
+    Input_PostCommand((InputCommand){.type = INPUT_CMD_RESIZE, .a = RTCHECK_SCREEN_W, .b = RTCHECK_SCREEN_H});
+    if (!InputThread_Start()) return EXIT_FAILURE;
+    GridLayout grid = gView->keyGrid;
+
+    Script_Gameplay(50);
+    Check(Script_WaitDrained(), "gameplay script read by the input thread");
+    Script_EditSession(&grid);
+    Check(Script_WaitDrained(), "edit mode script read by the input thread");
+    Script_Gameplay(10);
+    Check(Script_WaitDrained(), "second gameplay script read");
+
+    Input_PostCommand((InputCommand){.type = INPUT_CMD_SENSITIVITY, .f = 2.0f});
+    Input_PostCommand((InputCommand){.type = INPUT_CMD_ORIENTATION, .a = -1});
+    Input_PostCommand((InputCommand){.type = INPUT_CMD_ORIENTATION, .a = -1});
+    Input_PostCommand((InputCommand){.type = INPUT_CMD_ENABLE, .a = 0});
+    unsigned seq = Input_PostCommand((InputCommand){.type = INPUT_CMD_ENABLE, .a = 1});
+    Check(seq && Script_WaitCommand(seq), "commands applied");
+    Script_Gameplay(5);
+    Check(Script_WaitDrained(), "gameplay after re-enable read");
+    Script_LiftAndRedown();
+    Check(Script_WaitDrained(), "lift and touch-down in one read");
+    InputThread_Stop();
+
+    // The thread has exited, its state is safe to read
+    int idx = FindWidgetIndexById(remapId);
+    PerfCounters perf;
+    PerfCounters_Read(&perf);
+    Check(gNumWidgets == 5, "edit mode added a widget");
+    Check(gHudVisible, "edit mode toggled the HUD");
+    Check(idx >= 0 && gWidgets[idx].data.button.keycode == kKeyPages[0].keys[0], "edit mode remapped the button");
+    Check(idx >= 0 && gWidgets[idx].normCenter.y < 0.6f, "edit mode moved the button");
+    Check(idx >= 0 && gWidgets[idx].normHalfSize > 0.06f, "edit mode resized the button");
+    Check(gAppState == APP_STATE_RUNNING, "left edit mode");
+    Check(perf.synDropped == 3, "SYN_DROPPED seen");
+    Check(perf.touchResyncs == 3, "slots resynchronized after SYN_DROPPED");
+    Check(gTrackpadSensitivity == 2.0f && !gLandscapeMode, "sensitivity and orientation commands");
+    bool keysHeld = false;
+    for (int k = 0; k < KEY_CNT; ++k) keysHeld |= uinput_key_is_down(k);
+    const Widget *joystick = &gWidgets[0]; // Script_LiftAndRedown's, released while the slot is still down
+    Check(!uinput_key_is_down(joystick->data.analog.keycode[DIR_RIGHT]), "lift and touch-down in one read release joystick");
+    Check(!keysHeld, "no keys held at the end");
+    Check(atomic_load(&gTraceRings[TRACE_THREAD_INPUT].count) > perf.evdevEvents, "input thread traced");
+
+    // Read the view back as an --attach overlay would: read-only mapping, labels looked up again
+    gAttachedView = mmap(NULL, sizeof(SharedView), PROT_READ, MAP_SHARED, gSharedViewFd, 0);
+    bool viewOk = gAttachedView != MAP_FAILED && SharedView_Acquire() && gView->numWidgets == gNumWidgets;
+    for (int i = 0; viewOk && i < gView->numWidgets; ++i) {
+        const Widget *w = &gView->widgets[i];
+        viewOk = w->type == WIDGET_BUTTON ? w->data.button.keycode == gWidgets[i].data.button.keycode &&
+                                                !strcmp(w->data.button.mappedLabel, gWidgets[i].data.button.mappedLabel)
+                                          : w->data.analog.keycode[DIR_UP] == gWidgets[i].data.analog.keycode[DIR_UP];
+    }
+    Check(viewOk && !(gAttachedView->seq & 1), "shared view matches the input thread's state");
+    Trace_Write();
+
+    printf("\n%llu evdev events, %llu uinput writes\n",
+           (unsigned long long)perf.evdevEvents, (unsigned long long)perf.uinputWrites);
+    unsigned total = 0;
+    for (int c = 0; c < CALL_MAX; ++c) {
+        unsigned n = atomic_load(&gViolations[c]);
+        if (!n) continue;
+        printf("real-time path called %-20s %6u times, first from %p\n", kRtCheckCallNames[c], n, gFirstViolationCaller[c]);
+        total += n;
+    }
+    Check(total == 0, "no allocating or blocking calls on the real-time path");
+    printf("%s\n", gFailures ? "rtcheck FAILED" : "rtcheck passed");
+    return gFailures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE // accept4, pthread_setaffinity_np
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -5,19 +6,40 @@
 #include <time.h>
 #include <math.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <poll.h>
 #include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <grp.h>
+#include <sys/signalfd.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <linux/input.h>
 #include <errno.h>
 #include <linux/input-event-codes.h> 
+#ifndef WLR_GAMEPAD_HEADLESS
 #include <wayland-client.h>
 #include <wayland-client-protocol.h>
 #include <wayland-egl.h>
 #include <EGL/egl.h>
+#include <EGL/eglext.h>
 #include <GL/gl.h>
+#include <GL/glext.h>
 #include "protocol/wlr-layer-shell-unstable-v1-client-protocol.h"
+#include "protocol/viewporter-client-protocol.h"
+#include "protocol/presentation-time-client-protocol.h"
+#endif
 #include <linux/uinput.h>
 
 // --- Macros and Basic Defines ---
@@ -35,16 +57,393 @@
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
 #endif
 
+// WLR_GAMEPAD_HEADLESS builds only the input/widget core, without Wayland, EGL, GL or main(),
+// for bench/ programs that #include this file.
+
+// Set while the input thread is between read(gTouchDevFd) and its uinput writes (see
+// InputThread_Main). With --realtime nothing on that path may allocate or block.
+static __thread bool gInRtPath = false;
+static bool gRealtimeInput = false;
+
+// --- Logging ---
+// D() and LOG() never write to stderr themselves: they copy the format string pointer, the
+// raw arguments and a timestamp into a lock-free ring, and the logger thread formats and
+// writes them. A slow stderr (journal pipe, serial console) can then never stall a key
+// press. When the ring is full the message is dropped and counted.
+//
+// Levels above LOG_LEVEL compile to nothing. The Makefile builds the daemon with
+// LOG_LEVEL_INFO; `make LOG_LEVEL=DEBUG` brings D() back.
+
+#define LOG_LEVEL_ERROR 0
+#define LOG_LEVEL_WARN  1
+#define LOG_LEVEL_INFO  2
+#define LOG_LEVEL_DEBUG 3
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+#define LOG_RING_SIZE 512   // Records, power of two
+#define LOG_MAX_ARGS 8
+#define LOG_TEXT_BYTES 80   // Copies of %s arguments, which may not outlive the call
+
+static const char *kLogLevelNames[] = {"ERROR", "WARN", "INFO", "DEBUG"};
+
+typedef enum { LOG_ARG_INT, LOG_ARG_DOUBLE, LOG_ARG_STRING, LOG_ARG_POINTER } LogArgType;
+
+typedef struct {
+    LogArgType type;
+    union {
+        long long i;
+        double d;
+        const void *p;
+        const char *s;
+    };
+} LogArg;
+
+typedef struct {
+    atomic_uint seq;            // Ring slot state, see Log_Push
+    uint8_t level;
+    uint8_t numArgs;
+    uint8_t argTypes[LOG_MAX_ARGS];
+    int line;
+    const char *file;
+    const char *fmt;
+    uint64_t ns;                // CLOCK_MONOTONIC
+    union {
+        long long i;
+        double d;
+        const void *p;
+        unsigned textOffset;    // LOG_ARG_STRING: start in text[]
+    } args[LOG_MAX_ARGS];
+    char text[LOG_TEXT_BYTES];
+} LogRecord;
+
+// Bounded multi-producer queue (one sequence number per slot, so producers never wait for
+// each other). For position pos, slot pos % LOG_RING_SIZE is free when its seq equals
+// LOG_LAP(pos) and holds a record when it equals LOG_LAP(pos) + 1; zero-initialized means
+// free. The only consumer is Log_Flush.
+#define LOG_LAP(pos) ((pos) & ~(unsigned)(LOG_RING_SIZE - 1))
+static LogRecord gLogRing[LOG_RING_SIZE];
+static atomic_uint gLogHead;
+static unsigned gLogTail;
+static atomic_ullong gLogDropped;
+static atomic_bool gLogWaiting;     // Logger thread is about to sleep on gLogWakeFd
+static atomic_bool gLogStopping;
+static int gLogWakeFd = -1;
+static pthread_t gLogThread;
+static bool gLogThreadStarted = false;
+
+static inline LogArg Log_ArgInt(long long v) { return (LogArg){.type = LOG_ARG_INT, .i = v}; }
+static inline LogArg Log_ArgDouble(double v) { return (LogArg){.type = LOG_ARG_DOUBLE, .d = v}; }
+static inline LogArg Log_ArgString(const char *v) { return (LogArg){.type = LOG_ARG_STRING, .s = v}; }
+static inline LogArg Log_ArgPointer(const void *v) { return (LogArg){.type = LOG_ARG_POINTER, .p = v}; }
+
+#define LOG_ARG(x) _Generic((x), \
+        float: Log_ArgDouble, double: Log_ArgDouble, \
+        char *: Log_ArgString, const char *: Log_ArgString, \
+        void *: Log_ArgPointer, const void *: Log_ArgPointer, \
+        default: Log_ArgInt)(x)
+
+// LOG_MAP(a, b, ...) -> LOG_ARG(a), LOG_ARG(b), ... for up to LOG_MAX_ARGS arguments
+#define LOG_NARGS(...) LOG_NARGS_(_, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define LOG_NARGS_(_, a1, a2, a3, a4, a5, a6, a7, a8, n, ...) n
+#define LOG_CAT(a, b) LOG_CAT_(a, b)
+#define LOG_CAT_(a, b) a##b
+#define LOG_MAP(...) LOG_CAT(LOG_MAP_, LOG_NARGS(__VA_ARGS__))(__VA_ARGS__)
+#define LOG_MAP_0()
+#define LOG_MAP_1(a) LOG_ARG(a)
+#define LOG_MAP_2(a, ...) LOG_ARG(a), LOG_MAP_1(__VA_ARGS__)
+#define LOG_MAP_3(a, ...) LOG_ARG(a), LOG_MAP_2(__VA_ARGS__)
+#define LOG_MAP_4(a, ...) LOG_ARG(a), LOG_MAP_3(__VA_ARGS__)
+#define LOG_MAP_5(a, ...) LOG_ARG(a), LOG_MAP_4(__VA_ARGS__)
+#define LOG_MAP_6(a, ...) LOG_ARG(a), LOG_MAP_5(__VA_ARGS__)
+#define LOG_MAP_7(a, ...) LOG_ARG(a), LOG_MAP_6(__VA_ARGS__)
+#define LOG_MAP_8(a, ...) LOG_ARG(a), LOG_MAP_7(__VA_ARGS__)
+
+// The dead printf keeps the compiler's format string checks
+#define LOG(level, fmt, ...) do { \
+        if ((level) <= LOG_LEVEL) { \
+            const LogArg logArgs_[] = {{0}, LOG_MAP(__VA_ARGS__)}; \
+            Log_Push((level), __FILE__, __LINE__, fmt, logArgs_ + 1, (int)(sizeof(logArgs_) / sizeof(logArgs_[0])) - 1); \
+            if (0) printf(fmt, ##__VA_ARGS__); \
+        } \
+    } while (0)
+
 // Debug macro
-#define D(fmt, ...) fprintf(stderr, "[DEBUG] %s:%d: " fmt "\n", __FILE__, __LINE__, ##__VA_ARGS__)
+#define D(fmt, ...) LOG(LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+
+// Safe on the real-time path: no allocation, no locks, at most one eventfd write
+static void Log_Push(int level, const char *file, int line, const char *fmt, const LogArg *args, int numArgs) {
+    unsigned pos = atomic_load_explicit(&gLogHead, memory_order_relaxed);
+    LogRecord *r;
+    for (;;) {
+        r = &gLogRing[pos % LOG_RING_SIZE];
+        int diff = (int)(atomic_load_explicit(&r->seq, memory_order_acquire) - LOG_LAP(pos));
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&gLogHead, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) break;
+        } else if (diff < 0) {
+            atomic_fetch_add_explicit(&gLogDropped, 1, memory_order_relaxed);
+            return;
+        } else {
+            pos = atomic_load_explicit(&gLogHead, memory_order_relaxed);
+        }
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    r->ns = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+    r->level = (uint8_t)level;
+    r->file = file;
+    r->line = line;
+    r->fmt = fmt;
+    r->numArgs = (uint8_t)MIN(numArgs, LOG_MAX_ARGS);
+    unsigned textUsed = 0; // Kept below LOG_TEXT_BYTES, a full pool yields empty strings
+    for (int i = 0; i < r->numArgs; ++i) {
+        r->argTypes[i] = (uint8_t)args[i].type;
+        switch (args[i].type) {
+            case LOG_ARG_INT:     r->args[i].i = args[i].i; break;
+            case LOG_ARG_DOUBLE:  r->args[i].d = args[i].d; break;
+            case LOG_ARG_POINTER: r->args[i].p = args[i].p; break;
+            case LOG_ARG_STRING: {
+                const char *s = args[i].s ? args[i].s : "(null)";
+                size_t n = strnlen(s, LOG_TEXT_BYTES - 1 - textUsed);
+                memcpy(r->text + textUsed, s, n);
+                r->text[textUsed + n] = '\0';
+                r->args[i].textOffset = textUsed;
+                textUsed = MIN(textUsed + (unsigned)n + 1, LOG_TEXT_BYTES - 1);
+                break;
+            }
+        }
+    }
+    atomic_store_explicit(&r->seq, LOG_LAP(pos) + 1, memory_order_release);
+
+    // Publish before looking at the flag; pairs with the fence in Log_ThreadMain, so either
+    // the logger sees this record or we see it waiting
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load(&gLogWaiting) && atomic_exchange(&gLogWaiting, false)) {
+        uint64_t one = 1;
+        write(gLogWakeFd, &one, sizeof(one));
+    }
+}
+
+// Expand r->fmt with the recorded arguments. Length modifiers are ignored: integers are
+// stored as long long and printed with "ll".
+static size_t Log_Format(const LogRecord *r, char *out, size_t len) {
+    size_t off = 0;
+    #define LOG_APPEND(...) do { \
+        int n_ = snprintf(out + off, len - off, __VA_ARGS__); \
+        if (n_ > 0) off = MIN(off + (size_t)n_, len - 1); \
+    } while (0)
+
+    LOG_APPEND("[%s] %llu.%06llu %s:%d: ", kLogLevelNames[r->level],
+               (unsigned long long)(r->ns / 1000000000ULL), (unsigned long long)(r->ns % 1000000000ULL / 1000),
+               r->file, r->line);
+    int argIndex = 0;
+    for (const char *f = r->fmt; *f && off < len - 1; ++f) {
+        if (*f != '%') { out[off++] = *f; continue; }
+        if (f[1] == '%') { out[off++] = '%'; ++f; continue; }
+
+        char spec[16] = "%";
+        size_t specLen = 1;
+        for (++f; *f && strchr("-+ #0123456789.", *f); ++f) {
+            if (specLen < sizeof(spec) - 4) spec[specLen++] = *f;
+        }
+        while (*f && strchr("hlLqjzt", *f)) ++f;
+        if (!*f) break;
+        if (argIndex >= r->numArgs) { LOG_APPEND("?"); continue; }
+
+        int type = r->argTypes[argIndex];
+        long long i = type == LOG_ARG_DOUBLE ? (long long)r->args[argIndex].d : r->args[argIndex].i;
+        double d = type == LOG_ARG_DOUBLE ? r->args[argIndex].d : (double)r->args[argIndex].i;
+        const char *s = type == LOG_ARG_STRING ? r->text + r->args[argIndex].textOffset : "?";
+        ++argIndex;
+        switch (*f) {
+            case 'd': case 'i':
+                memcpy(spec + specLen, "lld", 4);
+                LOG_APPEND(spec, i);
+                break;
+            case 'u': case 'x': case 'X': case 'o':
+                spec[specLen++] = 'l'; spec[specLen++] = 'l'; spec[specLen++] = *f; spec[specLen] = '\0';
+                LOG_APPEND(spec, (unsigned long long)i);
+                break;
+            case 'c':
+                memcpy(spec + specLen, "c", 2);
+                LOG_APPEND(spec, (int)i);
+                break;
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+                spec[specLen++] = *f; spec[specLen] = '\0';
+                LOG_APPEND(spec, d);
+                break;
+            case 's':
+                memcpy(spec + specLen, "s", 2);
+                LOG_APPEND(spec, s);
+                break;
+            case 'p':
+                LOG_APPEND("%p", r->args[argIndex - 1].p);
+                break;
+            default:
+                LOG_APPEND("?");
+                break;
+        }
+    }
+    out[off++] = '\n';
+    #undef LOG_APPEND
+    return off;
+}
+
+static bool Log_Pending(void) {
+    const LogRecord *r = &gLogRing[gLogTail % LOG_RING_SIZE];
+    return atomic_load_explicit(&r->seq, memory_order_acquire) == LOG_LAP(gLogTail) + 1;
+}
+
+// Format and write everything queued so far. Only one thread may call this at a time:
+// the logger thread while it runs, otherwise whoever owns the process (startup, exit, bench/).
+static void Log_Flush(void) {
+    static char buf[8192];
+    static unsigned long long reportedDropped = 0;
+    size_t used = 0;
+    while (Log_Pending()) {
+        LogRecord *r = &gLogRing[gLogTail % LOG_RING_SIZE];
+        if (sizeof(buf) - used < 512) { fwrite(buf, 1, used, stderr); used = 0; }
+        used += Log_Format(r, buf + used, sizeof(buf) - used);
+        atomic_store_explicit(&r->seq, LOG_LAP(gLogTail) + LOG_RING_SIZE, memory_order_release);
+        gLogTail++;
+    }
+    unsigned long long dropped = atomic_load_explicit(&gLogDropped, memory_order_relaxed);
+    if (dropped != reportedDropped && sizeof(buf) - used >= 64) {
+        used += (size_t)snprintf(buf + used, sizeof(buf) - used, "[LOG] %llu messages dropped (ring full)\n",
+                                 dropped - reportedDropped);
+        reportedDropped = dropped;
+    }
+    if (used) fwrite(buf, 1, used, stderr);
+}
+
+static void *Log_ThreadMain(void *arg) {
+    (void)arg;
+    while (!atomic_load(&gLogStopping)) {
+        Log_Flush();
+        atomic_store(&gLogWaiting, true);
+        atomic_thread_fence(memory_order_seq_cst); // Flag before the check, see Log_Push
+        if (Log_Pending()) { // Pushed between the flush and the flag
+            atomic_store(&gLogWaiting, false);
+            continue;
+        }
+        struct pollfd pfd = {.fd = gLogWakeFd, .events = POLLIN};
+        if (poll(&pfd, 1, -1) > 0) {
+            uint64_t n;
+            read(gLogWakeFd, &n, sizeof(n));
+        }
+    }
+    return NULL;
+}
+
+static bool Log_Start(void) {
+    gLogWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (gLogWakeFd < 0) { perror("eventfd"); return false; }
+    int err = pthread_create(&gLogThread, NULL, Log_ThreadMain, NULL);
+    if (err) { fprintf(stderr, "Failed to start logger thread: %s\n", strerror(err)); return false; }
+    gLogThreadStarted = true;
+    return true;
+}
+
+// Stop the logger thread and write what is left
+static void Log_Stop(void) {
+    if (gLogThreadStarted) {
+        atomic_store(&gLogStopping, true);
+        uint64_t one = 1;
+        write(gLogWakeFd, &one, sizeof(one));
+        pthread_join(gLogThread, NULL);
+        gLogThreadStarted = false;
+    }
+    Log_Flush();
+    if (gLogWakeFd >= 0) close(gLogWakeFd);
+    gLogWakeFd = -1;
+}
 
 // --- Core Data Structures and Enumerations ---
 
-// Mappable Keys
+// Mappable Keys: the remap menu's pages, each an X-macro list of X(page, keycode, label).
+// Labels only use characters the overlay font has (letters and digits).
+#define KEYS_MAIN(X, p) \
+  X(p, KEY_A, "A") X(p, KEY_B, "B") X(p, KEY_C, "C") X(p, KEY_D, "D") \
+  X(p, KEY_E, "E") X(p, KEY_F, "F") X(p, KEY_G, "G") X(p, KEY_H, "H") \
+  X(p, KEY_I, "I") X(p, KEY_J, "J") X(p, KEY_K, "K") X(p, KEY_L, "L") \
+  X(p, KEY_M, "M") X(p, KEY_N, "N") X(p, KEY_O, "O") X(p, KEY_P, "P") \
+  X(p, KEY_Q, "Q") X(p, KEY_R, "R") X(p, KEY_S, "S") X(p, KEY_T, "T") \
+  X(p, KEY_U, "U") X(p, KEY_V, "V") X(p, KEY_W, "W") X(p, KEY_X, "X") \
+  X(p, KEY_Y, "Y") X(p, KEY_Z, "Z") \
+  X(p, KEY_1, "1") X(p, KEY_2, "2") X(p, KEY_3, "3") X(p, KEY_4, "4") \
+  X(p, KEY_5, "5") X(p, KEY_6, "6") X(p, KEY_7, "7") X(p, KEY_8, "8") \
+  X(p, KEY_9, "9") X(p, KEY_0, "0") \
+  X(p, KEY_ESC, "Esc") X(p, KEY_SPACE, "Spc") X(p, KEY_ENTER, "Ent") X(p, KEY_BACKSPACE, "Bk") \
+  X(p, KEY_TAB, "Tab") X(p, KEY_MINUS, "Minus") X(p, KEY_EQUAL, "Equal") X(p, KEY_LEFTBRACE, "LBrk") \
+  X(p, KEY_RIGHTBRACE, "RBrk") X(p, KEY_BACKSLASH, "Bslsh") X(p, KEY_SEMICOLON, "Semi") X(p, KEY_APOSTROPHE, "Quote") \
+  X(p, KEY_GRAVE, "Grave") X(p, KEY_COMMA, "Comma") X(p, KEY_DOT, "Dot") X(p, KEY_SLASH, "Slash")
+
+#define KEYS_NAV(X, p) \
+  X(p, KEY_LEFTCTRL, "Ctrl") X(p, KEY_LEFTSHIFT, "Shft") X(p, KEY_LEFTALT, "Alt") X(p, KEY_LEFTMETA, "Meta") \
+  X(p, KEY_RIGHTCTRL, "RCtrl") X(p, KEY_RIGHTSHIFT, "RShft") X(p, KEY_RIGHTALT, "RAlt") X(p, KEY_RIGHTMETA, "RMeta") \
+  X(p, KEY_UP, "Up") X(p, KEY_DOWN, "Dn") X(p, KEY_LEFT, "Lt") X(p, KEY_RIGHT, "Rt") \
+  X(p, KEY_INSERT, "Ins") X(p, KEY_DELETE, "Del") X(p, KEY_HOME, "Home") X(p, KEY_END, "End") \
+  X(p, KEY_PAGEUP, "PgUp") X(p, KEY_PAGEDOWN, "PgDn") X(p, KEY_CAPSLOCK, "Caps") X(p, KEY_COMPOSE, "Menu") \
+  X(p, KEY_SYSRQ, "PrtSc") X(p, KEY_SCROLLLOCK, "ScrLk") X(p, KEY_PAUSE, "Pause")
+
+#define KEYS_FUNC(X, p) \
+  X(p, KEY_F1, "F1") X(p, KEY_F2, "F2") X(p, KEY_F3, "F3") X(p, KEY_F4, "F4") \
+  X(p, KEY_F5, "F5") X(p, KEY_F6, "F6") X(p, KEY_F7, "F7") X(p, KEY_F8, "F8") \
+  X(p, KEY_F9, "F9") X(p, KEY_F10, "F10") X(p, KEY_F11, "F11") X(p, KEY_F12, "F12") \
+  X(p, KEY_F13, "F13") X(p, KEY_F14, "F14") X(p, KEY_F15, "F15") X(p, KEY_F16, "F16") \
+  X(p, KEY_F17, "F17") X(p, KEY_F18, "F18") X(p, KEY_F19, "F19") X(p, KEY_F20, "F20") \
+  X(p, KEY_F21, "F21") X(p, KEY_F22, "F22") X(p, KEY_F23, "F23") X(p, KEY_F24, "F24")
+
+#define KEYS_NUMPAD(X, p) \
+  X(p, KEY_KP7, "KP7") X(p, KEY_KP8, "KP8") X(p, KEY_KP9, "KP9") X(p, KEY_KPSLASH, "KPDiv") \
+  X(p, KEY_KP4, "KP4") X(p, KEY_KP5, "KP5") X(p, KEY_KP6, "KP6") X(p, KEY_KPASTERISK, "KPMul") \
+  X(p, KEY_KP1, "KP1") X(p, KEY_KP2, "KP2") X(p, KEY_KP3, "KP3") X(p, KEY_KPMINUS, "KPSub") \
+  X(p, KEY_KP0, "KP0") X(p, KEY_KPDOT, "KPDot") X(p, KEY_KPENTER, "KPEnt") X(p, KEY_KPPLUS, "KPAdd") \
+  X(p, KEY_NUMLOCK, "NumLk") X(p, KEY_KPEQUAL, "KPEq")
+
+#define KEYS_MOUSE(X, p) \
+  X(p, BTN_LEFT, "LMB") X(p, BTN_RIGHT, "RMB") X(p, BTN_MIDDLE, "MMB") X(p, BTN_SIDE, "Side") \
+  X(p, BTN_EXTRA, "Extra") X(p, BTN_FORWARD, "Fwd") X(p, BTN_BACK, "Back") \
+  X(p, KEY_MUTE, "Mute") X(p, KEY_VOLUMEDOWN, "VolDn") X(p, KEY_VOLUMEUP, "VolUp") X(p, KEY_PLAYPAUSE, "Play") \
+  X(p, KEY_PREVIOUSSONG, "Prev") X(p, KEY_NEXTSONG, "Next") X(p, KEY_STOPCD, "Stop")
+
+#define KEYS_GAMEPAD(X, p) \
+  X(p, BTN_SOUTH, "PadA") X(p, BTN_EAST, "PadB") X(p, BTN_NORTH, "PadX") X(p, BTN_WEST, "PadY") \
+  X(p, BTN_TL, "LB") X(p, BTN_TR, "RB") X(p, BTN_TL2, "LT") X(p, BTN_TR2, "RT") \
+  X(p, BTN_SELECT, "Sel") X(p, BTN_START, "Start") X(p, BTN_MODE, "Mode") X(p, BTN_THUMBL, "LS") \
+  X(p, BTN_THUMBR, "RS") X(p, BTN_DPAD_UP, "DUp") X(p, BTN_DPAD_DOWN, "DDn") X(p, BTN_DPAD_LEFT, "DLt") \
+  X(p, BTN_DPAD_RIGHT, "DRt")
+
+#define KEY_PAGE_LIST \
+  X(MAIN,    "Main",    KEYS_MAIN)    \
+  X(NAV,     "Mods",    KEYS_NAV)     \
+  X(FUNC,    "F Keys",  KEYS_FUNC)    \
+  X(NUMPAD,  "Numpad",  KEYS_NUMPAD)  \
+  X(MOUSE,   "Mouse",   KEYS_MOUSE)   \
+  X(GAMEPAD, "Gamepad", KEYS_GAMEPAD)
+
+typedef enum {
+  #define X(id, name, keys) KEY_PAGE_##id,
+    KEY_PAGE_LIST
+  #undef X
+  KEY_PAGE_MAX
+} KeyPageId;
+
+// One remap menu page, keys in grid order
+typedef struct {
+    const char *name;
+    const uint16_t *keys;
+    int numKeys;
+} KeyPage;
+
+// What we know about a keycode, see kKeyInfo
 typedef struct {
-    int keycode;        // Linux input event code (e.g., KEY_A)
-    const char *label;  // Human-readable label (e.g., "A", "Spc", "Ctrl")
-} MappableKey;
+    const char *label; // Human-readable label (e.g., "A", "Spc", "Ctrl"); NULL if not mappable
+    uint8_t page;      // KeyPageId listing it
+} KeyInfo;
 
 // Widget System
 #define WIDGET_TYPE_LIST \
@@ -64,9 +463,34 @@ typedef struct {
 } Vec2;
 
 typedef struct {
-    GLubyte r, g, b, a;
+    uint8_t r, g, b, a;
 } Color;
 
+// Screen area in pixels, top-left origin; empty when x1 <= x0 or y1 <= y0
+typedef struct {
+    float x0, y0, x1, y1;
+} DamageRect;
+
+// Pixels the software rasterizer draws into, see Software Rasterizer
+typedef struct {
+    uint32_t *pixels;        // Premultiplied ARGB8888
+    int width, height;
+    int stride;              // In pixels
+    float ox, oy;            // Screen position of pixels[0] (a widget surface's corner)
+    float scale;             // Canvas pixels per screen pixel, see --render-scale
+    int cx0, cy0, cx1, cy1;  // Clip rectangle in canvas pixels, x1/y1 exclusive
+} SwCanvas;
+
+typedef enum {
+    RENDERER_GL,  // EGL + desktop GL (default)
+    RENDERER_SHM, // CPU rasterizer into wl_shm buffers, no GPU
+} Renderer;
+
+typedef enum {
+    SURFACES_OVERLAY, // One full-screen layer surface (default)
+    SURFACES_WIDGET,  // A subsurface per widget, see Widget Surfaces
+} SurfaceMode;
+
 typedef struct {
     int id;
     WidgetType type;
@@ -130,13 +554,15 @@ typedef struct {
 // Input System
 typedef enum {
     EVT_KEY_DOWN,
-    EVT_KEY_UP
+    EVT_KEY_UP,
+    EVT_NONE      // Coalesced away, skipped by InputState_Flush
 } EventType;
 
 typedef struct {
     int widget_id;
     EventType type;
-    int keycode;  // Linux KEY_ code
+    int keycode;    // Linux KEY_ code
+    unsigned frame; // gTouchFrame when queued
 } InputEvent;
 
 typedef enum {
@@ -147,19 +573,26 @@ typedef enum {
 } Direction;
 
 // Touch Input System
-typedef struct {
-    bool active;
-    bool was_down;
-    double x;
-    double y;
-} MTSlot;
-
 typedef enum {
     SLOT_IDLE = 0,
     SLOT_WIDGET,
     SLOT_TRACKPAD
 } SlotMode;
 
+// Everything known about one multitouch slot, 64 bytes (one cache line)
+typedef struct {
+    double x;
+    double y;
+    double trackLastX, trackLastY;   // Trackpad: position of the last emitted motion
+    double trackAccumX, trackAccumY; // Trackpad: sub-pixel motion not emitted yet
+    int trackingId;   // ABS_MT_TRACKING_ID of the contact while active
+    SlotMode mode;    // What the contact is driving, decided at touch down
+    short widgetIndex; // gWidgets index this contact took control of, -1 if none
+    bool active;
+    bool was_down;
+    bool trackMoved;  // Trackpad contact moved, so its release is no click
+} MTSlot;
+
 // UI Menu System
 typedef struct {
     const char* label;
@@ -172,62 +605,515 @@ typedef enum {
     /*, PROP_ACTION_OPACITY ... */
 } PropertyAction;
 
+// Requests from the main thread to the input thread, see Input_PostCommand
+typedef enum {
+    INPUT_CMD_ENABLE,       // a: 1 enable, 0 disable, -1 toggle
+    INPUT_CMD_ORIENTATION,  // a: 1 landscape, 0 portrait, -1 toggle
+    INPUT_CMD_SENSITIVITY,  // f: trackpad sensitivity
+    INPUT_CMD_RESIZE,       // a x b: surface size
+    INPUT_CMD_LOAD_PROFILE, // Apply gPendingProfile
+    INPUT_CMD_KEY,          // a: keycode, b: 1 press, 0 release, 2 tap (press and release)
+    INPUT_CMD_QUIT
+} InputCommandType;
+
+typedef struct {
+    InputCommandType type;
+    int a, b;
+    float f;
+} InputCommand;
+
 
 // --- Global Constants ---
 
 // Mappable Keys Data
-static const MappableKey gMappableKeys[] = {
-    {KEY_A, "A"}, {KEY_B, "B"}, {KEY_C, "C"}, {KEY_D, "D"},
-    {KEY_E, "E"}, {KEY_F, "F"}, {KEY_G, "G"}, {KEY_H, "H"},
-    {KEY_I, "I"}, {KEY_J, "J"}, {KEY_K, "K"}, {KEY_L, "L"},
-    {KEY_M, "M"}, {KEY_N, "N"}, {KEY_O, "O"}, {KEY_P, "P"},
-    {KEY_Q, "Q"}, {KEY_R, "R"}, {KEY_S, "S"}, {KEY_T, "T"},
-    {KEY_U, "U"}, {KEY_V, "V"}, {KEY_W, "W"}, {KEY_X, "X"},
-    {KEY_Y, "Y"}, {KEY_Z, "Z"},
-    {KEY_1, "1"}, {KEY_2, "2"}, {KEY_3, "3"}, {KEY_4, "4"},
-    {KEY_5, "5"}, {KEY_6, "6"}, {KEY_7, "7"}, {KEY_8, "8"},
-    {KEY_9, "9"}, {KEY_0, "0"},
-    {KEY_ESC, "Esc"},
-    {KEY_SPACE, "Spc"}, {KEY_ENTER, "Ent"}, {KEY_BACKSPACE, "Bk"}, {KEY_TAB, "Tab"},
-    {KEY_LEFTCTRL, "Ctrl"}, {KEY_LEFTSHIFT, "Shft"}, {KEY_LEFTALT, "Alt"},
-    {KEY_UP, "Up"}, {KEY_DOWN, "Dn"}, {KEY_LEFT, "Lt"}, {KEY_RIGHT, "Rt"},
-    {BTN_LEFT, "LMB"}, {BTN_RIGHT, "RMB"},
+// Direct-indexed by keycode over the whole KEY_CNT range, so label lookups are O(1)
+static const KeyInfo kKeyInfo[KEY_CNT] = {
+  #define KEY_INFO_ENTRY(page, code, label) [code] = {label, page},
+  #define X(id, name, keys) keys(KEY_INFO_ENTRY, KEY_PAGE_##id)
+    KEY_PAGE_LIST
+  #undef X
+  #undef KEY_INFO_ENTRY
 };
-static const int gNumMappableKeys = sizeof(gMappableKeys) / sizeof(gMappableKeys[0]);
 
-// UInput integration 
-static int uinput_fd = -1;
+#define KEY_CODE_ENTRY(page, code, label) code,
+#define X(id, name, keys) static const uint16_t kKeys##id[] = {keys(KEY_CODE_ENTRY, 0)};
+KEY_PAGE_LIST
+#undef X
+#undef KEY_CODE_ENTRY
 
-static bool uinput_init(void) {
-    uinput_fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
-    if (uinput_fd < 0) { perror("Failed to open /dev/uinput"); return false; }
+static const KeyPage kKeyPages[KEY_PAGE_MAX] = {
+  #define X(id, name, keys) [KEY_PAGE_##id] = {name, kKeys##id, sizeof(kKeys##id) / sizeof(kKeys##id[0])},
+    KEY_PAGE_LIST
+  #undef X
+};
 
-    if (ioctl(uinput_fd, UI_SET_EVBIT, EV_REL) < 0) { perror("Failed to set EV_REL"); close(uinput_fd); return false; }
-    if (ioctl(uinput_fd, UI_SET_RELBIT, REL_X) < 0 || ioctl(uinput_fd, UI_SET_RELBIT, REL_Y) < 0) { perror("Failed to set REL_X/REL_Y"); close(uinput_fd); return false; }
-    if (ioctl(uinput_fd, UI_SET_EVBIT, EV_KEY) < 0) { perror("Failed to set EV_KEY"); close(uinput_fd); return false; }
+// --- Performance Counters ---
+// Cheap always-on counters, dumped to stderr on SIGUSR1:
+//   kill -USR1 $(pidof wlr_gamepad)
+
+// Main loop wakeup sources
+#define PERF_WAKE_LIST       \
+  X(WAYLAND, "wayland")      \
+  X(TOUCH,   "touch")        \
+  X(INPUT,   "input")        \
+  X(VOLDOWN, "voldown")      \
+  X(VOLUP,   "volup")        \
+  X(SIGNAL,  "signal")       \
+  X(CONTROL, "control")      \
+  X(TIMEOUT, "timeout")
 
-    const int extra_keys[] = {BTN_LEFT, BTN_RIGHT, KEY_VOLUMEDOWN, KEY_VOLUMEUP};
-    for (size_t i = 0; i < sizeof(extra_keys)/sizeof(extra_keys[0]); ++i) {
-        if (ioctl(uinput_fd, UI_SET_KEYBIT, extra_keys[i]) < 0) {
-            char err_msg[64];
-            snprintf(err_msg, sizeof(err_msg), "Failed to set keybit for extra key %d", extra_keys[i]);
-            perror(err_msg);
-            close(uinput_fd);
-            return false;
+typedef enum {
+  #define X(name, str) WAKE_##name,
+    PERF_WAKE_LIST
+  #undef X
+  WAKE_MAX
+} WakeSource;
+
+// Timed stages of a loop iteration
+#define PERF_STAGE_LIST      \
+  X(INPUT,  "input")         \
+  X(RENDER, "render")        \
+  X(SWAP,   "swap")
+
+typedef enum {
+  #define X(name, str) STAGE_##name,
+    PERF_STAGE_LIST
+  #undef X
+  STAGE_MAX
+} PerfStage;
+
+typedef struct {
+    uint64_t loopIterations;
+    uint64_t wakeups[WAKE_MAX];
+    uint64_t evdevEvents;          // struct input_event read from the touch device
+    uint64_t synReports;           // Touch frames (SYN_REPORT) processed
+    uint64_t synDropped;           // SYN_DROPPED: the kernel evdev buffer overflowed
+    uint64_t touchResyncs;         // Slot state read back with EVIOCGMTSLOTS after SYN_DROPPED
+    uint64_t touchResyncFailures;  // EVIOCGMTSLOTS failed, every contact was released instead
+    uint64_t queueOverflows;       // gInputEvents filled up and was flushed early (nothing is lost)
+    uint64_t queueHighWater;       // Most widget events pending at one flush
+    uint64_t eventsCoalesced;      // Key up + down pairs within one touch frame that were dropped
+    uint64_t uinputWrites;         // write() syscalls issued on the uinput fd
+    uint64_t framesRendered;
+    uint64_t framesSwapped;
+    uint64_t damagePixels;         // Area submitted as damage, summed over rendered frames
+    uint64_t surfacePixels;        // Full surface area, summed over rendered frames
+    uint64_t staticRebuilds;       // Static layer cache redrawn (GL overlay only)
+    uint64_t stageCalls[STAGE_MAX];
+    uint64_t stageCpuNs[STAGE_MAX];  // Thread CPU time
+    uint64_t stageWallNs[STAGE_MAX]; // Wall-clock time (includes blocking, e.g. vsync in swap)
+    uint64_t lastStageWallNs[STAGE_MAX];
+    uint64_t lastTouchToUinputNs;  // SYN_REPORT kernel timestamp -> first uinput write it caused
+    uint64_t maxTouchToUinputNs;
+    uint64_t sumTouchToUinputNs;
+    uint64_t touchToUinputCount;
+    uint64_t lastTouchToPhotonNs;  // Oldest undrawn touch frame -> wp_presentation time of the frame showing it
+    uint64_t maxTouchToPhotonNs;
+    uint64_t sumTouchToPhotonNs;
+    uint64_t touchToPhotonCount;
+    uint64_t framesPresented;      // Committed frames the compositor reported on screen
+    uint64_t framesLate;           // Presented more than two refresh periods after their commit
+    uint64_t framesDiscarded;      // Committed frames that were replaced or never shown
+    uint64_t framesUnmeasured;     // Committed without presentation feedback, every request was outstanding
+} PerfCounters;
+
+// Rolling once-per-second rates for the HUD
+typedef struct {
+    float evdevEvents;
+    float uinputWrites;
+    float framesRendered;
+} PerfRates;
+
+// Start timestamps of a timed stage
+typedef struct {
+    uint64_t wall;
+    uint64_t cpu;
+} PerfTimer;
+
+static const char *kPerfWakeNames[WAKE_MAX] = {
+  #define X(name, str) str,
+    PERF_WAKE_LIST
+  #undef X
+};
+
+static const char *kPerfStageNames[STAGE_MAX] = {
+  #define X(name, str) str,
+    PERF_STAGE_LIST
+  #undef X
+};
+
+// Each thread counts into its own block, so every field has a single writer: a field both
+// threads update (uinputWrites, wakeups) is the sum of the blocks, any other field is 0 in
+// the block of the thread that doesn't own it. Writers use relaxed atomic stores, which
+// never tear (64-bit counters on 32-bit ARM) and need no locked read-modify-write.
+// Readers on any thread go through PerfCounters_Read.
+typedef enum { PERF_THREAD_MAIN, PERF_THREAD_INPUT, PERF_THREAD_MAX } PerfThread;
+static PerfCounters gPerfThreads[PERF_THREAD_MAX];
+static __thread PerfCounters *gPerfMine = &gPerfThreads[PERF_THREAD_MAIN];
+
+#define PERF_SET(field, v) __atomic_store_n(&gPerfMine->field, (v), __ATOMIC_RELAXED)
+#define PERF_ADD(field, n) PERF_SET(field, gPerfMine->field + (n))
+#define PERF_INC(field)    PERF_ADD(field, 1)
+#define PERF_MAX(field, v) do { uint64_t v_ = (v); if (v_ > gPerfMine->field) PERF_SET(field, v_); } while (0)
+
+// Counters at the previous report, for per-second rates. One per consumer, so a control
+// "stats" query doesn't shorten the window of the next SIGUSR1 dump and vice versa.
+typedef struct {
+    PerfCounters last;
+    uint64_t lastNs;
+} PerfWindow;
+
+static uint64_t gPerfStartNs = 0;
+static PerfWindow gPerfDumpWindow = {0};    // SIGUSR1, see PerfStats_Dump
+static PerfWindow gPerfControlWindow = {0}; // Control socket "stats"
+static PerfRates gPerfRates = {0};
+static PerfCounters gPerfLastTick = {0};
+static uint64_t gPerfLastTickNs = 0;
+// Timestamp of the oldest touch frame not yet answered by uinput. Per thread: only the thread
+// that reads the touchscreen sets it, so uinput writes from other threads never see it.
+static __thread uint64_t gPendingTouchNs = 0;
+// Touch -> photon: the input thread keeps the oldest touch frame no committed frame has
+// shown yet and hands it to the renderer in the snapshot. The main thread marks it drawn
+// when it commits (or has nothing to redraw for) the snapshot carrying it.
+static uint64_t gUndrawnTouchNs = 0;         // Input thread
+static atomic_uint_fast64_t gDrawnTouchNs;   // Main thread
+
+static uint64_t clock_ns(clockid_t clk) {
+    struct timespec ts;
+    clock_gettime(clk, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// Totals over all threads' blocks, see gPerfThreads
+static void PerfCounters_Read(PerfCounters *out) {
+    uint64_t *dst = (uint64_t *)out;
+    memset(out, 0, sizeof(*out));
+    for (int t = 0; t < PERF_THREAD_MAX; ++t) {
+        const uint64_t *src = (const uint64_t *)&gPerfThreads[t];
+        for (size_t i = 0; i < sizeof(PerfCounters) / sizeof(uint64_t); ++i) dst[i] += __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+    }
+}
+
+static PerfTimer PerfTimer_Start(void) {
+    return (PerfTimer){clock_ns(CLOCK_MONOTONIC), clock_ns(CLOCK_THREAD_CPUTIME_ID)};
+}
+
+static void PerfTimer_Stop(PerfStage stage, PerfTimer t) {
+    uint64_t wall = clock_ns(CLOCK_MONOTONIC) - t.wall;
+    PERF_INC(stageCalls[stage]);
+    PERF_ADD(stageWallNs[stage], wall);
+    PERF_SET(lastStageWallNs[stage], wall);
+    PERF_ADD(stageCpuNs[stage], clock_ns(CLOCK_THREAD_CPUTIME_ID) - t.cpu);
+}
+
+// Called for every uinput write; the first one after a touch frame closes the latency measurement
+static void PerfStats_UinputWrite(int writes) {
+    PERF_ADD(uinputWrites, writes);
+    if (gPendingTouchNs) {
+        uint64_t latency = clock_ns(CLOCK_MONOTONIC) - gPendingTouchNs;
+        PERF_SET(lastTouchToUinputNs, latency);
+        PERF_ADD(sumTouchToUinputNs, latency);
+        PERF_INC(touchToUinputCount);
+        PERF_MAX(maxTouchToUinputNs, latency);
+        gPendingTouchNs = 0;
+    }
+}
+
+// Refresh gPerfRates at most once per second. Only runs when the loop wakes anyway.
+static void PerfStats_Tick(void) {
+    uint64_t now = clock_ns(CLOCK_MONOTONIC);
+    float window = (now - gPerfLastTickNs) / 1e9f;
+    if (window < 1.0f) return;
+    PerfCounters c;
+    PerfCounters_Read(&c);
+    gPerfRates.evdevEvents = (c.evdevEvents - gPerfLastTick.evdevEvents) / window;
+    gPerfRates.uinputWrites = (c.uinputWrites - gPerfLastTick.uinputWrites) / window;
+    gPerfRates.framesRendered = (c.framesRendered - gPerfLastTick.framesRendered) / window;
+    gPerfLastTick = c;
+    gPerfLastTickNs = now;
+}
+
+// Room for PerfStats_Format: a fixed part plus a line per stage and an entry per wakeup source
+#define PERF_STATS_SIZE (2048 + (WAKE_MAX + STAGE_MAX) * 128)
+
+// Format counters into buf: totals plus rates since win's previous report, then restart win.
+// Returns the length the full text needs, like snprintf; len or more means it was truncated.
+static size_t PerfStats_Format(PerfWindow *win, char *buf, size_t len) {
+    uint64_t now = clock_ns(CLOCK_MONOTONIC);
+    PerfCounters cur;
+    PerfCounters_Read(&cur);
+    const PerfCounters *c = &cur, *p = &win->last;
+    double window = (now - win->lastNs) / 1e9;
+    if (window <= 0.0) window = 1e-9;
+    size_t off = 0;
+
+#define APPEND(...) do { \
+        int n_ = snprintf(buf + off, off < len ? len - off : 0, __VA_ARGS__); \
+        if (n_ > 0) off += (size_t)n_; \
+    } while (0)
+
+    APPEND("[STATS] uptime %.1fs, window %.1fs, loop iterations %llu (%.1f/s)\n",
+           (now - gPerfStartNs) / 1e9, window,
+           (unsigned long long)c->loopIterations, (c->loopIterations - p->loopIterations) / window);
+    APPEND("[STATS] wakeups/s:");
+    for (int i = 0; i < WAKE_MAX; ++i) {
+        APPEND(" %s %.1f", kPerfWakeNames[i], (c->wakeups[i] - p->wakeups[i]) / window);
+    }
+    APPEND("\n");
+    APPEND("[STATS] evdev events %llu (%.1f/s), uinput writes %llu (%.1f/s)\n",
+           (unsigned long long)c->evdevEvents, (c->evdevEvents - p->evdevEvents) / window,
+           (unsigned long long)c->uinputWrites, (c->uinputWrites - p->uinputWrites) / window);
+    uint64_t surfacePixels = c->surfacePixels - p->surfacePixels;
+    APPEND("[STATS] frames rendered %llu (%.1f/s), swapped %llu (%.1f/s), damage %.1f%% of surface, "
+           "static layer rebuilds %llu\n",
+           (unsigned long long)c->framesRendered, (c->framesRendered - p->framesRendered) / window,
+           (unsigned long long)c->framesSwapped, (c->framesSwapped - p->framesSwapped) / window,
+           surfacePixels ? (c->damagePixels - p->damagePixels) * 100.0 / surfacePixels : 0.0,
+           (unsigned long long)c->staticRebuilds);
+    uint64_t latencyCount = c->touchToUinputCount - p->touchToUinputCount;
+    APPEND("[STATS] touch->uinput latency last %.1fus, avg %.1fus, max %.1fus (since start)\n",
+           c->lastTouchToUinputNs / 1e3,
+           latencyCount ? (c->sumTouchToUinputNs - p->sumTouchToUinputNs) / 1e3 / latencyCount : 0.0,
+           c->maxTouchToUinputNs / 1e3);
+    uint64_t photonCount = c->touchToPhotonCount - p->touchToPhotonCount;
+    APPEND("[STATS] touch->photon latency last %.1fus, avg %.1fus, max %.1fus (since start); "
+           "frames presented %llu, late %llu, discarded %llu, unmeasured %llu\n",
+           c->lastTouchToPhotonNs / 1e3,
+           photonCount ? (c->sumTouchToPhotonNs - p->sumTouchToPhotonNs) / 1e3 / photonCount : 0.0,
+           c->maxTouchToPhotonNs / 1e3, (unsigned long long)c->framesPresented,
+           (unsigned long long)c->framesLate, (unsigned long long)c->framesDiscarded,
+           (unsigned long long)c->framesUnmeasured);
+    APPEND("[STATS] touch frames %llu (%.1f/s), SYN_DROPPED %llu (resyncs %llu, failed %llu), "
+           "event queue early flushes %llu\n",
+           (unsigned long long)c->synReports, (c->synReports - p->synReports) / window,
+           (unsigned long long)c->synDropped, (unsigned long long)c->touchResyncs,
+           (unsigned long long)c->touchResyncFailures, (unsigned long long)c->queueOverflows);
+    APPEND("[STATS] event queue high water %llu, coalesced key up/down pairs %llu\n",
+           (unsigned long long)c->queueHighWater, (unsigned long long)c->eventsCoalesced);
+    APPEND("[STATS] log messages dropped %llu\n", (unsigned long long)atomic_load(&gLogDropped));
+    for (int i = 0; i < STAGE_MAX; ++i) {
+        uint64_t calls = c->stageCalls[i] - p->stageCalls[i];
+        uint64_t cpu = c->stageCpuNs[i] - p->stageCpuNs[i];
+        uint64_t wall = c->stageWallNs[i] - p->stageWallNs[i];
+        APPEND("[STATS] %-6s cpu %.2f%% (%.1fus/call), wall %.1fus/call, %llu calls\n",
+               kPerfStageNames[i], cpu / (window * 1e9) * 100.0,
+               calls ? cpu / 1e3 / calls : 0.0, calls ? wall / 1e3 / calls : 0.0,
+               (unsigned long long)calls);
+    }
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) == 0) {
+        APPEND("[STATS] process cpu: user %ld.%03lds, sys %ld.%03lds\n",
+               (long)ru.ru_utime.tv_sec, (long)ru.ru_utime.tv_usec / 1000,
+               (long)ru.ru_stime.tv_sec, (long)ru.ru_stime.tv_usec / 1000);
+    }
+#undef APPEND
+
+    win->last = cur;
+    win->lastNs = now;
+    return off;
+}
+
+static void PerfStats_Dump(void) {
+    char buf[PERF_STATS_SIZE];
+    size_t need = PerfStats_Format(&gPerfDumpWindow, buf, sizeof(buf));
+    fputs(buf, stderr);
+    if (need >= sizeof(buf)) fprintf(stderr, "[STATS] truncated, %zu of %zu bytes\n", sizeof(buf) - 1, need);
+}
+
+// --- Trace ---
+// --trace PATH records a timestamped span for every stage of both loops into a
+// preallocated per-thread ring, and writes the newest spans as Chrome trace JSON (open in
+// ui.perfetto.dev or chrome://tracing) on SIGUSR2 and at exit:
+//   kill -USR2 $(pidof wlr_gamepad)
+// Recording is two clock reads and a store, so it runs on the real-time path too. Threads
+// that never called Trace_BindThread (and every thread without --trace) record nothing.
+
+#define TRACE_RING_SIZE (1 << 17) // Spans per thread, power of two
+
+// X(id, name, arg name or NULL); spans with a zero duration are instant events
+#define TRACE_SPAN_LIST                                          \
+  X(POLL,        "poll wait",              NULL)                 \
+  X(DISPATCH,    "wayland dispatch",       NULL)                 \
+  X(RENDER,      "RenderFrame",            NULL)                 \
+  X(SWAP,        "swap",                   NULL)                 \
+  X(EVDEV_READ,  "evdev read",             "events")             \
+  X(EVDEV_EVENT, "handle_evdev_event",     "type")               \
+  X(WIDGETS,     "ProcessAllWidgetsInput", NULL)                 \
+  X(FLUSH,       "InputState_Flush",       "writes")             \
+  X(TOUCH_FRAME, "touch frame",            "us since kernel")    \
+  X(UINPUT_KEY,  "uinput key",             "code (negative: up)")
+
+typedef enum {
+  #define X(id, name, arg) TRACE_##id,
+    TRACE_SPAN_LIST
+  #undef X
+  TRACE_MAX
+} TraceSpan;
+
+#define TRACE_THREAD_LIST \
+  X(MAIN,  "main")        \
+  X(INPUT, "input")
+
+typedef enum {
+  #define X(id, name) TRACE_THREAD_##id,
+    TRACE_THREAD_LIST
+  #undef X
+  TRACE_THREAD_MAX
+} TraceThread;
+
+typedef struct {
+    uint64_t start;   // CLOCK_MONOTONIC ns
+    uint64_t dur;     // ns, 0 for an instant event
+    int32_t arg;
+    uint32_t span;    // TraceSpan
+} TraceRecord;
+
+// Single writer (the bound thread), read by Trace_Write on the main thread
+typedef struct {
+    TraceRecord *records;
+    atomic_uint_fast64_t count; // Records written since start; the ring holds the newest
+} TraceRing;
+
+static const char *kTraceSpanNames[TRACE_MAX] = {
+  #define X(id, name, arg) name,
+    TRACE_SPAN_LIST
+  #undef X
+};
+
+static const char *kTraceArgNames[TRACE_MAX] = {
+  #define X(id, name, arg) arg,
+    TRACE_SPAN_LIST
+  #undef X
+};
+
+static const char *kTraceThreadNames[TRACE_THREAD_MAX] = {
+  #define X(id, name) name,
+    TRACE_THREAD_LIST
+  #undef X
+};
+
+static const char *gTracePath = NULL;
+static TraceRing gTraceRings[TRACE_THREAD_MAX];
+static uint64_t gTraceStartNs = 0;
+static __thread TraceRing *gTraceRing = NULL;
+
+// Allocate and pre-fault the rings, before the input thread starts and memory is locked
+static bool Trace_Init(const char *path) {
+    for (int t = 0; t < TRACE_THREAD_MAX; ++t) {
+        gTraceRings[t].records = malloc(TRACE_RING_SIZE * sizeof(TraceRecord));
+        if (!gTraceRings[t].records) { perror("trace buffer"); return false; }
+        memset(gTraceRings[t].records, 0, TRACE_RING_SIZE * sizeof(TraceRecord));
+    }
+    gTracePath = path;
+    gTraceStartNs = clock_ns(CLOCK_MONOTONIC);
+    return true;
+}
+
+static void Trace_BindThread(TraceThread thread) {
+    if (gTracePath) gTraceRing = &gTraceRings[thread];
+}
+
+// Start of a span; pass the result to Trace_End
+static uint64_t Trace_Begin(void) {
+    return gTraceRing ? clock_ns(CLOCK_MONOTONIC) : 0;
+}
+
+static void Trace_Record(TraceRing *ring, TraceSpan span, uint64_t start, uint64_t dur, int32_t arg) {
+    uint64_t n = atomic_load_explicit(&ring->count, memory_order_relaxed);
+    ring->records[n & (TRACE_RING_SIZE - 1)] = (TraceRecord){start, dur, arg, span};
+    atomic_store_explicit(&ring->count, n + 1, memory_order_release);
+}
+
+static void Trace_End(TraceSpan span, uint64_t start, int32_t arg) {
+    TraceRing *ring = gTraceRing;
+    if (!ring || !start) return;
+    uint64_t now = clock_ns(CLOCK_MONOTONIC);
+    Trace_Record(ring, span, start, now > start ? now - start : 1, arg);
+}
+
+static void Trace_Instant(TraceSpan span, int32_t arg) {
+    TraceRing *ring = gTraceRing;
+    if (!ring) return;
+    Trace_Record(ring, span, clock_ns(CLOCK_MONOTONIC), 0, arg);
+}
+
+// Write the newest spans of every thread to gTracePath. Main thread; the input thread
+// keeps recording meanwhile, so a record it overwrote during the copy is skipped.
+static void Trace_Write(void) {
+    if (!gTracePath) return;
+    FILE *f = fopen(gTracePath, "w");
+    if (!f) { fprintf(stderr, "[TRACE] %s: %s\n", gTracePath, strerror(errno)); return; }
+    int pid = (int)getpid();
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"wlr_gamepad\"}}", pid);
+    uint64_t written = 0;
+    for (int t = 0; t < TRACE_THREAD_MAX; ++t) {
+        const TraceRing *ring = &gTraceRings[t];
+        fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                pid, t + 1, kTraceThreadNames[t]);
+        uint64_t end = atomic_load_explicit(&ring->count, memory_order_acquire);
+        uint64_t begin = end > TRACE_RING_SIZE ? end - TRACE_RING_SIZE : 0;
+        for (uint64_t i = begin; i < end; ++i) {
+            TraceRecord r = ring->records[i & (TRACE_RING_SIZE - 1)];
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(&ring->count, memory_order_relaxed) - i > TRACE_RING_SIZE) continue;
+            if (r.span >= TRACE_MAX || r.start < gTraceStartNs) continue;
+            double ts = (r.start - gTraceStartNs) / 1e3;
+            if (r.dur) {
+                fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d",
+                        kTraceSpanNames[r.span], ts, r.dur / 1e3, pid, t + 1);
+            } else {
+                fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d",
+                        kTraceSpanNames[r.span], ts, pid, t + 1);
+            }
+            if (kTraceArgNames[r.span]) fprintf(f, ",\"args\":{\"%s\":%d}", kTraceArgNames[r.span], (int)r.arg);
+            fputc('}', f);
+            written++;
         }
     }
+    fprintf(f, "\n]}\n");
+    if (fclose(f) != 0) { fprintf(stderr, "[TRACE] %s: %s\n", gTracePath, strerror(errno)); return; }
+    fprintf(stderr, "[TRACE] wrote %llu events to %s\n", (unsigned long long)written, gTracePath);
+}
+
+// UInput integration 
+static int uinput_fd = -1;
+#define KEY_WORDS (KEY_CNT / (8 * sizeof(long)) + 1)
+// Keys currently held on the uinput device. Written by the input thread and by the main
+// thread (forwarded volume keys), hence atomic.
+static unsigned long gKeyDown[KEY_WORDS];
+
+static bool uinput_key_is_down(int keycode) {
+    unsigned long word = __atomic_load_n(&gKeyDown[keycode / (8 * sizeof(long))], __ATOMIC_RELAXED);
+    return (word >> (keycode % (8 * sizeof(long)))) & 1UL;
+}
 
-    for (int i = 0; i < gNumMappableKeys; ++i) {
-        if (ioctl(uinput_fd, UI_SET_KEYBIT, gMappableKeys[i].keycode) < 0) {
+// Creates the device with every key the remap menu offers (kKeyInfo) plus the trackpad and
+// volume keys, once: uinput can't add keys to a live device, and recreating it would look
+// like the controller being unplugged to the game.
+static bool uinput_init(void) {
+    int fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) { perror("Failed to open /dev/uinput"); return false; }
+
+    if (ioctl(fd, UI_SET_EVBIT, EV_REL) < 0) { perror("Failed to set EV_REL"); close(fd); return false; }
+    if (ioctl(fd, UI_SET_RELBIT, REL_X) < 0 || ioctl(fd, UI_SET_RELBIT, REL_Y) < 0) { perror("Failed to set REL_X/REL_Y"); close(fd); return false; }
+    if (ioctl(fd, UI_SET_EVBIT, EV_KEY) < 0) { perror("Failed to set EV_KEY"); close(fd); return false; }
+
+    int numKeys = 0;
+    for (int keycode = 1; keycode < KEY_CNT; ++keycode) {
+        bool extra = keycode == BTN_LEFT || keycode == BTN_RIGHT || keycode == KEY_VOLUMEDOWN || keycode == KEY_VOLUMEUP;
+        if (!kKeyInfo[keycode].label && !extra) continue;
+        if (ioctl(fd, UI_SET_KEYBIT, keycode) < 0) {
             char err_msg[64];
-            snprintf(err_msg, sizeof(err_msg), "Failed to set keybit for keycode %d", gMappableKeys[i].keycode);
+            snprintf(err_msg, sizeof(err_msg), "Failed to set keybit for keycode %d", keycode);
             perror(err_msg);
-            close(uinput_fd);
+            close(fd);
             return false;
         }
+        numKeys++;
     }
 
-    if (ioctl(uinput_fd, UI_SET_EVBIT, EV_SYN) < 0) { perror("Failed to set EV_SYN"); close(uinput_fd); return false; }
+    if (ioctl(fd, UI_SET_EVBIT, EV_SYN) < 0) { perror("Failed to set EV_SYN"); close(fd); return false; }
 
     struct uinput_user_dev uidev;
     memset(&uidev, 0, sizeof(uidev));
@@ -237,46 +1123,79 @@ static bool uinput_init(void) {
     uidev.id.product = 0x5678;
     uidev.id.version = 1;
 
-    if (write(uinput_fd, &uidev, sizeof(uidev)) < 0) { perror("Failed to write uinput_user_dev"); close(uinput_fd); return false; }
-    if (ioctl(uinput_fd, UI_DEV_CREATE) < 0) { perror("Failed to create uinput device"); close(uinput_fd); return false; }
-
-    fprintf(stderr, "[UINPUT] initialized: fd=%d\n", uinput_fd);
+    if (write(fd, &uidev, sizeof(uidev)) < 0) { perror("Failed to write uinput_user_dev"); close(fd); return false; }
+    if (ioctl(fd, UI_DEV_CREATE) < 0) { perror("Failed to create uinput device"); close(fd); return false; }
+    uinput_fd = fd;
+    fprintf(stderr, "[UINPUT] initialized: fd=%d, %d keys\n", uinput_fd, numKeys);
     return true;
 }
 
+// Each report goes out in a single write(), so reports from the input and main threads
+// never interleave on the device.
 static void uinput_move(int dx, int dy) {
-    if (uinput_fd < 0) return;
-    struct input_event ev;
-    memset(&ev, 0, sizeof(ev));
-    ev.type = EV_REL;
-    ev.code = REL_X;
-    ev.value = dx;
-    write(uinput_fd, &ev, sizeof(ev));
-    ev.code = REL_Y;
-    ev.value = dy;
-    write(uinput_fd, &ev, sizeof(ev));
-    ev.type = EV_SYN;
-    ev.code = SYN_REPORT;
-    ev.value = 0;
-    write(uinput_fd, &ev, sizeof(ev));
+    int fd = uinput_fd;
+    if (fd < 0) return;
+    struct input_event ev[3];
+    memset(ev, 0, sizeof(ev));
+    ev[0].type = EV_REL;
+    ev[0].code = REL_X;
+    ev[0].value = dx;
+    ev[1].type = EV_REL;
+    ev[1].code = REL_Y;
+    ev[1].value = dy;
+    ev[2].type = EV_SYN;
+    ev[2].code = SYN_REPORT;
+    write(fd, ev, sizeof(ev));
+    PerfStats_UinputWrite(1);
 }
 
 static void uinput_key(int keycode, bool pressed) {
-    if (uinput_fd < 0) return;
-    struct input_event ev;
-    memset(&ev, 0, sizeof(ev));
-    ev.type = EV_KEY;
-    ev.code = keycode;
-    ev.value = pressed ? 1 : 0;
-    write(uinput_fd, &ev, sizeof(ev));
-    ev.type = EV_SYN;
-    ev.code = SYN_REPORT;
-    ev.value = 0;
-    write(uinput_fd, &ev, sizeof(ev));
+    int fd = uinput_fd;
+    if (fd < 0) return;
+    if (keycode >= 0 && keycode < KEY_CNT) {
+        unsigned long bit = 1UL << (keycode % (8 * sizeof(long)));
+        unsigned long *word = &gKeyDown[keycode / (8 * sizeof(long))];
+        if (pressed) __atomic_fetch_or(word, bit, __ATOMIC_RELAXED);
+        else __atomic_fetch_and(word, ~bit, __ATOMIC_RELAXED);
+    }
+    struct input_event ev[2];
+    memset(ev, 0, sizeof(ev));
+    ev[0].type = EV_KEY;
+    ev[0].code = keycode;
+    ev[0].value = pressed ? 1 : 0;
+    ev[1].type = EV_SYN;
+    ev[1].code = SYN_REPORT;
+    write(fd, ev, sizeof(ev));
+    PerfStats_UinputWrite(1);
+    Trace_Instant(TRACE_UINPUT_KEY, pressed ? keycode : -keycode);
+}
+
+// Key up for exactly the keys gKeyDown holds. Only write() and atomics, so it is also safe
+// from the fatal signal handler.
+static void uinput_release_all(void) {
+    const size_t bits = 8 * sizeof(long);
+    for (size_t w = 0; w < KEY_WORDS; ++w) {
+        unsigned long word = __atomic_load_n(&gKeyDown[w], __ATOMIC_RELAXED);
+        for (; word; word &= word - 1) uinput_key((int)(w * bits + __builtin_ctzl(word)), false);
+    }
+}
+
+// Fatal signals: a crash must not leave a key held down in the game
+static void uinput_crash_handler(int sig) {
+    uinput_release_all();
+    raise(sig); // SA_RESETHAND restored the default action
+}
+
+static void uinput_install_crash_handler(void) {
+    struct sigaction sa = {.sa_handler = uinput_crash_handler, .sa_flags = SA_RESETHAND};
+    sigemptyset(&sa.sa_mask);
+    const int fatal[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+    for (size_t i = 0; i < sizeof(fatal) / sizeof(fatal[0]); ++i) sigaction(fatal[i], &sa, NULL);
 }
 
 static void uinput_destroy(void) {
     if (uinput_fd < 0) return;
+    uinput_release_all();
     fprintf(stderr, "[UINPUT] destroying device fd=%d\n", uinput_fd);
     ioctl(uinput_fd, UI_DEV_DESTROY);
     close(uinput_fd);
@@ -287,6 +1206,8 @@ static void uinput_destroy(void) {
 static const int kKeyGridCols = 8;
 static const float kKeyButtonSize = 60.0f;
 static const float kKeyButtonSpacing = 10.0f;
+static const float kKeyGridTitlePixelSize = 2.0f;
+static const float kKeyGridTitlePadding = 10.0f;
 
 // Grid layout helper struct for arranging items in a grid
 typedef struct {
@@ -371,9 +1292,15 @@ static const char* availablePropertyNames[] = {"Remap", "Delete" /*, ... */};
 static const int numAvailablePropertyActions = sizeof(availablePropertyActions) / sizeof(availablePropertyActions[0]);
 
 // Max Limits
+#ifndef MAX_WIDGETS // Overridable for benchmarks with large layouts
 #define MAX_WIDGETS 15
-#define MAX_MT_SLOTS 10
-#define MAX_INPUT_EVENTS 64
+#endif
+#define MAX_MT_SLOTS 64     // Slots tracked at most; the device's own count is gNumTouchSlots
+#define DEFAULT_MT_SLOTS 10 // When the device doesn't report ABS_MT_SLOT
+// Widget -> uinput queue. Between two flushes an analog widget reports at most 4 direction
+// changes per touch frame and a button one press and one release; a full queue is
+// flushed early rather than dropping anything.
+#define INPUT_EVENT_QUEUE_SIZE (MAX_WIDGETS * 8)
 
 // UI Constants: Positioning and Sizes
 static const float kEditButtonX = 10.0f, kEditButtonY = 10.0f;
@@ -386,6 +1313,10 @@ static const float kPropsButtonX = kAddButtonX + kAddButtonW + 10.0f;
 static const float kPropsButtonY = kAddButtonY;
 static const float kPropsButtonW = kAddButtonW;
 static const float kPropsButtonH = kAddButtonH;
+static const float kHudButtonX = kPropsButtonX + kPropsButtonW + 10.0f;
+static const float kHudButtonY = kPropsButtonY;
+static const float kHudButtonW = kPropsButtonW;
+static const float kHudButtonH = kPropsButtonH;
 static const float kHandleSize = 20.0f;
 
 // Add constant for outline thickness
@@ -410,10 +1341,12 @@ static const Color kColorDisabled = {150, 150, 150, 255}; // Greyed out color fo
 // Master opacity for entire UI [0.0 .. 1.0]
 static float gMasterOpacity = 0.5f;
 // Helper macro to apply master opacity
-#define SET_COLOR(c) glColor4ub((c).r, (c).g, (c).b, (GLubyte)((c).a * ((gAppState == APP_STATE_RUNNING) ? gMasterOpacity : 1.0f)))
+#define DRAW_ALPHA(c) ((uint8_t)((c).a * ((gView->appState == APP_STATE_RUNNING) ? gMasterOpacity : 1.0f)))
+#define SET_COLOR(c) glColor4ub((c).r, (c).g, (c).b, DRAW_ALPHA(c))
+#define SW_COLOR(c) ((Color){(c).r, (c).g, (c).b, DRAW_ALPHA(c)})
 
-// Input
-static const float kTrackpadSensitivity = 1.0f;
+// Input (sensitivity and opacity are adjustable over the control socket)
+static float gTrackpadSensitivity = 1.0f;
 
 // --- Global Variables ---
 
@@ -432,6 +1365,7 @@ static int gRemapAction = -1;        // Which direction/action is being remapped
 
 // UI Interaction State
 static int gLastUIFinger = -1;
+static bool gHudVisible = false;     // Performance HUD, toggled by the "Perf" button in edit mode
 
 // Scaled UI Values (calculated at runtime)
 static float gScaledKeyButtonSize = 60.0f;
@@ -439,11 +1373,42 @@ static float gScaledKeyButtonSpacing = 10.0f;
 
 // Cached layout for key selection grid (recomputed on resize)
 static GridLayout gKeyGridLayout = {0};
+static int gKeyPage = 0; // KeyPageId the key selection menu shows
 
+// The widget, application and UI state above is owned by the input thread. The renderer and control queries on the
+// main thread read this copy of it instead, published after every input batch.
+typedef struct {
+    Widget widgets[MAX_WIDGETS];
+    int numWidgets;
+    ApplicationState appState;
+    int selectedWidgetId;
+    int remappingWidgetId;
+    int remapAction;
+    bool hudVisible;
+    bool overlayActive;
+    bool landscape;
+    float sensitivity;
+    int width, height;
+    GridLayout keyGrid;
+    int keyPage;
+    unsigned cmdSeq; // Input commands applied so far
+    uint64_t touchNs; // Oldest touch frame not yet on screen (kernel timestamp), see gUndrawnTouchNs
+} UiSnapshot;
+
+static UiSnapshot gSnapshots[3];           // Triple buffer, see Snapshot_Publish
+static const UiSnapshot *gView = &gSnapshots[2]; // Main thread's current snapshot
+
+#ifndef WLR_GAMEPAD_HEADLESS
 // Wayland and EGL Globals
 static struct wl_display *display = NULL;
 static struct wl_registry *registry = NULL;
 static struct wl_compositor *compositor = NULL;
+static struct wl_shm *gShm = NULL; // Only bound for --renderer shm
+static struct wl_subcompositor *gSubcompositor = NULL; // Only bound for --surfaces widget
+static struct wp_viewporter *gViewporter = NULL;       // Only bound for --render-scale below 1
+static struct wp_viewport *gViewport = NULL;           // Scales the layer surface's buffer up
+static struct wp_presentation *gPresentation = NULL;   // Presentation feedback, for touch -> photon latency
+static clockid_t gPresentationClock = CLOCK_MONOTONIC; // Clock of wp_presentation timestamps
 static struct zwlr_layer_shell_v1 *layer_shell = NULL;
 static struct wl_surface *surface = NULL;
 static struct zwlr_layer_surface_v1 *layer_surface = NULL;
@@ -451,27 +1416,53 @@ static struct wl_egl_window *egl_window = NULL;
 static EGLDisplay egl_display = EGL_NO_DISPLAY;
 static EGLContext egl_context = EGL_NO_CONTEXT;
 static EGLSurface egl_surface = EGL_NO_SURFACE;
+static EGLConfig egl_config;
 static EGLint egl_major, egl_minor;
-static int width = 0, height = 0;
+static int gSurfaceWidth = 0, gSurfaceHeight = 0; // Last configure, main thread
+static struct wl_callback *gFrameCallback = NULL;  // Outstanding wl_surface.frame, see RenderFrame
+static Renderer gRenderer = RENDERER_GL;           // --renderer, fixed at startup
+static SurfaceMode gSurfaceMode = SURFACES_OVERLAY; // --surfaces, fixed at startup
+// --render-scale: buffer pixels per surface pixel. Buffers are this much smaller and
+// wp_viewporter scales them back up; layout, hit-testing and touch mapping stay in
+// surface coordinates, only the final rasterization sees the scale.
+static float gRenderScale = 1.0f;
+static SwCanvas gCanvas;                           // Buffer being drawn by the shm renderer
+#endif
+static int width = 0, height = 0; // Input thread's copy, see INPUT_CMD_RESIZE
 
-// Input Event Queue
-static InputEvent gInputEvents[MAX_INPUT_EVENTS];
-static int gInputEventCount = 0;
+// Input Event Queue: ring of events queued since the last InputState_Flush
+static InputEvent gInputEvents[INPUT_EVENT_QUEUE_SIZE];
+static unsigned gInputEventHead = 0;     // Next position to write
+static unsigned gInputEventTail = 0;     // Next position to flush
+static unsigned gPendingKeyEvent[KEY_CNT]; // 1 + position of the newest queued event per key, 0 if none
+static unsigned gTouchFrame = 0;         // Counts SYN_REPORTs, events of one frame may coalesce
 
 // Raw Touch Input (evdev)
 static MTSlot mt_slots[MAX_MT_SLOTS] = {0};
+static int gNumTouchSlots = DEFAULT_MT_SLOTS; // ABS_MT_SLOT maximum + 1, see init_touch_device
+_Static_assert(MAX_MT_SLOTS <= 64, "slot masks are uint64_t");
+// Bit s set: slot s changed. gSyncSlots is consumed by the next SYN_REPORT, gDirtySlots
+// collects those frames for the next ProcessAllWidgetsInput, so both only visit slots
+// that actually changed instead of every slot and every widget.
+static uint64_t gSyncSlots = 0;
+static uint64_t gDirtySlots = 0;
+static bool gProcessAllWidgets = true; // Next ProcessAllWidgetsInput runs every widget (layout, mode, resize)
+static int gChangedWidgets[MAX_MT_SLOTS]; // Widgets the last ProcessAllWidgetsInput ran, for InputState_Update
+static int gNumChangedWidgets = 0;
+static bool gChangedAllWidgets = true;   // It ran all of them (or none could be skipped)
+
+// Bit i: gWidgets[i] is held, pressed or deflected; the rest are at rest, see Live Widgets
+#define WIDGET_LIVE_WORDS ((MAX_WIDGETS + 63) / 64)
+static uint64_t gLiveWidgets[WIDGET_LIVE_WORDS];
+static bool gLiveWidgetsStale = true; // gWidgets moved or were reset, recompute before processing
 static int gTouchDevFd = -1;
 static int touch_min_x = 0, touch_max_x = 0;
 static int touch_min_y = 0, touch_max_y = 0;
 static int current_slot = 0; // Current slot being processed by evdev
-static SlotMode slot_mode[MAX_MT_SLOTS] = {SLOT_IDLE};
-static double track_last_x[MAX_MT_SLOTS];
-static double track_last_y[MAX_MT_SLOTS];
-static double track_accum_x[MAX_MT_SLOTS];
-static double track_accum_y[MAX_MT_SLOTS];
-static bool track_moved[MAX_MT_SLOTS];
+static bool gTouchDropped = false; // SYN_DROPPED seen, discarding until the next SYN_REPORT
 static bool gLandscapeMode = false;
 static bool gViewportChanged = true;
+static bool gRenderRequested = true; // Main thread: a change outside the snapshot needs a frame (opacity)
 
 // Overlay toggle globals
 static int gVolDevFd = -1;
@@ -490,12 +1481,13 @@ static struct timespec gVolUpTs;
 // Widget Specific Handlers (Generated by X-Macro)
 #define X(name, func) \
   void func##_draw   (Widget *w); \
-  void func##_process(Widget *w);
+  bool func##_process(Widget *w);
 WIDGET_TYPE_LIST
 #undef X
 
 // Input Handling
 static void InputState_Update(void);
+static void InputState_RemoveWidget(int index);
 static void InputState_Flush(void);
 static void init_touch_device(const char *device);
 static void handle_evdev_event(const struct input_event *ev);
@@ -518,29 +1510,111 @@ static int find_input_device(int ev_type, int ev_code) {
     return -1;
 }
 
-// Toggle overlay on/off by grabbing/ungrabbing the touch device
-static void toggle_overlay(void) {
-    gOverlayActive = !gOverlayActive;
-    ioctl(gTouchDevFd, EVIOCGRAB, gOverlayActive);
-    // Reset all touch state to avoid stale slots blocking new input
-    for (int i = 0; i < MAX_MT_SLOTS; ++i) {
+// --- Touch Prediction ---
+// With --predict MS every contact keeps its last few positions with their kernel
+// timestamps (input_event.time of the SYN_REPORT). Joysticks then read their contact
+// resampled to one common time for the whole batch, the processing time plus the horizon,
+// instead of wherever it was at its last report, so the output and the dot drawn from it
+// lead by a few milliseconds rather than lag by up to a touch sampling period.
+//
+// Overshoot is bounded: the extrapolated offset is never longer than the last real step,
+// a contact whose last two steps point in different directions (a flick turning round)
+// is not extrapolated, and a contact that stops reporting for 1.5 sampling periods is
+// stationary, which a timeout on the input thread settles back to its raw position.
+
+#define SLOT_HISTORY_SIZE 4                     // Power of two
+#define PREDICT_MAX_MS 20
+static const uint64_t kPredictMaxIntervalNs = 50000000; // Sparser reports than this: not extrapolated
+
+typedef struct {
+    uint64_t t[SLOT_HISTORY_SIZE]; // Kernel timestamps, CLOCK_MONOTONIC ns
+    float x[SLOT_HISTORY_SIZE];
+    float y[SLOT_HISTORY_SIZE];
+    unsigned count;                // Samples since touch down; the newest is count - 1
+} SlotHistory;
+
+static SlotHistory gSlotHistory[MAX_MT_SLOTS];
+static uint64_t gPredictNs = 0;         // --predict horizon, 0 disables history and prediction
+static uint64_t gPredictAtNs = 0;       // Common time of this batch, processing time + horizon
+static uint64_t gPredictedSlots = 0;    // Slots read extrapolated, revisited until they settle
+static uint64_t gPredictSettleNs = UINT64_MAX; // When the first of them counts as stationary
+
+// SYN_REPORT: record slot s at frame time t. A new contact starts a new history.
+static void SlotHistory_Push(int s, uint64_t t, float x, float y, bool touchDown) {
+    SlotHistory *h = &gSlotHistory[s];
+    if (touchDown) h->count = 0;
+    if (h->count) {
+        unsigned last = (h->count - 1) & (SLOT_HISTORY_SIZE - 1);
+        if (h->x[last] == x && h->y[last] == y) return; // Only other axes changed
+    }
+    unsigned i = h->count++ & (SLOT_HISTORY_SIZE - 1);
+    h->t[i] = t;
+    h->x[i] = x;
+    h->y[i] = y;
+}
+
+// Contacts restart their history; extrapolated ones still settle through gPredictedSlots
+static void SlotHistory_Reset(void) {
+    for (int s = 0; s < MAX_MT_SLOTS; ++s) gSlotHistory[s].count = 0;
+}
+
+// Before ProcessAllWidgetsInput: fix the batch's common time and revisit every contact
+// read extrapolated last time, to resample it again or settle it
+static void SlotHistory_BeginBatch(void) {
+    if (!gPredictNs) return;
+    gPredictAtNs = clock_ns(CLOCK_MONOTONIC) + gPredictNs;
+    gDirtySlots |= gPredictedSlots;
+    gPredictedSlots = 0;
+    gPredictSettleNs = UINT64_MAX;
+}
+
+// Position of slot s at gPredictAtNs, written to *x, *y when it can be extrapolated
+static void SlotHistory_Predict(int s, float *x, float *y) {
+    const SlotHistory *h = &gSlotHistory[s];
+    if (h->count < 3) return;
+    unsigned i0 = (h->count - 1) & (SLOT_HISTORY_SIZE - 1);
+    unsigned i1 = (h->count - 2) & (SLOT_HISTORY_SIZE - 1);
+    unsigned i2 = (h->count - 3) & (SLOT_HISTORY_SIZE - 1);
+    uint64_t now = gPredictAtNs - gPredictNs;
+    uint64_t dt1 = h->t[i0] - h->t[i1], dt2 = h->t[i1] - h->t[i2];
+    if (h->t[i0] > now || !dt1 || !dt2 || dt1 > kPredictMaxIntervalNs || dt2 > kPredictMaxIntervalNs) return;
+    uint64_t settle = h->t[i0] + dt1 + dt1 / 2;
+    if (now >= settle) return; // Stopped
+
+    float sx1 = h->x[i0] - h->x[i1], sy1 = h->y[i0] - h->y[i1];
+    float sx2 = h->x[i1] - h->x[i2], sy2 = h->y[i1] - h->y[i2];
+    if (sx1 * sx2 + sy1 * sy2 <= 0.0f) return; // Turning
+    float vx = 0.5f * (sx1 / dt1 + sx2 / dt2), vy = 0.5f * (sy1 / dt1 + sy2 / dt2); // px/ns
+    float ahead = (float)(gPredictAtNs - h->t[i0]);
+    float ox = vx * ahead, oy = vy * ahead;
+    float lenSq = ox * ox + oy * oy, stepSq = sx1 * sx1 + sy1 * sy1;
+    if (lenSq > stepSq) {
+        float k = sqrtf(stepSq / lenSq);
+        ox *= k;
+        oy *= k;
+    }
+    *x = h->x[i0] + ox;
+    *y = h->y[i0] + oy;
+    gPredictedSlots |= 1ULL << s;
+    if (settle < gPredictSettleNs) gPredictSettleNs = settle;
+}
+
+// Forget all fingers and any edit/menu interaction in progress
+static void ResetTouchState(void) {
+    for (int i = 0; i < gNumTouchSlots; ++i) {
         mt_slots[i].active = false;
         mt_slots[i].was_down = false;
-        slot_mode[i] = SLOT_IDLE;
-        track_moved[i] = false;
+        mt_slots[i].mode = SLOT_IDLE;
+        mt_slots[i].widgetIndex = -1;
+        mt_slots[i].trackMoved = false;
     }
+    gProcessAllWidgets = gChangedAllWidgets = true;
+    SlotHistory_Reset();
     gLastUIFinger = -1;
     gEditState = (EditState){NULL, EDIT_NONE, {0,0}, {0,0}, 0.0f, 0.0f};
     gSelectedWidgetId = 0;
     gRemappingWidgetId = 0;
     gRemapAction = -1;
-    if (!gOverlayActive) {
-        // Immediately clear screen when turned off
-        glClear(GL_COLOR_BUFFER_BIT);
-        eglSwapBuffers(egl_display, egl_surface);
-        // Release any pressed keys when overlay turned off
-        for (int i = 0; i < gNumMappableKeys; ++i) uinput_key(gMappableKeys[i].keycode, false);
-    }
 }
 
 // Drawing Primitives & Helpers
@@ -559,6 +1633,8 @@ void DrawGenericButton(float x, float y, float w, float h, const char *label, Co
 void DrawMainButton(bool isActive);
 void DrawAddButton(bool isActive, bool isDisabled);
 void DrawPropertiesButton(bool isActive);
+void DrawHudButton(bool isActive);
+void DrawPerfHud(int screenW, int screenH);
 void DrawGenericMenu(int screenW, int screenH, const MenuItem items[], int numItems, float itemW, float itemH, float itemSpacing, Color overlayColor);
 void DrawWidgetSelectionMenu(int screenW, int screenH);
 void DrawWidgetPropertiesMenu(int screenW, int screenH);
@@ -567,6 +1643,7 @@ void DrawAnalogActionSelectionMenu(int screenW, int screenH);
 void DrawAllWidgets(int screenW, int screenH, bool editMode);
 void DrawUserInterface(bool editMode);
 
+#ifndef WLR_GAMEPAD_HEADLESS
 // Main Rendering
 void RenderFrame(int w, int h, EGLDisplay display, EGLSurface surface);
 
@@ -577,18 +1654,21 @@ static void layer_surface_handle_configure(void *data,
                                            struct zwlr_layer_surface_v1 *layer_surface,
                                            uint32_t serial,
                                            uint32_t w, uint32_t h);
+#endif
 
 
 // --- Widget Dispatch Tables ---
 // Initialized after widget handler forward declarations
 
+#ifndef WLR_GAMEPAD_HEADLESS
 static void (*widget_draw_tbl[WIDGET_MAX])(Widget*) = {
   #define X(name, func) func##_draw,
     WIDGET_TYPE_LIST
   #undef X
 };
+#endif
 
-static void (*widget_proc_tbl[WIDGET_MAX])(Widget*) = {
+static bool (*widget_proc_tbl[WIDGET_MAX])(Widget*) = {
   #define X(name, func) func##_process,
     WIDGET_TYPE_LIST
   #undef X
@@ -608,12 +1688,8 @@ static float dist(Vec2 p1, Vec2 p2) {
 
 // Helper to lookup label for a given keycode
 static const char* GetMappableKeyLabel(int keycode) {
-    for (int i = 0; i < gNumMappableKeys; ++i) {
-        if (gMappableKeys[i].keycode == keycode) {
-            return gMappableKeys[i].label;
-        }
-    }
-    return "";
+    if (keycode < 0 || keycode >= KEY_CNT || !kKeyInfo[keycode].label) return "";
+    return kKeyInfo[keycode].label;
 }
 
 // Helper function to calculate text pixel size to fit within bounds
@@ -721,11 +1797,191 @@ static int map6x8(char c) {
     return -1; // Character not in font
 }
 
+// --- Software Rasterizer ---
+// CPU versions of the drawing primitives for the wl_shm renderer (--renderer shm). They
+// draw into premultiplied ARGB8888, wl_shm's native format, sample pixel centers without
+// anti-aliasing like the GL path, and never touch pixels outside the canvas clip, so a
+// partial repaint costs only the damaged area. Callers pass screen coordinates and colors
+// with their final alpha (SW_COLOR); the canvas maps them to its pixels. Headless-safe so
+// bench/bench can time a full software frame.
+
+// Screen position -> canvas pixel position
+static inline Vec2 Sw_Map(const SwCanvas *c, float x, float y) {
+    return (Vec2){(x - c->ox) * c->scale, (y - c->oy) * c->scale};
+}
+
+// Limits drawing to r (screen coordinates), rounded outwards to whole canvas pixels
+static void Sw_SetClip(SwCanvas *c, DamageRect r) {
+    Vec2 p0 = Sw_Map(c, r.x0, r.y0), p1 = Sw_Map(c, r.x1, r.y1);
+    c->cx0 = MAX(0, (int)floorf(p0.x));
+    c->cy0 = MAX(0, (int)floorf(p0.y));
+    c->cx1 = MIN(c->width, (int)ceilf(p1.x));
+    c->cy1 = MIN(c->height, (int)ceilf(p1.y));
+}
+
+static inline uint32_t Sw_Premultiply(Color col) {
+    uint32_t a = col.a;
+    return a << 24 | (col.r * a + 127) / 255 << 16 | (col.g * a + 127) / 255 << 8 | (col.b * a + 127) / 255;
+}
+
+// src over dst, both premultiplied; two channels per multiply
+static inline uint32_t Sw_Blend(uint32_t dst, uint32_t src) {
+    uint32_t ia = 255 - (src >> 24);
+    uint32_t rb = (dst & 0x00FF00FFu) * ia + 0x00800080u;
+    rb = ((rb + ((rb >> 8) & 0x00FF00FFu)) >> 8) & 0x00FF00FFu;
+    uint32_t ag = ((dst >> 8) & 0x00FF00FFu) * ia + 0x00800080u;
+    ag = (ag + ((ag >> 8) & 0x00FF00FFu)) & 0xFF00FF00u;
+    return src + rb + ag;
+}
+
+// Canvas pixels [x0, x1) of row y
+static void Sw_Span(SwCanvas *c, int y, int x0, int x1, uint32_t src) {
+    if (y < c->cy0 || y >= c->cy1) return;
+    x0 = MAX(x0, c->cx0);
+    x1 = MIN(x1, c->cx1);
+    uint32_t *p = c->pixels + (size_t)y * c->stride;
+    if ((src >> 24) == 255) {
+        for (int x = x0; x < x1; ++x) p[x] = src;
+    } else {
+        for (int x = x0; x < x1; ++x) p[x] = Sw_Blend(p[x], src);
+    }
+}
+
+// First pixel whose center is at or right of v
+static inline int Sw_PixelEdge(float v) {
+    return (int)ceilf(v - 0.5f);
+}
+
+static void Sw_Clear(SwCanvas *c) {
+    for (int y = c->cy0; y < c->cy1; ++y) {
+        memset(c->pixels + (size_t)y * c->stride + c->cx0, 0, (size_t)MAX(0, c->cx1 - c->cx0) * sizeof(uint32_t));
+    }
+}
+
+void Sw_DrawRect(SwCanvas *c, float x, float y, float w, float h, Color col) {
+    if (col.a == 0) return;
+    uint32_t src = Sw_Premultiply(col);
+    Vec2 p0 = Sw_Map(c, x, y), p1 = Sw_Map(c, x + w, y + h);
+    int x0 = Sw_PixelEdge(p0.x), x1 = Sw_PixelEdge(p1.x);
+    int y0 = MAX(Sw_PixelEdge(p0.y), c->cy0), y1 = MIN(Sw_PixelEdge(p1.y), c->cy1);
+    for (int py = y0; py < y1; ++py) Sw_Span(c, py, x0, x1, src);
+}
+
+// Convex polygon in canvas pixels, one span per row from its edge crossings at the pixel centers
+static void Sw_FillConvex(SwCanvas *c, const Vec2 *pts, int n, Color col) {
+    if (col.a == 0) return;
+    uint32_t src = Sw_Premultiply(col);
+    float minY = pts[0].y, maxY = pts[0].y;
+    for (int i = 1; i < n; ++i) { minY = MIN(minY, pts[i].y); maxY = MAX(maxY, pts[i].y); }
+    int y0 = MAX(Sw_PixelEdge(minY), c->cy0), y1 = MIN(Sw_PixelEdge(maxY), c->cy1);
+    for (int py = y0; py < y1; ++py) {
+        float yc = py + 0.5f, xl = INFINITY, xr = -INFINITY;
+        for (int i = 0; i < n; ++i) {
+            Vec2 p = pts[i], q = pts[(i + 1) % n];
+            if ((p.y <= yc) == (q.y <= yc)) continue;
+            float xi = p.x + (yc - p.y) * (q.x - p.x) / (q.y - p.y);
+            xl = MIN(xl, xi);
+            xr = MAX(xr, xi);
+        }
+        if (xl < xr) Sw_Span(c, py, Sw_PixelEdge(xl), Sw_PixelEdge(xr), src);
+    }
+}
+
+void Sw_DrawLine(SwCanvas *c, float x1, float y1, float x2, float y2, float thickness, Color col) {
+    Vec2 a = Sw_Map(c, x1, y1), b = Sw_Map(c, x2, y2);
+    float dx = b.x - a.x, dy = b.y - a.y, len = sqrtf(dx * dx + dy * dy);
+    if (len <= 0.0f) return;
+    float half = thickness * c->scale * 0.5f;
+    float nx = -dy / len * half, ny = dx / len * half;
+    Vec2 quad[4] = {{a.x + nx, a.y + ny}, {b.x + nx, b.y + ny}, {b.x - nx, b.y - ny}, {a.x - nx, a.y - ny}};
+    Sw_FillConvex(c, quad, 4, col);
+}
+
+// Four non-overlapping bars centered on the edges, as a GL line loop of that width
+void Sw_DrawOutlinedRect(SwCanvas *c, float x, float y, float w, float h, float thickness, Color col) {
+    float t = thickness, ht = thickness * 0.5f;
+    Sw_DrawRect(c, x - ht, y - ht, w + t, t, col);
+    Sw_DrawRect(c, x - ht, y + h - ht, w + t, t, col);
+    Sw_DrawRect(c, x - ht, y + ht, t, h - t, col);
+    Sw_DrawRect(c, x + w - ht, y + ht, t, h - t, col);
+}
+
+// Ring between radii r - thickness/2 and r + thickness/2, up to two spans per row.
+// Exact circles; the GL path's segment count doesn't matter here.
+void Sw_DrawCircle(SwCanvas *c, float cx, float cy, float r, float thickness, Color col) {
+    if (col.a == 0) return;
+    uint32_t src = Sw_Premultiply(col);
+    Vec2 m = Sw_Map(c, cx, cy);
+    float ro = (r + thickness * 0.5f) * c->scale, ri = MAX(0.0f, r - thickness * 0.5f) * c->scale;
+    int y0 = MAX(Sw_PixelEdge(m.y - ro), c->cy0), y1 = MIN(Sw_PixelEdge(m.y + ro), c->cy1);
+    for (int py = y0; py < y1; ++py) {
+        float dy = py + 0.5f - m.y;
+        float wo = ro * ro - dy * dy;
+        if (wo <= 0.0f) continue;
+        wo = sqrtf(wo);
+        float wi = ri * ri - dy * dy;
+        if (wi <= 0.0f) {
+            Sw_Span(c, py, Sw_PixelEdge(m.x - wo), Sw_PixelEdge(m.x + wo), src);
+        } else {
+            wi = sqrtf(wi);
+            Sw_Span(c, py, Sw_PixelEdge(m.x - wo), Sw_PixelEdge(m.x - wi), src);
+            Sw_Span(c, py, Sw_PixelEdge(m.x + wi), Sw_PixelEdge(m.x + wo), src);
+        }
+    }
+}
+
+void Sw_DrawFilledCircle(SwCanvas *c, float cx, float cy, float r, Color col) {
+    if (col.a == 0) return;
+    uint32_t src = Sw_Premultiply(col);
+    Vec2 m = Sw_Map(c, cx, cy);
+    r *= c->scale;
+    int y0 = MAX(Sw_PixelEdge(m.y - r), c->cy0), y1 = MIN(Sw_PixelEdge(m.y + r), c->cy1);
+    for (int py = y0; py < y1; ++py) {
+        float dy = py + 0.5f - m.y, hw = r * r - dy * dy;
+        if (hw <= 0.0f) continue;
+        hw = sqrtf(hw);
+        Sw_Span(c, py, Sw_PixelEdge(m.x - hw), Sw_PixelEdge(m.x + hw), src);
+    }
+}
+
+void Sw_DrawTriangle(SwCanvas *c, Vec2 a, Vec2 b, Vec2 t, Color col, float thickness) {
+    Sw_DrawLine(c, a.x, a.y, b.x, b.y, thickness, col);
+    Sw_DrawLine(c, b.x, b.y, t.x, t.y, thickness, col);
+    Sw_DrawLine(c, t.x, t.y, a.x, a.y, thickness, col);
+}
+
+void Sw_DrawTriangleFilled(SwCanvas *c, Vec2 a, Vec2 b, Vec2 t, Color col) {
+    Vec2 tri[3] = {Sw_Map(c, a.x, a.y), Sw_Map(c, b.x, b.y), Sw_Map(c, t.x, t.y)};
+    Sw_FillConvex(c, tri, 3, col);
+}
+
+// One rectangle per vertical run of set bits in a glyph column
+void Sw_RenderText(SwCanvas *c, const char *text, float x, float y, float pixelSize, Color col) {
+    if (!text) return;
+    for (float currentX = x; *text; ++text, currentX += 6 * pixelSize) {
+        int idx = map6x8(*text);
+        if (idx < 0) continue;
+        const uint8_t *glyph = FONT6x8[idx];
+        for (int cx = 0; cx < 6; ++cx) {
+            uint8_t bits = glyph[cx];
+            for (int ry = 0; ry < 8; ++ry) {
+                if (!(bits & (1 << ry))) continue;
+                int run = 1;
+                while (ry + run < 8 && (bits & (1 << (ry + run)))) run++;
+                Sw_DrawRect(c, currentX + cx * pixelSize, y + ry * pixelSize, pixelSize, run * pixelSize, col);
+                ry += run;
+            }
+        }
+    }
+}
+
+#ifndef WLR_GAMEPAD_HEADLESS
 // Lightweight bitmap blitter - Batched Immediate Mode
 void RenderText(const char *text, float x, float y, float pixelSize, Color col) {
     if (!text || *text == '\0') { // Early exit for empty or NULL string
         return;
     }
+    if (gRenderer == RENDERER_SHM) { Sw_RenderText(&gCanvas, text, x, y, pixelSize, SW_COLOR(col)); return; }
 
     // Set color once for all pixels in this text string
     SET_COLOR(col);
@@ -761,6 +2017,7 @@ void RenderText(const char *text, float x, float y, float pixelSize, Color col)
 // --- Drawing Primitives ---
 
 void DrawRect(float x, float y, float w, float h, Color col) {
+    if (gRenderer == RENDERER_SHM) { Sw_DrawRect(&gCanvas, x, y, w, h, SW_COLOR(col)); return; }
     SET_COLOR(col);
     glBegin(GL_QUADS);
     glVertex2f(x, y);
@@ -771,8 +2028,9 @@ void DrawRect(float x, float y, float w, float h, Color col) {
 }
 
 void DrawOutlinedRect(float x, float y, float w, float h, float thickness, Color col) {
+    if (gRenderer == RENDERER_SHM) { Sw_DrawOutlinedRect(&gCanvas, x, y, w, h, thickness, SW_COLOR(col)); return; }
     SET_COLOR(col);
-    glLineWidth(thickness);
+    glLineWidth(thickness * gRenderScale);
     glBegin(GL_LINE_LOOP);
     glVertex2f(x, y);
     glVertex2f(x + w, y);
@@ -782,8 +2040,9 @@ void DrawOutlinedRect(float x, float y, float w, float h, float thickness, Color
 }
 
 void DrawLine(float x1, float y1, float x2, float y2, float thickness, Color col) {
+    if (gRenderer == RENDERER_SHM) { Sw_DrawLine(&gCanvas, x1, y1, x2, y2, thickness, SW_COLOR(col)); return; }
     SET_COLOR(col);
-    glLineWidth(thickness);
+    glLineWidth(thickness * gRenderScale);
     glBegin(GL_LINES);
     glVertex2f(x1, y1);
     glVertex2f(x2, y2);
@@ -791,8 +2050,9 @@ void DrawLine(float x1, float y1, float x2, float y2, float thickness, Color col
 }
 
 void DrawCircle(float cx, float cy, float r, int segments, float thickness, Color col) {
+    if (gRenderer == RENDERER_SHM) { Sw_DrawCircle(&gCanvas, cx, cy, r, thickness, SW_COLOR(col)); return; }
     SET_COLOR(col);
-    glLineWidth(thickness);
+    glLineWidth(thickness * gRenderScale);
     glBegin(GL_LINE_LOOP);
     for (int i = 0; i < segments; i++) {
         float a = (2.0f * M_PI * i) / segments;
@@ -802,6 +2062,7 @@ void DrawCircle(float cx, float cy, float r, int segments, float thickness, Colo
 }
 
 void DrawFilledCircle(float cx, float cy, float r, int segments, Color col) {
+    if (gRenderer == RENDERER_SHM) { Sw_DrawFilledCircle(&gCanvas, cx, cy, r, SW_COLOR(col)); return; }
     SET_COLOR(col);
     glBegin(GL_TRIANGLE_FAN);
     glVertex2f(cx, cy); // Center point
@@ -813,8 +2074,9 @@ void DrawFilledCircle(float cx, float cy, float r, int segments, Color col) {
 }
 
 void DrawTriangle(Vec2 a, Vec2 b, Vec2 c, Color col, float thickness) {
+    if (gRenderer == RENDERER_SHM) { Sw_DrawTriangle(&gCanvas, a, b, c, SW_COLOR(col), thickness); return; }
     SET_COLOR(col);
-    glLineWidth(thickness);
+    glLineWidth(thickness * gRenderScale);
     glBegin(GL_LINE_LOOP);
     glVertex2f(a.x, a.y);
     glVertex2f(b.x, b.y);
@@ -823,6 +2085,7 @@ void DrawTriangle(Vec2 a, Vec2 b, Vec2 c, Color col, float thickness) {
 }
 
 void DrawTriangleFilled(Vec2 a, Vec2 b, Vec2 c, Color col) {
+    if (gRenderer == RENDERER_SHM) { Sw_DrawTriangleFilled(&gCanvas, a, b, c, SW_COLOR(col)); return; }
     SET_COLOR(col);
     glBegin(GL_TRIANGLES);
     glVertex2f(a.x, a.y);
@@ -876,8 +2139,42 @@ void DrawPropertiesButton(bool isActive) {
     DrawGenericButton(kPropsButtonX, kPropsButtonY, kPropsButtonW, kPropsButtonH, "Edit", btnCol, kColorWhite);
 }
 
-void DrawGenericMenu(int screenW, int screenH, const MenuItem items[], int numItems, float itemW, float itemH, float itemSpacing, Color overlayColor) {
-    DrawRect(0, 0, (float)screenW, (float)screenH, overlayColor);
+void DrawHudButton(bool isActive) {
+    Color btnCol = isActive ? kColorActive : kColorIdle;
+    DrawGenericButton(kHudButtonX, kHudButtonY, kHudButtonW, kHudButtonH, "Perf", btnCol, kColorWhite);
+}
+
+// Performance HUD in the top right corner. Frame and swap times are those of the previous frame.
+static const float kHudPixelSize = 2.0f;
+static const float kHudLineH = 10.0f * kHudPixelSize;
+static const float kHudPanelW = 16 * 6.0f * kHudPixelSize + 20.0f;
+static const float kHudPanelH = 6 * kHudLineH + 10.0f;
+
+static DamageRect PerfHud_Bounds(int screenW) {
+    float x = (float)screenW - kHudPanelW - 10.0f;
+    return (DamageRect){x, kEditButtonY, x + kHudPanelW, kEditButtonY + kHudPanelH};
+}
+
+void DrawPerfHud(int screenW, int screenH) {
+    char lines[6][32];
+    PerfCounters pc;
+    PerfCounters_Read(&pc);
+    snprintf(lines[0], sizeof(lines[0]), "frame %lluus", (unsigned long long)(pc.lastStageWallNs[STAGE_RENDER] / 1000));
+    snprintf(lines[1], sizeof(lines[1]), "swap %lluus", (unsigned long long)(pc.lastStageWallNs[STAGE_SWAP] / 1000));
+    snprintf(lines[2], sizeof(lines[2]), "events %d per s", (int)gPerfRates.evdevEvents);
+    snprintf(lines[3], sizeof(lines[3]), "uinput %d per s", (int)gPerfRates.uinputWrites);
+    snprintf(lines[4], sizeof(lines[4]), "latency %lluus", (unsigned long long)(pc.lastTouchToUinputNs / 1000));
+    snprintf(lines[5], sizeof(lines[5]), "photon %lluus", (unsigned long long)(pc.lastTouchToPhotonNs / 1000));
+
+    DamageRect r = PerfHud_Bounds(screenW);
+    DrawRect(r.x0, r.y0, kHudPanelW, kHudPanelH, kMenuOverlayColor);
+    for (int i = 0; i < 6; ++i) {
+        RenderText(lines[i], r.x0 + 10.0f, r.y0 + 5.0f + i * kHudLineH, kHudPixelSize, kColorWhite);
+    }
+}
+
+void DrawGenericMenu(int screenW, int screenH, const MenuItem items[], int numItems, float itemW, float itemH, float itemSpacing, Color overlayColor) {
+    DrawRect(0, 0, (float)screenW, (float)screenH, overlayColor);
 
     float totalMenuHeight = (itemH + itemSpacing) * numItems - itemSpacing;
     float startY = ((float)screenH - totalMenuHeight) * 0.5f;
@@ -911,13 +2208,17 @@ void DrawWidgetPropertiesMenu(int screenW, int screenH) {
 void DrawKeySelectionMenu(int screenW, int screenH) {
     DrawRect(0, 0, (float)screenW, (float)screenH, kMenuOverlayColor);
 
-    int widgetIndex = FindWidgetIndexById(gRemappingWidgetId);
-    Widget *targetWidget = (widgetIndex != -1) ? &gWidgets[widgetIndex] : NULL;
+    const GridLayout *grid = &gView->keyGrid;
+    int remapAction = gView->remapAction;
+    const Widget *targetWidget = NULL;
+    for (int i = 0; i < gView->numWidgets && gView->remappingWidgetId != 0; ++i) {
+        if (gView->widgets[i].id == gView->remappingWidgetId) targetWidget = &gView->widgets[i];
+    }
     bool isAnalog = (targetWidget && (targetWidget->type == WIDGET_JOYSTICK || targetWidget->type == WIDGET_DPAD));
     int currentKeycode = -1;
     if (targetWidget) {
-        if (isAnalog && gRemapAction >= 0 && gRemapAction < numAnalogActions) {
-            currentKeycode = targetWidget->data.analog.keycode[gRemapAction];
+        if (isAnalog && remapAction >= 0 && remapAction < numAnalogActions) {
+            currentKeycode = targetWidget->data.analog.keycode[remapAction];
         } else if (targetWidget->type == WIDGET_BUTTON) {
             currentKeycode = targetWidget->data.button.keycode;
         }
@@ -926,40 +2227,47 @@ void DrawKeySelectionMenu(int screenW, int screenH) {
     // Prepare title text
     char titleBuffer[128];
     if (!isAnalog) {
-        snprintf(titleBuffer, sizeof(titleBuffer), "Select Key for Button %d", gRemappingWidgetId);
+        snprintf(titleBuffer, sizeof(titleBuffer), "Select Key for Button %d", gView->remappingWidgetId);
     } else {
         const char *wname = (targetWidget->type == WIDGET_JOYSTICK ? "Joystick" : "DPad");
-        if (gRemapAction >= 0 && gRemapAction < numAnalogActions) {
-             snprintf(titleBuffer, sizeof(titleBuffer), "Select Key for %s '%s'", wname, availableAnalogActionNames[gRemapAction]);
+        if (remapAction >= 0 && remapAction < numAnalogActions) {
+             snprintf(titleBuffer, sizeof(titleBuffer), "Select Key for %s '%s'", wname, availableAnalogActionNames[remapAction]);
         } else {
              snprintf(titleBuffer, sizeof(titleBuffer), "Select Key for %s", wname);
         }
     }
 
-    // Title and grid group vertical centering
-    float titlePixelSize = 2.0f;
-    float titleTextRenderHeight = 8.0f * titlePixelSize;
-    float paddingBelowTitle = 10.0f;
-    // Compute overall group height (title + padding + grid)
-    float groupHeight = titleTextRenderHeight + paddingBelowTitle + gKeyGridLayout.totalHeight;
-    float groupStartY = ((float)screenH - groupHeight) * 0.5f;
+    // Title sits right above the page switcher row, see UpdateKeyGridLayout
+    float pitch = grid->cellSize + grid->cellSpacing;
+    float pagerY = grid->startY - pitch;
+    float titlePixelSize = kKeyGridTitlePixelSize;
     float titleWidth = strlen(titleBuffer) * 6.0f * titlePixelSize;
     float titleX = ((float)screenW - titleWidth) * 0.5f;
-    float titleY = groupStartY;
+    float titleY = pagerY - kKeyGridTitlePadding - 8.0f * titlePixelSize;
     RenderText(titleBuffer, titleX, titleY, titlePixelSize, kColorWhite);
-    // Position grid below title
-    gKeyGridLayout.startY = titleY + titleTextRenderHeight + paddingBelowTitle;
 
-    // Draw key buttons using cached grid layout (horizontally centered, startY updated)
-    for (int i = 0; i < gNumMappableKeys; ++i) {
-        int row = i / gKeyGridLayout.cols;
-        int col = i % gKeyGridLayout.cols;
-        float buttonX = gKeyGridLayout.startX + col * (gKeyGridLayout.cellSize + gKeyGridLayout.cellSpacing);
-        float buttonY = gKeyGridLayout.startY + row * (gKeyGridLayout.cellSize + gKeyGridLayout.cellSpacing);
-
-        Color btnColor = (gMappableKeys[i].keycode == currentKeycode) ? kColorActive : kColorIdle;
-        DrawGenericButton(buttonX, buttonY, gKeyGridLayout.cellSize, gKeyGridLayout.cellSize,
-                          gMappableKeys[i].label, btnColor, kColorWhite);
+    // Page switcher, hit-tested by KeyGrid_Hit
+    const KeyPage *page = &kKeyPages[gView->keyPage];
+    float pagerW = 2.0f * grid->cellSize + grid->cellSpacing;
+    DrawGenericButton(grid->startX, pagerY, pagerW, grid->cellSize, "Prev", kColorIdle, kColorWhite);
+    DrawGenericButton(grid->startX + grid->totalWidth - pagerW, pagerY, pagerW, grid->cellSize, "Next", kColorIdle, kColorWhite);
+    char pageBuffer[32];
+    snprintf(pageBuffer, sizeof(pageBuffer), "%s %d of %d", page->name, gView->keyPage + 1, KEY_PAGE_MAX);
+    float pagePixelSize = CalculateFittingPixelSize(pageBuffer, grid->totalWidth - 2.0f * (pagerW + grid->cellSpacing), grid->cellSize);
+    float pageWidth = strlen(pageBuffer) * 6.0f * pagePixelSize;
+    RenderText(pageBuffer, grid->startX + (grid->totalWidth - pageWidth) * 0.5f,
+               pagerY + (grid->cellSize - 8.0f * pagePixelSize) * 0.5f, pagePixelSize, kColorWhite);
+
+    // Draw key buttons using cached grid layout (same cells the input thread hit-tests)
+    for (int i = 0; i < page->numKeys; ++i) {
+        int row = i / grid->cols;
+        int col = i % grid->cols;
+        float buttonX = grid->startX + col * pitch;
+        float buttonY = grid->startY + row * pitch;
+
+        Color btnColor = (page->keys[i] == currentKeycode) ? kColorActive : kColorIdle;
+        DrawGenericButton(buttonX, buttonY, grid->cellSize, grid->cellSize,
+                          kKeyInfo[page->keys[i]].label, btnColor, kColorWhite);
     }
 }
 
@@ -973,6 +2281,8 @@ void DrawAnalogActionSelectionMenu(int screenW, int screenH) {
                     kMenuButtonW, kMenuButtonH, kMenuButtonSpacing, kMenuOverlayColor);
 }
 
+#endif // !WLR_GAMEPAD_HEADLESS
+
 // --- Widget Structure and Core Logic ---
 
 void Widget_UpdateAbsCoords(Widget* w, int screenW, int screenH) {
@@ -996,10 +2306,10 @@ void Widget_ClampToScreen(Widget* w, int screenW, int screenH) {
     Widget_UpdateAbsCoords(w, screenW, screenH); // Re-calculate absolute after clamping normalized
 }
 
-void CreateWidget(WidgetType type, Vec2 normCenter, float normHalfSize) {
+Widget* CreateWidget(WidgetType type, Vec2 normCenter, float normHalfSize) {
     if (gNumWidgets >= MAX_WIDGETS) {
         D("Cannot create widget: MAX_WIDGETS reached");
-        return;
+        return NULL;
     }
 
     Widget newWidget = {
@@ -1032,6 +2342,7 @@ void CreateWidget(WidgetType type, Vec2 normCenter, float normHalfSize) {
     gWidgets[gNumWidgets++] = newWidget;
     D("Widget created. gNumWidgets = %d", gNumWidgets);
     Widget_UpdateAbsCoords(&gWidgets[gNumWidgets - 1], width, height);
+    return &gWidgets[gNumWidgets - 1];
 }
 
 int FindWidgetIndexById(int widgetId) {
@@ -1051,11 +2362,17 @@ void RemoveWidgetByIndex(int index) {
     D("Removing widget at index %d (ID: %d)", index, gWidgets[index].id);
     
     int removedWidgetId = gWidgets[index].id; // Store ID before potentially overwriting
+    InputState_RemoveWidget(index);
 
     for (int i = index; i < gNumWidgets - 1; ++i) {
         gWidgets[i] = gWidgets[i + 1];
     }
     gNumWidgets--;
+    gLiveWidgetsStale = true;
+    for (int s = 0; s < gNumTouchSlots; ++s) { // Contacts still held since RUNNING follow their widget
+        if (mt_slots[s].widgetIndex == index) mt_slots[s].widgetIndex = -1;
+        else if (mt_slots[s].widgetIndex > index) mt_slots[s].widgetIndex--;
+    }
 
     if (gSelectedWidgetId == removedWidgetId) {
         gSelectedWidgetId = 0;
@@ -1068,6 +2385,55 @@ void UpdateAllWidgetCoords(int screenW, int screenH) {
     }
 }
 
+// Key selection grid, shared by DrawKeySelectionMenu and KeyGrid_Hit.
+// The title, the page switcher row and the grid are centered vertically as one group.
+// Every page uses the grid of the largest one, so cells don't jump when paging.
+void UpdateKeyGridLayout(int screenW, int screenH) {
+    float menuContentStartY = kEditButtonY + kEditButtonH + 20.0f;
+    float titleTextRenderHeight = 8.0f * kKeyGridTitlePixelSize;
+    float offsetTop = menuContentStartY + titleTextRenderHeight + kKeyGridTitlePadding;
+    int maxPageKeys = 0;
+    for (int i = 0; i < KEY_PAGE_MAX; ++i) maxPageKeys = MAX(maxPageKeys, kKeyPages[i].numKeys);
+    CalculateGridLayout(screenW, screenH, maxPageKeys + kKeyGridCols, // + the page switcher row
+                        kKeyGridCols, kKeyButtonSize, kKeyButtonSpacing,
+                        offsetTop, &gKeyGridLayout);
+    float groupHeight = titleTextRenderHeight + kKeyGridTitlePadding + gKeyGridLayout.totalHeight;
+    float pitch = gKeyGridLayout.cellSize + gKeyGridLayout.cellSpacing;
+    gKeyGridLayout.rows -= 1;
+    gKeyGridLayout.totalHeight -= pitch;
+    gKeyGridLayout.startY = ((float)screenH - groupHeight) * 0.5f + titleTextRenderHeight + kKeyGridTitlePadding + pitch;
+    gScaledKeyButtonSize = gKeyGridLayout.cellSize;
+    gScaledKeyButtonSpacing = gKeyGridLayout.cellSpacing;
+}
+
+enum { KEY_GRID_MISS = -1, KEY_GRID_PREV = -2, KEY_GRID_NEXT = -3 };
+
+// What of the key selection menu is under p: a cell index on the page, or the page switcher
+// (the row above the grid, Prev and Next two cells wide at either end). Row and column come
+// straight from the cell pitch; taps in the spacing miss.
+static int KeyGrid_Hit(const GridLayout *g, Vec2 p) {
+    float pitch = g->cellSize + g->cellSpacing;
+    float fx = (p.x - g->startX) / pitch, fy = (p.y - g->startY) / pitch;
+    if (fx < 0.0f || fx >= (float)g->cols || fy < -1.0f || fy >= (float)g->rows) return KEY_GRID_MISS;
+    int col = (int)fx, row = (int)floorf(fy);
+    bool inGapX = (fx - col) * pitch > g->cellSize;
+    if ((fy - row) * pitch > g->cellSize) return KEY_GRID_MISS;
+    if (row < 0) {
+        if (col == 0 || (col == 1 && !inGapX)) return KEY_GRID_PREV;
+        if (col == g->cols - 2 || (col == g->cols - 1 && !inGapX)) return KEY_GRID_NEXT;
+        return KEY_GRID_MISS;
+    }
+    return inGapX ? KEY_GRID_MISS : row * g->cols + col;
+}
+
+// Open the key selection menu on the page listing the key being replaced
+static void KeyMenu_Open(int currentKeycode) {
+    bool listed = currentKeycode > 0 && currentKeycode < KEY_CNT && kKeyInfo[currentKeycode].label;
+    gKeyPage = listed ? kKeyInfo[currentKeycode].page : 0;
+    gAppState = APP_STATE_MENU_REMAP_KEY;
+}
+
+#ifndef WLR_GAMEPAD_HEADLESS
 // --- Widget-Specific Implementations (Draw) ---
 
 void joystick_draw(Widget *w) {
@@ -1124,12 +2490,69 @@ void button_draw(Widget *w) {
     }
 }
 
+#endif // !WLR_GAMEPAD_HEADLESS
+
+// --- Live Widgets ---
+// A widget without a contact, output or press comes out of processing unchanged, so a full
+// pass only visits the bits of gLiveWidgets: after a resize or leaving edit mode it costs
+// the widgets in use, not the layout size. Anything that moves or resets gWidgets outside
+// the process functions marks the mask stale.
+
+static inline bool Widget_IsLive(const Widget *w) {
+    return w->controllingFinger != INVALID_FINGER_ID || w->outputValue.x != 0.0f || w->outputValue.y != 0.0f ||
+           (w->type == WIDGET_BUTTON && w->data.button.isPressed);
+}
+
+static inline void Widget_SetLive(int i, bool live) {
+    uint64_t bit = 1ULL << (i & 63);
+    if (live) {
+        gLiveWidgets[i >> 6] |= bit;
+    } else {
+        gLiveWidgets[i >> 6] &= ~bit;
+    }
+}
+
+static void LiveWidgets_Build(void) {
+    memset(gLiveWidgets, 0, sizeof(gLiveWidgets));
+    for (int i = 0; i < gNumWidgets; ++i) Widget_SetLive(i, Widget_IsLive(&gWidgets[i]));
+    gLiveWidgetsStale = false;
+}
+
+// Attach (or with INVALID_FINGER_ID detach) a contact, outside the process functions
+static void Widget_SetFinger(int i, int finger) {
+    gWidgets[i].controllingFinger = finger;
+    if (!gLiveWidgetsStale) Widget_SetLive(i, Widget_IsLive(&gWidgets[i]));
+}
+
+// Every live widget, in index order. The mask word is gathered in a register and stored
+// once: updating it after every widget chains each one on the last one's store.
+static void LiveWidgets_ProcessAll(void) {
+    if (gLiveWidgetsStale) LiveWidgets_Build();
+    for (int k = 0; k < WIDGET_LIVE_WORDS; ++k) {
+        uint64_t live = 0;
+        for (uint64_t m = gLiveWidgets[k]; m; m &= m - 1) {
+            int bit = __builtin_ctzll(m);
+            Widget *w = &gWidgets[k * 64 + bit];
+            live |= (uint64_t)widget_proc_tbl[w->type](w) << bit;
+        }
+        gLiveWidgets[k] = live;
+    }
+}
+
+// Just gWidgets[i]
+static void Widget_Process(int i) {
+    bool live = widget_proc_tbl[gWidgets[i].type](&gWidgets[i]);
+    if (!gLiveWidgetsStale) Widget_SetLive(i, live);
+}
+
 // --- Widget-Specific Implementations (Process) ---
+// Each returns whether the widget stays live; the caller updates the live mask
 
-void joystick_process(Widget* w) {
-    if (w->controllingFinger != INVALID_FINGER_ID && mt_slots[w->controllingFinger].active) {
-        int slot_idx = w->controllingFinger;
-        Vec2 touchPos = {mt_slots[slot_idx].x, mt_slots[slot_idx].y};
+bool joystick_process(Widget* w) {
+    int f = w->controllingFinger;
+    if (f != INVALID_FINGER_ID && mt_slots[f].active) {
+        Vec2 touchPos = {mt_slots[f].x, mt_slots[f].y};
+        if (gPredictNs) SlotHistory_Predict(f, &touchPos.x, &touchPos.y);
         Vec2 delta = {touchPos.x - w->absCenter.x, touchPos.y - w->absCenter.y};
         Vec2 norm = {
             (w->absRadius > 1e-5f) ? delta.x / w->absRadius : 0.0f,
@@ -1143,19 +2566,20 @@ void joystick_process(Widget* w) {
             norm.y /= len;
         }
         w->outputValue = norm;
-    } else {
-        if (w->controllingFinger != INVALID_FINGER_ID) {
-            D("Joystick %d lost finger slot %d, resetting", w->id, w->controllingFinger);
-            w->controllingFinger = INVALID_FINGER_ID;
-        }
-        w->outputValue = (Vec2){0, 0};
+        return true;
+    }
+    if (f != INVALID_FINGER_ID) {
+        D("Joystick %d lost finger slot %d, resetting", w->id, f);
+        w->controllingFinger = INVALID_FINGER_ID;
     }
+    w->outputValue = (Vec2){0, 0};
+    return false;
 }
 
-void dpad_process(Widget* w) {
-    if (w->controllingFinger != INVALID_FINGER_ID && mt_slots[w->controllingFinger].active) {
-        int slot_idx = w->controllingFinger;
-        Vec2 touchPos = {mt_slots[slot_idx].x, mt_slots[slot_idx].y};
+bool dpad_process(Widget* w) {
+    int f = w->controllingFinger;
+    if (f != INVALID_FINGER_ID && mt_slots[f].active) {
+        Vec2 touchPos = {mt_slots[f].x, mt_slots[f].y};
         Vec2 delta = {touchPos.x - w->absCenter.x, touchPos.y - w->absCenter.y};
 
         w->outputValue = (Vec2){0, 0};
@@ -1167,85 +2591,385 @@ void dpad_process(Widget* w) {
                 w->outputValue.y = (delta.y > 0 ? 1.0f : -1.0f); // Screen Y is down, output Y positive means down
             }
         }
-    } else {
-        if (w->controllingFinger != INVALID_FINGER_ID) {
-            D("DPad %d lost finger slot %d, resetting", w->id, w->controllingFinger);
-            w->controllingFinger = INVALID_FINGER_ID;
-        }
-        w->outputValue = (Vec2){0, 0};
+        return true;
+    }
+    if (f != INVALID_FINGER_ID) {
+        D("DPad %d lost finger slot %d, resetting", w->id, f);
+        w->controllingFinger = INVALID_FINGER_ID;
     }
+    w->outputValue = (Vec2){0, 0};
+    return false;
 }
 
-void button_process(Widget* w) {
-    bool fingerIsDownOnButton = (w->controllingFinger != INVALID_FINGER_ID && mt_slots[w->controllingFinger].active);
+bool button_process(Widget* w) {
+    int f = w->controllingFinger;
+    bool fingerIsDownOnButton = (f != INVALID_FINGER_ID && mt_slots[f].active);
 
     if (fingerIsDownOnButton) {
-        int slot_idx = w->controllingFinger;
-        Vec2 touchPos = {mt_slots[slot_idx].x, mt_slots[slot_idx].y};
+        Vec2 touchPos = {mt_slots[f].x, mt_slots[f].y};
         if (!Widget_IsInside(w, touchPos)) {
             fingerIsDownOnButton = false;
-            D("Button %d: Finger slot %d slid off", w->id, slot_idx);
+            D("Button %d: Finger slot %d slid off", w->id, f);
         }
     }
 
     if (fingerIsDownOnButton && !w->data.button.isPressed) {
-        D("Button %d pressed by finger slot %d", w->id, w->controllingFinger);
+        D("Button %d pressed by finger slot %d", w->id, f);
         w->data.button.isPressed = true;
         enqueue_event(w->id, EVT_KEY_DOWN, w->data.button.keycode);
         w->outputValue = (Vec2){0, 0};
     } else if (!fingerIsDownOnButton && w->data.button.isPressed) {
-        D("Button %d released (finger slot %d)", w->id, (w->controllingFinger != INVALID_FINGER_ID ? w->controllingFinger : -2)); // -2 if already cleared
+        D("Button %d released (finger slot %d)", w->id, (f != INVALID_FINGER_ID ? f : -2)); // -2 if already cleared
         w->data.button.isPressed = false;
         enqueue_event(w->id, EVT_KEY_UP, w->data.button.keycode);
         w->outputValue = (Vec2){0, 0};
-        if (w->controllingFinger != INVALID_FINGER_ID) { // Clear if it was ours and not already cleared
-            w->controllingFinger = INVALID_FINGER_ID;
-        }
+        w->controllingFinger = INVALID_FINGER_ID; // Clear if it was ours and not already cleared
+    }
+    return Widget_IsLive(w);
+}
+
+
+#ifndef WLR_GAMEPAD_HEADLESS
+// --- Damage Tracking ---
+// RenderFrame repaints and submits only what changed since the last frame: widgets whose
+// drawn state differs from gLastDrawn, plus the HUD while it is shown. A change of mode,
+// selection, opacity or size damages the whole surface. With EGL_EXT_buffer_age the back
+// buffer still holds an older frame, so only the damage of the frames since then is
+// repainted (scissored); swap_buffers_with_damage hands the damage to the compositor,
+// which EGL turns into wl_surface.damage_buffer.
+
+#define DAMAGE_HISTORY 4 // Frames of damage kept for buffer age
+
+static PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC gSwapBuffersWithDamage = NULL; // KHR or EXT variant
+static bool gHasBufferAge = false;
+static UiSnapshot gLastDrawn;                     // State of the last swapped frame
+static float gLastDrawnOpacity = -1.0f;
+static bool gForceFullDamage = true;              // Nothing drawn yet, or the viewport changed
+static DamageRect gDamageHistory[DAMAGE_HISTORY]; // [0] is the damage of the last frame
+static DamageRect gRedrawRect;                    // Being repainted, DrawAllWidgets skips the rest
+
+static bool Damage_IsEmpty(DamageRect r) {
+    return r.x1 <= r.x0 || r.y1 <= r.y0;
+}
+
+static DamageRect Damage_Union(DamageRect a, DamageRect b) {
+    if (Damage_IsEmpty(a)) return b;
+    if (Damage_IsEmpty(b)) return a;
+    return (DamageRect){MIN(a.x0, b.x0), MIN(a.y0, b.y0), MAX(a.x1, b.x1), MAX(a.y1, b.y1)};
+}
+
+static bool Damage_Intersects(DamageRect a, DamageRect b) {
+    return a.x0 < b.x1 && b.x0 < a.x1 && a.y0 < b.y1 && b.y0 < a.y1;
+}
+
+// Everything a widget's draw function can touch, including the joystick dot at full deflection
+static DamageRect Widget_DrawBounds(const Widget *w) {
+    float r = w->absRadius * 1.3f + kOutlineThickness + 2.0f;
+    return (DamageRect){w->absCenter.x - r, w->absCenter.y - r, w->absCenter.x + r, w->absCenter.y + r};
+}
+
+static bool Widget_DrawsSame(const Widget *a, const Widget *b) {
+    return a->id == b->id && a->type == b->type &&
+           a->absCenter.x == b->absCenter.x && a->absCenter.y == b->absCenter.y && a->absRadius == b->absRadius &&
+           a->outputValue.x == b->outputValue.x && a->outputValue.y == b->outputValue.y &&
+           memcmp(&a->data, &b->data, sizeof(a->data)) == 0;
+}
+
+// What changed between gLastDrawn and gView
+static DamageRect Damage_Compute(int screenW, int screenH) {
+    const UiSnapshot *prev = &gLastDrawn, *cur = gView;
+    if (gForceFullDamage || prev->numWidgets != cur->numWidgets || prev->appState != cur->appState ||
+        prev->selectedWidgetId != cur->selectedWidgetId || prev->remappingWidgetId != cur->remappingWidgetId ||
+        prev->remapAction != cur->remapAction || prev->keyPage != cur->keyPage || prev->hudVisible != cur->hudVisible ||
+        prev->overlayActive != cur->overlayActive || gLastDrawnOpacity != gMasterOpacity) {
+        return (DamageRect){0, 0, (float)screenW, (float)screenH};
+    }
+    DamageRect damage = {0};
+    if (!cur->overlayActive) return damage;
+    for (int i = 0; i < cur->numWidgets; ++i) {
+        if (Widget_DrawsSame(&prev->widgets[i], &cur->widgets[i])) continue;
+        damage = Damage_Union(damage, Widget_DrawBounds(&prev->widgets[i]));
+        damage = Damage_Union(damage, Widget_DrawBounds(&cur->widgets[i]));
     }
+    if (cur->hudVisible) damage = Damage_Union(damage, PerfHud_Bounds(screenW));
+    return damage;
+}
+
+// Surface size -> buffer size at gRenderScale
+static int Scale_ToBuffer(int size) {
+    return MAX(1, (int)ceilf(size * gRenderScale));
 }
 
+// Surface rectangle -> the buffer pixels it covers
+static DamageRect Damage_ToBuffer(DamageRect r) {
+    return (DamageRect){floorf(r.x0 * gRenderScale), floorf(r.y0 * gRenderScale),
+                        ceilf(r.x1 * gRenderScale), ceilf(r.y1 * gRenderScale)};
+}
+
+// Clip to the surface and round outwards to whole pixels
+static DamageRect Damage_Clip(DamageRect r, int screenW, int screenH) {
+    DamageRect c = {floorf(MAX(r.x0, 0.0f)), floorf(MAX(r.y0, 0.0f)),
+                    ceilf(MIN(r.x1, (float)screenW)), ceilf(MIN(r.y1, (float)screenH))};
+    return Damage_IsEmpty(c) ? (DamageRect){0} : c;
+}
+
+static void Damage_InitEGL(EGLDisplay dpy) {
+    const char *ext = eglQueryString(dpy, EGL_EXTENSIONS);
+    if (!ext) return;
+    if (strstr(ext, "EGL_KHR_swap_buffers_with_damage")) {
+        gSwapBuffersWithDamage = (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)eglGetProcAddress("eglSwapBuffersWithDamageKHR");
+    } else if (strstr(ext, "EGL_EXT_swap_buffers_with_damage")) {
+        gSwapBuffersWithDamage = (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)eglGetProcAddress("eglSwapBuffersWithDamageEXT");
+    }
+    gHasBufferAge = strstr(ext, "EGL_EXT_buffer_age") != NULL;
+    fprintf(stderr, "[EGL] swap with damage %s, buffer age %s\n",
+            gSwapBuffersWithDamage ? "yes" : "no", gHasBufferAge ? "yes" : "no");
+}
 
 // --- Application UI and Widget Drawing ---
 
-void DrawAllWidgets(int screenW, int screenH, bool editMode) {
-    for (int i = 0; i < gNumWidgets; ++i) {
-        widget_draw_tbl[gWidgets[i].type](&gWidgets[i]);
+// One widget plus its edit-mode box and resize handle, all within Widget_DrawBounds
+static void DrawWidget(const Widget *w, bool editMode) {
+    widget_draw_tbl[w->type]((Widget*)w); // Draw functions don't modify the widget
 
-        if (editMode) {
-            Widget* w = &gWidgets[i];
-            bool isSelected = (w->id == gSelectedWidgetId);
-            Color boxColor = isSelected ? kColorActive : kColorEditMode;
-            Color handleColor = isSelected ? kColorActive : kColorEditModeHandle;
+    if (editMode) {
+        bool isSelected = (w->id == gView->selectedWidgetId);
+        Color boxColor = isSelected ? kColorActive : kColorEditMode;
+        Color handleColor = isSelected ? kColorActive : kColorEditModeHandle;
 
-            Vec2 tl = w->absTopLeft;
-            float s = w->absSize;
+        Vec2 tl = w->absTopLeft;
+        float s = w->absSize;
 
-            // Bounding box
-            DrawOutlinedRect(tl.x, tl.y, s, s, kOutlineThickness, boxColor);
+        // Bounding box
+        DrawOutlinedRect(tl.x, tl.y, s, s, kOutlineThickness, boxColor);
 
-            // Resize handle
-            Vec2 br = {tl.x + s, tl.y + s};
-            DrawRect(br.x - kHandleSize, br.y - kHandleSize, kHandleSize, kHandleSize, handleColor);
-        }
+        // Resize handle
+        Vec2 br = {tl.x + s, tl.y + s};
+        DrawRect(br.x - kHandleSize, br.y - kHandleSize, kHandleSize, kHandleSize, handleColor);
+    }
+}
+
+void DrawAllWidgets(int screenW, int screenH, bool editMode) {
+    for (int i = 0; i < gView->numWidgets; ++i) {
+        const Widget *w = &gView->widgets[i];
+        if (!Damage_Intersects(gRedrawRect, Widget_DrawBounds(w))) continue;
+        DrawWidget(w, editMode);
+    }
+}
+
+// Everything drawn above the widgets: the open menu, the edit buttons and the HUD
+static void DrawMenusAndInterface(int screenW, int screenH) {
+    ApplicationState appState = gView->appState;
+    if (appState == APP_STATE_MENU_ADD_WIDGET) {
+        DrawWidgetSelectionMenu(screenW, screenH);
+    } else if (appState == APP_STATE_MENU_WIDGET_PROPERTIES) {
+        DrawWidgetPropertiesMenu(screenW, screenH);
+    } else if (appState == APP_STATE_MENU_REMAP_ACTION) {
+        DrawAnalogActionSelectionMenu(screenW, screenH);
+    } else if (appState == APP_STATE_MENU_REMAP_KEY) {
+        DrawKeySelectionMenu(screenW, screenH);
+    }
+
+    DrawUserInterface(appState != APP_STATE_RUNNING);
+    if (gView->hudVisible) {
+        DrawPerfHud(screenW, screenH);
     }
 }
 
-void DrawUserInterface(bool editMode) { // editMode is (gAppState != APP_STATE_RUNNING)
+void DrawUserInterface(bool editMode) { // editMode is (appState != APP_STATE_RUNNING)
     DrawMainButton(editMode); // This is our main "Back/Cancel" or "Enter/Exit Edit Mode" button
 
     // Only show Add and Properties buttons when in the main edit mode screen
-    if (gAppState == APP_STATE_EDIT_MODE) { // Or APP_STATE_EDIT_IDLE if not renamed
+    if (gView->appState == APP_STATE_EDIT_MODE) { // Or APP_STATE_EDIT_IDLE if not renamed
         // Draw Add button as a simple action button, not indicating menu state
         DrawAddButton(false, false);
 
-        if (gSelectedWidgetId != 0) {
+        if (gView->selectedWidgetId != 0) {
             // Draw Properties button as a simple action button if a widget is selected
             DrawPropertiesButton(false);
         }
+        DrawHudButton(gView->hudVisible);
     }
     // If gAppState is any of the _MENU_ states, Add/Properties buttons will not be drawn.
 }
 
+// --- Static Layer Cache ---
+// Most of a frame doesn't change while playing: outlines, DPad triangles, button labels,
+// edit boxes and buttons. With the GL renderer the scene is drawn once with every widget
+// at rest (dot centered, nothing pressed) into an offscreen framebuffer. Each frame then
+// copies it with one glBlitFramebuffer and repaints only the areas of widgets that are
+// not at rest, plus the HUD: clear that area and draw what intersects it, exactly as the
+// full draw would. The cache is rebuilt when the at-rest scene changes (layout, mode,
+// selection, opacity, size), but only once it has held still for a frame, so an edit drag
+// keeps drawing directly instead of rebuilding every frame. Menus always draw directly.
+
+static PFNGLGENFRAMEBUFFERSPROC pglGenFramebuffers;
+static PFNGLDELETEFRAMEBUFFERSPROC pglDeleteFramebuffers;
+static PFNGLBINDFRAMEBUFFERPROC pglBindFramebuffer;
+static PFNGLFRAMEBUFFERRENDERBUFFERPROC pglFramebufferRenderbuffer;
+static PFNGLCHECKFRAMEBUFFERSTATUSPROC pglCheckFramebufferStatus;
+static PFNGLGENRENDERBUFFERSPROC pglGenRenderbuffers;
+static PFNGLDELETERENDERBUFFERSPROC pglDeleteRenderbuffers;
+static PFNGLBINDRENDERBUFFERPROC pglBindRenderbuffer;
+static PFNGLRENDERBUFFERSTORAGEPROC pglRenderbufferStorage;
+static PFNGLBLITFRAMEBUFFERPROC pglBlitFramebuffer;
+
+static bool gStaticAvailable = false;  // Framebuffer objects resolved
+static GLuint gStaticFbo = 0, gStaticRbo = 0;
+static int gStaticW = 0, gStaticH = 0; // Renderbuffer size
+static bool gStaticValid = false;
+static UiSnapshot gStaticView;         // What the cache was drawn from
+static float gStaticOpacity = -1.0f;
+
+static void StaticLayer_InitGL(void) {
+    pglGenFramebuffers = (PFNGLGENFRAMEBUFFERSPROC)eglGetProcAddress("glGenFramebuffers");
+    pglDeleteFramebuffers = (PFNGLDELETEFRAMEBUFFERSPROC)eglGetProcAddress("glDeleteFramebuffers");
+    pglBindFramebuffer = (PFNGLBINDFRAMEBUFFERPROC)eglGetProcAddress("glBindFramebuffer");
+    pglFramebufferRenderbuffer = (PFNGLFRAMEBUFFERRENDERBUFFERPROC)eglGetProcAddress("glFramebufferRenderbuffer");
+    pglCheckFramebufferStatus = (PFNGLCHECKFRAMEBUFFERSTATUSPROC)eglGetProcAddress("glCheckFramebufferStatus");
+    pglGenRenderbuffers = (PFNGLGENRENDERBUFFERSPROC)eglGetProcAddress("glGenRenderbuffers");
+    pglDeleteRenderbuffers = (PFNGLDELETERENDERBUFFERSPROC)eglGetProcAddress("glDeleteRenderbuffers");
+    pglBindRenderbuffer = (PFNGLBINDRENDERBUFFERPROC)eglGetProcAddress("glBindRenderbuffer");
+    pglRenderbufferStorage = (PFNGLRENDERBUFFERSTORAGEPROC)eglGetProcAddress("glRenderbufferStorage");
+    pglBlitFramebuffer = (PFNGLBLITFRAMEBUFFERPROC)eglGetProcAddress("glBlitFramebuffer");
+    const char *ext = (const char *)glGetString(GL_EXTENSIONS);
+    const char *version = (const char *)glGetString(GL_VERSION);
+    bool supported = (version && atoi(version) >= 3) || (ext && strstr(ext, "GL_ARB_framebuffer_object"));
+    gStaticAvailable = supported && pglGenFramebuffers && pglDeleteFramebuffers && pglBindFramebuffer &&
+                       pglFramebufferRenderbuffer && pglCheckFramebufferStatus && pglGenRenderbuffers &&
+                       pglDeleteRenderbuffers && pglBindRenderbuffer && pglRenderbufferStorage && pglBlitFramebuffer;
+    fprintf(stderr, "[GL] static layer cache %s\n", gStaticAvailable ? "yes" : "no");
+}
+
+static void StaticLayer_Destroy(void) {
+    if (gStaticFbo) pglDeleteFramebuffers(1, &gStaticFbo);
+    if (gStaticRbo) pglDeleteRenderbuffers(1, &gStaticRbo);
+    gStaticFbo = gStaticRbo = 0;
+    gStaticW = gStaticH = 0;
+    gStaticValid = false;
+}
+
+// Joystick dot centered, DPad and button released: the at-rest look the cache holds
+static bool Widget_IsAtRest(const Widget *w) {
+    return w->outputValue.x == 0.0f && w->outputValue.y == 0.0f &&
+           !(w->type == WIDGET_BUTTON && w->data.button.isPressed);
+}
+
+static Widget Widget_AtRest(const Widget *w) {
+    Widget r = *w;
+    r.outputValue = (Vec2){0.0f, 0.0f};
+    if (r.type == WIDGET_BUTTON) r.data.button.isPressed = false;
+    return r;
+}
+
+// Whether a and b look the same with every widget at rest
+static bool StaticLayer_SameScene(const UiSnapshot *a, const UiSnapshot *b) {
+    if (a->numWidgets != b->numWidgets || a->appState != b->appState || a->selectedWidgetId != b->selectedWidgetId ||
+        a->remappingWidgetId != b->remappingWidgetId || a->remapAction != b->remapAction || a->keyPage != b->keyPage ||
+        a->hudVisible != b->hudVisible || a->overlayActive != b->overlayActive ||
+        a->width != b->width || a->height != b->height) {
+        return false;
+    }
+    for (int i = 0; i < a->numWidgets; ++i) {
+        Widget wa = Widget_AtRest(&a->widgets[i]), wb = Widget_AtRest(&b->widgets[i]);
+        if (!Widget_DrawsSame(&wa, &wb)) return false;
+    }
+    return true;
+}
+
+static void Gl_Scissor(DamageRect r, int bufH) {
+    DamageRect b = Damage_ToBuffer(r);
+    glEnable(GL_SCISSOR_TEST); // GL's origin is bottom-left
+    glScissor((GLint)b.x0, (GLint)(bufH - b.y1), (GLsizei)(b.x1 - b.x0), (GLsizei)(b.y1 - b.y0));
+}
+
+// Whether RenderFrame may draw through the cache this frame
+static bool StaticLayer_Usable(void) {
+    ApplicationState appState = gView->appState;
+    if (!gStaticAvailable || !gView->overlayActive) return false;
+    if (appState != APP_STATE_RUNNING && appState != APP_STATE_EDIT_MODE) return false;
+    if (gStaticValid && gStaticOpacity == gMasterOpacity && StaticLayer_SameScene(&gStaticView, gView)) return true;
+    gStaticValid = false;
+    // Still changing since the last frame (e.g. a widget being dragged): not worth caching yet
+    return gLastDrawnOpacity == gMasterOpacity && StaticLayer_SameScene(&gLastDrawn, gView);
+}
+
+// Draws the at-rest scene into the cache at buffer size
+static bool StaticLayer_Rebuild(int screenW, int screenH, int bufW, int bufH) {
+    if (gStaticW != bufW || gStaticH != bufH) {
+        StaticLayer_Destroy();
+        pglGenRenderbuffers(1, &gStaticRbo);
+        pglBindRenderbuffer(GL_RENDERBUFFER, gStaticRbo);
+        pglRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, bufW, bufH);
+        pglGenFramebuffers(1, &gStaticFbo);
+        pglBindFramebuffer(GL_FRAMEBUFFER, gStaticFbo);
+        pglFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, gStaticRbo);
+        if (pglCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            fprintf(stderr, "[GL] static layer framebuffer incomplete, drawing directly\n");
+            pglBindFramebuffer(GL_FRAMEBUFFER, 0);
+            StaticLayer_Destroy();
+            gStaticAvailable = false;
+            return false;
+        }
+        gStaticW = bufW;
+        gStaticH = bufH;
+    }
+    pglBindFramebuffer(GL_FRAMEBUFFER, gStaticFbo);
+    glDisable(GL_SCISSOR_TEST);
+    glClear(GL_COLOR_BUFFER_BIT);
+    bool editMode = gView->appState != APP_STATE_RUNNING;
+    for (int i = 0; i < gView->numWidgets; ++i) {
+        Widget rest = Widget_AtRest(&gView->widgets[i]);
+        DrawWidget(&rest, editMode);
+    }
+    DrawMenusAndInterface(screenW, screenH);
+    pglBindFramebuffer(GL_FRAMEBUFFER, 0);
+    gStaticView = *gView;
+    gStaticOpacity = gMasterOpacity;
+    gStaticValid = true;
+    PERF_INC(staticRebuilds);
+    return true;
+}
+
+// Clears r within gRedrawRect and draws everything there as it is now
+static void StaticLayer_Repaint(DamageRect r, int screenW, int screenH, int bufH) {
+    DamageRect redraw = gRedrawRect;
+    if (!Damage_Intersects(r, redraw)) return;
+    gRedrawRect = (DamageRect){MAX(r.x0, redraw.x0), MAX(r.y0, redraw.y0), MIN(r.x1, redraw.x1), MIN(r.y1, redraw.y1)};
+    Gl_Scissor(gRedrawRect, bufH);
+    glClear(GL_COLOR_BUFFER_BIT);
+    DrawAllWidgets(screenW, screenH, gView->appState != APP_STATE_RUNNING);
+    DrawMenusAndInterface(screenW, screenH);
+    gRedrawRect = redraw;
+}
+
+// Draws gView within gRedrawRect: blit of the cache, then the widgets that moved away
+// from their rest state. partial tells whether RenderFrame has a scissor set. False if
+// the cache can't be used and RenderFrame has to draw directly.
+static bool StaticLayer_Draw(int screenW, int screenH, int bufW, int bufH, bool partial) {
+    if (!gStaticValid && !StaticLayer_Rebuild(screenW, screenH, bufW, bufH)) return false;
+    if (partial) Gl_Scissor(gRedrawRect, bufH); // Rebuild drops it; the blit honours it
+    pglBindFramebuffer(GL_READ_FRAMEBUFFER, gStaticFbo);
+    pglBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    pglBlitFramebuffer(0, 0, bufW, bufH, 0, 0, bufW, bufH, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    pglBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    for (int i = 0; i < gView->numWidgets; ++i) {
+        const Widget *w = &gView->widgets[i];
+        if (!Widget_IsAtRest(w)) StaticLayer_Repaint(Widget_DrawBounds(w), screenW, screenH, bufH);
+    }
+    if (gView->hudVisible) StaticLayer_Repaint(PerfHud_Bounds(screenW), screenW, screenH, bufH);
+
+    if (partial) {
+        Gl_Scissor(gRedrawRect, bufH);
+    } else {
+        glDisable(GL_SCISSOR_TEST);
+    }
+    return true;
+}
+
+#endif // !WLR_GAMEPAD_HEADLESS
+
 // --- Input Processing Logic ---
 
 static int map_key(int widget_id, Direction d) {
@@ -1266,74 +2990,184 @@ static int map_key(int widget_id, Direction d) {
     }
 }
 
+void InputState_Flush(void);
+
+// A key released and pressed again within one touch frame (e.g. a stick direction and a
+// button sharing a key hand over) would reach the game as a spurious release: drop both.
+// A press followed by a release is a tap and always goes out.
 static void enqueue_event(int widget_id, EventType type, int keycode) {
-    if (gInputEventCount < MAX_INPUT_EVENTS) {
-        gInputEvents[gInputEventCount++] = (InputEvent){widget_id, type, keycode};
-    } else {
-        D("Input event queue full!");
+    if (keycode < 0 || keycode >= KEY_CNT) return;
+    unsigned last = gPendingKeyEvent[keycode];
+    if (type == EVT_KEY_DOWN && last) {
+        InputEvent *prev = &gInputEvents[(last - 1) % INPUT_EVENT_QUEUE_SIZE];
+        if (prev->type == EVT_KEY_UP && prev->frame == gTouchFrame) {
+            prev->type = EVT_NONE;
+            gPendingKeyEvent[keycode] = 0;
+            PERF_INC(eventsCoalesced);
+            return;
+        }
     }
+    if (gInputEventHead - gInputEventTail == INPUT_EVENT_QUEUE_SIZE) {
+        PERF_INC(queueOverflows);
+        InputState_Flush(); // Out early, in order, instead of losing a key up
+    }
+    unsigned pos = gInputEventHead++;
+    gInputEvents[pos % INPUT_EVENT_QUEUE_SIZE] = (InputEvent){widget_id, type, keycode, gTouchFrame};
+    gPendingKeyEvent[keycode] = pos + 1;
 }
 
-void InputState_Update(void) {
-    for (int i = 0; i < gNumWidgets; ++i) {
-        Widget* w = &gWidgets[i];
+// Widget presses are reference counted per keycode: the key goes down on the first press
+// and up on the last release, so two widgets mapped to the same key (a stick direction and
+// a button, say) don't release it while the other still holds it. Trackpad clicks and
+// forwarded volume keys (INPUT_CMD_KEY) count too, since widgets can map LMB, VolDn and
+// VolUp. Input thread only.
+static uint16_t gKeyRefs[KEY_CNT];
 
-        if (w->type == WIDGET_JOYSTICK || w->type == WIDGET_DPAD) {
-            float x = w->outputValue.x;
-            float y = w->outputValue.y;
-            bool now_up    = (y < -0.5f);
-            bool now_down  = (y >  0.5f);
-            bool now_left  = (x < -0.5f);
-            bool now_right = (x >  0.5f);
-
-            static bool prev_up[MAX_WIDGETS] = {false};
-            static bool prev_down[MAX_WIDGETS] = {false};
-            static bool prev_left[MAX_WIDGETS] = {false};
-            static bool prev_right[MAX_WIDGETS] = {false};
-
-            if (w->controllingFinger == INVALID_FINGER_ID || (w->controllingFinger < MAX_MT_SLOTS && !mt_slots[w->controllingFinger].active) ) {
-                if (prev_up[i])    enqueue_event(w->id, EVT_KEY_UP, map_key(w->id, DIR_UP));
-                if (prev_down[i])  enqueue_event(w->id, EVT_KEY_UP, map_key(w->id, DIR_DOWN));
-                if (prev_left[i])  enqueue_event(w->id, EVT_KEY_UP, map_key(w->id, DIR_LEFT));
-                if (prev_right[i]) enqueue_event(w->id, EVT_KEY_UP, map_key(w->id, DIR_RIGHT));
-                prev_up[i] = prev_down[i] = prev_left[i] = prev_right[i] = false;
-                continue;
-            }
+static void Keys_Press(int keycode) {
+    if (keycode < 0 || keycode >= KEY_CNT) return;
+    if (gKeyRefs[keycode]++ == 0) uinput_key(keycode, true);
+}
 
-            if (now_up != prev_up[i]) {
-                enqueue_event(w->id, now_up ? EVT_KEY_DOWN : EVT_KEY_UP, map_key(w->id, DIR_UP));
-                prev_up[i] = now_up;
-            }
-            if (now_down != prev_down[i]) {
-                enqueue_event(w->id, now_down ? EVT_KEY_DOWN : EVT_KEY_UP, map_key(w->id, DIR_DOWN));
-                prev_down[i] = now_down;
-            }
-            if (now_left != prev_left[i]) {
-                enqueue_event(w->id, now_left ? EVT_KEY_DOWN : EVT_KEY_UP, map_key(w->id, DIR_LEFT));
-                prev_left[i] = now_left;
-            }
-            if (now_right != prev_right[i]) {
-                enqueue_event(w->id, now_right ? EVT_KEY_DOWN : EVT_KEY_UP, map_key(w->id, DIR_RIGHT));
-                prev_right[i] = now_right;
-            }
+static void Keys_Release(int keycode) {
+    if (keycode < 0 || keycode >= KEY_CNT || gKeyRefs[keycode] == 0) return;
+    if (--gKeyRefs[keycode] == 0) uinput_key(keycode, false);
+}
+
+static void Keys_ReleaseAll(void) {
+    uinput_release_all();
+    memset(gKeyRefs, 0, sizeof(gKeyRefs));
+}
+
+// Direction state last reported for each analog widget, indexed like gWidgets
+static bool prev_up[MAX_WIDGETS], prev_down[MAX_WIDGETS], prev_left[MAX_WIDGETS], prev_right[MAX_WIDGETS];
+
+// Drop queued events without writing them
+static void InputState_DiscardEvents(void) {
+    for (unsigned pos = gInputEventTail; pos != gInputEventHead; ++pos) {
+        gPendingKeyEvent[gInputEvents[pos % INPUT_EVENT_QUEUE_SIZE].keycode] = 0;
+    }
+    gInputEventTail = gInputEventHead;
+}
+
+// Forget reported direction state and queued events, e.g. after the widget array was replaced
+static void InputState_Reset(void) {
+    InputState_DiscardEvents();
+    memset(prev_up, 0, sizeof(prev_up));
+    memset(prev_down, 0, sizeof(prev_down));
+    memset(prev_left, 0, sizeof(prev_left));
+    memset(prev_right, 0, sizeof(prev_right));
+}
+
+static void InputState_UpdateWidget(int i) {
+    Widget* w = &gWidgets[i];
+
+    if (w->type == WIDGET_JOYSTICK || w->type == WIDGET_DPAD) {
+        float x = w->outputValue.x;
+        float y = w->outputValue.y;
+        bool now_up    = (y < -0.5f);
+        bool now_down  = (y >  0.5f);
+        bool now_left  = (x < -0.5f);
+        bool now_right = (x >  0.5f);
+
+        if (w->controllingFinger == INVALID_FINGER_ID || (w->controllingFinger < gNumTouchSlots && !mt_slots[w->controllingFinger].active) ) {
+            if (prev_up[i])    enqueue_event(w->id, EVT_KEY_UP, map_key(w->id, DIR_UP));
+            if (prev_down[i])  enqueue_event(w->id, EVT_KEY_UP, map_key(w->id, DIR_DOWN));
+            if (prev_left[i])  enqueue_event(w->id, EVT_KEY_UP, map_key(w->id, DIR_LEFT));
+            if (prev_right[i]) enqueue_event(w->id, EVT_KEY_UP, map_key(w->id, DIR_RIGHT));
+            prev_up[i] = prev_down[i] = prev_left[i] = prev_right[i] = false;
+            return;
+        }
+
+        if (now_up != prev_up[i]) {
+            enqueue_event(w->id, now_up ? EVT_KEY_DOWN : EVT_KEY_UP, map_key(w->id, DIR_UP));
+            prev_up[i] = now_up;
         }
+        if (now_down != prev_down[i]) {
+            enqueue_event(w->id, now_down ? EVT_KEY_DOWN : EVT_KEY_UP, map_key(w->id, DIR_DOWN));
+            prev_down[i] = now_down;
+        }
+        if (now_left != prev_left[i]) {
+            enqueue_event(w->id, now_left ? EVT_KEY_DOWN : EVT_KEY_UP, map_key(w->id, DIR_LEFT));
+            prev_left[i] = now_left;
+        }
+        if (now_right != prev_right[i]) {
+            enqueue_event(w->id, now_right ? EVT_KEY_DOWN : EVT_KEY_UP, map_key(w->id, DIR_RIGHT));
+            prev_right[i] = now_right;
+        }
+    }
+}
+
+// gWidgets[index] is about to be removed: release the keys it holds and move the key
+// state of the widgets after it down with them
+static void InputState_RemoveWidget(int index) {
+    const Widget *w = &gWidgets[index];
+    if (w->type == WIDGET_BUTTON) {
+        if (w->data.button.isPressed) enqueue_event(w->id, EVT_KEY_UP, w->data.button.keycode);
+    } else {
+        if (prev_up[index])    enqueue_event(w->id, EVT_KEY_UP, map_key(w->id, DIR_UP));
+        if (prev_down[index])  enqueue_event(w->id, EVT_KEY_UP, map_key(w->id, DIR_DOWN));
+        if (prev_left[index])  enqueue_event(w->id, EVT_KEY_UP, map_key(w->id, DIR_LEFT));
+        if (prev_right[index]) enqueue_event(w->id, EVT_KEY_UP, map_key(w->id, DIR_RIGHT));
+    }
+    size_t n = (size_t)(gNumWidgets - 1 - index);
+    memmove(&prev_up[index], &prev_up[index + 1], n);
+    memmove(&prev_down[index], &prev_down[index + 1], n);
+    memmove(&prev_left[index], &prev_left[index + 1], n);
+    memmove(&prev_right[index], &prev_right[index + 1], n);
+    int last = gNumWidgets - 1;
+    prev_up[last] = prev_down[last] = prev_left[last] = prev_right[last] = false;
+}
+
+// Direction keys of the widgets the last ProcessAllWidgetsInput ran; the others kept
+// their output, so their keys can't have changed
+void InputState_Update(void) {
+    if (gChangedAllWidgets) {
+        for (int i = 0; i < gNumWidgets; ++i) InputState_UpdateWidget(i);
+        return;
     }
+    for (int n = 0; n < gNumChangedWidgets; ++n) InputState_UpdateWidget(gChangedWidgets[n]);
 }
 
 void InputState_Flush(void) {
-    for (int i = 0; i < gInputEventCount; ++i) {
-        InputEvent *e = &gInputEvents[i];
-        uinput_key(e->keycode, e->type == EVT_KEY_DOWN);
+    unsigned pending = gInputEventHead - gInputEventTail;
+    PERF_MAX(queueHighWater, pending);
+    for (unsigned pos = gInputEventTail; pos != gInputEventHead; ++pos) {
+        InputEvent *e = &gInputEvents[pos % INPUT_EVENT_QUEUE_SIZE];
+        if (e->type == EVT_KEY_DOWN) Keys_Press(e->keycode);
+        else if (e->type == EVT_KEY_UP) Keys_Release(e->keycode);
+        if (gPendingKeyEvent[e->keycode] == pos + 1) gPendingKeyEvent[e->keycode] = 0;
     }
-    gInputEventCount = 0;
+    gInputEventTail = gInputEventHead;
 }
 
+// Widget output only depends on its controlling contact, so after the first full pass
+// only the widgets of slots that changed are run. A widget whose contact just lifted is
+// still reached through the slot's widgetIndex and runs once more to release; if the slot
+// came down again before that, the touch-down asks for a full pass instead.
 void ProcessAllWidgetsInput(void) {
     if (gAppState != APP_STATE_RUNNING) {
+        gProcessAllWidgets = gChangedAllWidgets = true; // Contacts may come and go meanwhile
         return;
     }
-    for (int i = 0; i < gNumWidgets; ++i) {
-        widget_proc_tbl[gWidgets[i].type](&gWidgets[i]);
+    uint64_t dirty = gDirtySlots;
+    gDirtySlots = 0;
+    gNumChangedWidgets = 0;
+    gChangedAllWidgets = gProcessAllWidgets;
+    if (gProcessAllWidgets) {
+        gProcessAllWidgets = false;
+        LiveWidgets_ProcessAll();
+        return;
+    }
+    for (; dirty; dirty &= dirty - 1) {
+        int s = __builtin_ctzll(dirty);
+        MTSlot *slot = &mt_slots[s];
+        int i = slot->widgetIndex;
+        if (!slot->active) slot->widgetIndex = -1;
+        if (i < 0 || i >= gNumWidgets) continue;
+        int finger = gWidgets[i].controllingFinger;
+        if (finger != s && finger != INVALID_FINGER_ID) continue; // Taken over since
+        Widget_Process(i);
+        gChangedWidgets[gNumChangedWidgets++] = i;
     }
 }
 
@@ -1407,6 +3241,17 @@ bool HandleUITouchDown(Vec2 p, uint32_t id) {
             return true;
         }
     }
+
+    // Performance HUD toggle
+    if (p.x >= kHudButtonX && p.x <= kHudButtonX + kHudButtonW &&
+        p.y >= kHudButtonY && p.y <= kHudButtonY + kHudButtonH) {
+        if (gAppState == APP_STATE_EDIT_MODE) {
+            gHudVisible = !gHudVisible;
+            D("UI: Perf button pressed id=%d, HUD %s", id, gHudVisible ? "on" : "off");
+            gLastUIFinger = id;
+            return true;
+        }
+    }
     return false;
 }
 
@@ -1470,6 +3315,10 @@ static void init_touch_device(const char *device) {
         close(gTouchDevFd); // Close fd on failure
         exit(EXIT_FAILURE);
     }
+    int clk = CLOCK_MONOTONIC; // Timestamp events on the same clock as clock_ns()
+    if (ioctl(gTouchDevFd, EVIOCSCLOCKID, &clk) < 0) {
+        perror("EVIOCSCLOCKID");
+    }
     struct input_absinfo absinfo;
     if (ioctl(gTouchDevFd, EVIOCGABS(ABS_MT_POSITION_X), &absinfo) == 0) {
         touch_min_x = absinfo.minimum;
@@ -1479,26 +3328,113 @@ static void init_touch_device(const char *device) {
         touch_min_y = absinfo.minimum;
         touch_max_y = absinfo.maximum;
     } else { /* Handle error or set defaults */ }
-    D("Touchscreen initialized: X(%d-%d), Y(%d-%d)", touch_min_x, touch_max_x, touch_min_y, touch_max_y);
+    if (ioctl(gTouchDevFd, EVIOCGABS(ABS_MT_SLOT), &absinfo) == 0 && absinfo.maximum >= 0) {
+        gNumTouchSlots = absinfo.maximum + 1;
+        if (gNumTouchSlots > MAX_MT_SLOTS) {
+            fprintf(stderr, "Touchscreen has %d slots, tracking the first %d\n", gNumTouchSlots, MAX_MT_SLOTS);
+            gNumTouchSlots = MAX_MT_SLOTS;
+        }
+    }
+    D("Touchscreen initialized: X(%d-%d), Y(%d-%d), %d slots", touch_min_x, touch_max_x, touch_min_y, touch_max_y, gNumTouchSlots);
+}
+
+// --- Touch Resynchronization ---
+// After SYN_DROPPED the kernel has thrown events away, so the slots no longer match the
+// contacts on the screen: a finger lifted during the overflow would stay active forever,
+// holding its joystick or key. The rest of that frame is discarded (it is incomplete);
+// at its SYN_REPORT the real contacts are read back with EVIOCGMTSLOTS and the difference
+// is replayed through handle_evdev_event as ordinary ABS events. Contacts that ended, or
+// were replaced by a new one in the same slot, are released in a frame of their own first,
+// so widgets and the trackpad see the up before any new down.
+
+typedef struct {
+    __u32 code;
+    __s32 values[MAX_MT_SLOTS];
+} MTSlotsQuery; // EVIOCGMTSLOTS layout
+
+static void Touch_Inject(struct input_event e, int code, int value) {
+    e.code = code;
+    e.value = value;
+    handle_evdev_event(&e);
+}
+
+// report: the SYN_REPORT ending the discarded frame, processed by the caller afterwards
+static void Touch_Resync(const struct input_event *report) {
+    MTSlotsQuery ids = {.code = ABS_MT_TRACKING_ID};
+    MTSlotsQuery xs = {.code = ABS_MT_POSITION_X};
+    MTSlotsQuery ys = {.code = ABS_MT_POSITION_Y};
+    struct input_absinfo slotInfo = {0};
+    bool ok = ioctl(gTouchDevFd, EVIOCGMTSLOTS(sizeof(ids)), &ids) >= 0 &&
+              ioctl(gTouchDevFd, EVIOCGMTSLOTS(sizeof(xs)), &xs) >= 0 &&
+              ioctl(gTouchDevFd, EVIOCGMTSLOTS(sizeof(ys)), &ys) >= 0 &&
+              ioctl(gTouchDevFd, EVIOCGABS(ABS_MT_SLOT), &slotInfo) >= 0;
+    PERF_INC(touchResyncs);
+    if (!ok) { // State unknown: lifting every contact is safer than leaving one stuck
+        PERF_INC(touchResyncFailures);
+        for (int s = 0; s < gNumTouchSlots; ++s) ids.values[s] = -1;
+        slotInfo.value = current_slot;
+    }
+    D("SYN_DROPPED: resynchronizing slots%s", ok ? "" : " failed, releasing all contacts");
+    SlotHistory_Reset(); // Positions in between were lost
+
+    struct input_event e = *report;
+    e.type = EV_ABS;
+    bool lifted = false;
+    for (int s = 0; s < gNumTouchSlots; ++s) {
+        if (mt_slots[s].active && ids.values[s] != mt_slots[s].trackingId) {
+            Touch_Inject(e, ABS_MT_SLOT, s);
+            Touch_Inject(e, ABS_MT_TRACKING_ID, -1);
+            lifted = true;
+        }
+    }
+    if (lifted) handle_evdev_event(report);
+    for (int s = 0; s < gNumTouchSlots; ++s) {
+        if (ids.values[s] < 0) continue;
+        Touch_Inject(e, ABS_MT_SLOT, s);
+        if (!mt_slots[s].active) Touch_Inject(e, ABS_MT_TRACKING_ID, ids.values[s]);
+        Touch_Inject(e, ABS_MT_POSITION_X, xs.values[s]);
+        Touch_Inject(e, ABS_MT_POSITION_Y, ys.values[s]);
+    }
+    Touch_Inject(e, ABS_MT_SLOT, slotInfo.value);
 }
 
 static void handle_evdev_event(const struct input_event *ev) {
+    if (gTouchDropped) {
+        if (ev->type != EV_SYN || ev->code != SYN_REPORT) return; // Rest of an incomplete frame
+        gTouchDropped = false;
+        Touch_Resync(ev);
+    }
     switch (ev->type) {
         case EV_ABS:
             if (ev->code == ABS_MT_SLOT) {
-                current_slot = ev->value % MAX_MT_SLOTS;
+                // Slots past the table are ignored until the next ABS_MT_SLOT, never aliased
+                current_slot = (ev->value >= 0 && ev->value < gNumTouchSlots) ? ev->value : -1;
             } else if (ev->code == ABS_MT_TRACKING_ID) {
-                if (current_slot < 0 || current_slot >= MAX_MT_SLOTS) break; // Invalid slot
+                if (current_slot < 0 || current_slot >= gNumTouchSlots) break; // Invalid slot
+                gSyncSlots |= 1ULL << current_slot;
                 if (ev->value >= 0) { // Touch down
+                    int prev = mt_slots[current_slot].widgetIndex;
+                    if (prev >= 0) {
+                        // The last contact's lift hasn't reached ProcessAllWidgetsInput yet (same
+                        // read, or a Touch_Resync replay): let go of its widget and run a full pass,
+                        // which still reaches it through the live mask
+                        if (prev < gNumWidgets && gWidgets[prev].controllingFinger == current_slot) {
+                            Widget_SetFinger(prev, INVALID_FINGER_ID);
+                        }
+                        gProcessAllWidgets = true;
+                    }
                     mt_slots[current_slot].active = true;
+                    mt_slots[current_slot].trackingId = ev->value;
+                    mt_slots[current_slot].widgetIndex = -1;
                     mt_slots[current_slot].was_down = false; // Will be set true after processing this event batch
-                    slot_mode[current_slot] = SLOT_IDLE;   // Default mode
+                    mt_slots[current_slot].mode = SLOT_IDLE;   // Default mode
                 } else { // Touch up
                     mt_slots[current_slot].active = false;
                     // was_down will be handled in SYN_REPORT
                 }
             } else if (ev->code == ABS_MT_POSITION_X) {
-                if (current_slot < 0 || current_slot >= MAX_MT_SLOTS) break;
+                if (current_slot < 0 || current_slot >= gNumTouchSlots) break;
+                gSyncSlots |= 1ULL << current_slot;
                 if (gLandscapeMode) {
                     mt_slots[current_slot].y = (touch_max_x > touch_min_x) ?
                         (double)(touch_max_x - ev->value) / (touch_max_x - touch_min_x) * height : 0;
@@ -1507,7 +3443,8 @@ static void handle_evdev_event(const struct input_event *ev) {
                         (double)(ev->value - touch_min_x) / (touch_max_x - touch_min_x) * width : 0;
                 }
             } else if (ev->code == ABS_MT_POSITION_Y) {
-                if (current_slot < 0 || current_slot >= MAX_MT_SLOTS) break;
+                if (current_slot < 0 || current_slot >= gNumTouchSlots) break;
+                gSyncSlots |= 1ULL << current_slot;
                 if (gLandscapeMode) {
                     mt_slots[current_slot].x = (touch_max_y > touch_min_y) ?
                         (double)(ev->value - touch_min_y) / (touch_max_y - touch_min_y) * width : 0;
@@ -1519,17 +3456,35 @@ static void handle_evdev_event(const struct input_event *ev) {
             break;
 
         case EV_SYN:
+            if (ev->code == SYN_DROPPED) {
+                PERF_INC(synDropped);
+                gTouchDropped = true;
+                D("SYN_DROPPED: evdev buffer overflow");
+            }
             if (ev->code == SYN_REPORT) {
-                for (int s = 0; s < MAX_MT_SLOTS; ++s) {
+                PERF_INC(synReports);
+                gTouchFrame++;
+                // Kernel timestamp (CLOCK_MONOTONIC, see init_touch_device) for touch->uinput latency.
+                // Frames batched before one flush are measured from the first of them.
+                uint64_t frameNs = (uint64_t)ev->input_event_sec * 1000000000ULL + (uint64_t)ev->input_event_usec * 1000ULL;
+                if (!gPendingTouchNs) gPendingTouchNs = frameNs;
+                if (gUndrawnTouchNs <= atomic_load_explicit(&gDrawnTouchNs, memory_order_relaxed)) gUndrawnTouchNs = frameNs;
+                if (gTraceRing) Trace_Instant(TRACE_TOUCH_FRAME, (int32_t)((clock_ns(CLOCK_MONOTONIC) - frameNs) / 1000));
+                uint64_t changed = gSyncSlots;
+                gSyncSlots = 0;
+                gDirtySlots |= changed;
+                for (; changed; changed &= changed - 1) { // Slots untouched since the last frame have nothing to do
+                    int s = __builtin_ctzll(changed);
                     MTSlot *slot = &mt_slots[s];
                     Vec2 p = {slot->x, slot->y};
                     bool handled_by_ui_button = false;
+                    if (gPredictNs && slot->active) SlotHistory_Push(s, frameNs, p.x, p.y, !slot->was_down);
 
                     // Touch Down Logic
                     if (slot->active && !slot->was_down) {
                         handled_by_ui_button = HandleUITouchDown(p, s);
                         if (handled_by_ui_button) {
-                            slot_mode[s] = SLOT_WIDGET; // UI buttons are treated as widgets for flow
+                            mt_slots[s].mode = SLOT_WIDGET; // UI buttons are treated as widgets for flow
                         } else {
                             switch (gAppState) {
                                 case APP_STATE_RUNNING:
@@ -1541,17 +3496,17 @@ static void handle_evdev_event(const struct input_event *ev) {
                                     }
                                     if (overWidget) {
                                         D("Widget control START for widget %d by slot %d", hitWidget->id, s);
-                                        slot_mode[s] = SLOT_WIDGET;
-                                        hitWidget->controllingFinger = s;
-                                        if (widget_proc_tbl[hitWidget->type]) {
-                                            widget_proc_tbl[hitWidget->type](hitWidget); // Initial process
-                                        }
+                                        mt_slots[s].mode = SLOT_WIDGET;
+                                        int hitIndex = (int)(hitWidget - gWidgets);
+                                        Widget_SetFinger(hitIndex, s);
+                                        mt_slots[s].widgetIndex = (short)hitIndex;
+                                        Widget_Process(hitIndex); // Initial process
                                     } else {
                                         D("Trackpad START for slot %d", s);
-                                        slot_mode[s] = SLOT_TRACKPAD;
-                                        track_last_x[s] = p.x; track_last_y[s] = p.y;
-                                        track_accum_x[s] = 0; track_accum_y[s] = 0;
-                                        track_moved[s] = false;
+                                        mt_slots[s].mode = SLOT_TRACKPAD;
+                                        mt_slots[s].trackLastX = p.x; mt_slots[s].trackLastY = p.y;
+                                        mt_slots[s].trackAccumX = 0; mt_slots[s].trackAccumY = 0;
+                                        mt_slots[s].trackMoved = false;
                                     }
                                     break;
                                 case APP_STATE_EDIT_MODE:
@@ -1581,14 +3536,14 @@ static void handle_evdev_event(const struct input_event *ev) {
                                                 gEditState.startTouchPos = p;
                                                 gEditState.startWidgetCenter = w->absCenter;
                                             }
-                                            hitWidgetAction = true; slot_mode[s] = SLOT_WIDGET;
+                                            hitWidgetAction = true; mt_slots[s].mode = SLOT_WIDGET;
                                             break; 
                                         }
                                     }
                                     if (!hitWidgetAction) { // Clicked on background
                                         D("Touch in APP_STATE_EDIT_MODE on background (slot %d) -> Deselecting widget %d", s, gSelectedWidgetId);
                                         gSelectedWidgetId = 0;
-                                        // slot_mode[s] remains SLOT_IDLE or is handled by UI
+                                        // mt_slots[s].mode remains SLOT_IDLE or is handled by UI
                                     }
                                     break;
                                 case APP_STATE_MENU_ADD_WIDGET:
@@ -1603,7 +3558,7 @@ static void handle_evdev_event(const struct input_event *ev) {
                                                 CreateWidget(availableWidgetTypes[i], (Vec2){0.5f, 0.5f}, 0.1f);
                                                 gAppState = APP_STATE_EDIT_MODE;
                                                 D("State transition -> APP_STATE_EDIT_MODE");
-                                                slot_mode[s] = SLOT_WIDGET; // Consumed by menu
+                                                mt_slots[s].mode = SLOT_WIDGET; // Consumed by menu
                                                 break;
                                             }
                                         }
@@ -1627,14 +3582,14 @@ static void handle_evdev_event(const struct input_event *ev) {
                                                     int idx = FindWidgetIndexById(gSelectedWidgetId);
                                                     if (idx != -1) {
                                                         gRemappingWidgetId = gSelectedWidgetId;
-                                                        if (gWidgets[idx].type == WIDGET_BUTTON) gAppState = APP_STATE_MENU_REMAP_KEY;
+                                                        if (gWidgets[idx].type == WIDGET_BUTTON) KeyMenu_Open(gWidgets[idx].data.button.keycode);
                                                         else if (gWidgets[idx].type == WIDGET_JOYSTICK || gWidgets[idx].type == WIDGET_DPAD) {
                                                             gRemapAction = 0; // Default to "Up"
                                                             gAppState = APP_STATE_MENU_REMAP_ACTION;
                                                         } else gAppState = APP_STATE_MENU_WIDGET_PROPERTIES; // Unsupported
                                                     }
                                                 }
-                                                slot_mode[s] = SLOT_WIDGET;
+                                                mt_slots[s].mode = SLOT_WIDGET;
                                                 break;
                                             }
                                         }
@@ -1649,8 +3604,10 @@ static void handle_evdev_event(const struct input_event *ev) {
                                             float btnX = startX; float btnY = startY + i * (kMenuButtonH + kMenuButtonSpacing);
                                             if (p.x >= btnX && p.x <= btnX + kMenuButtonW && p.y >= btnY && p.y <= btnY + kMenuButtonH) {
                                                 D("Analog Action Selection: picked '%s' for widget %d", availableAnalogActionNames[i], gRemappingWidgetId);
-                                                gRemapAction = i; gAppState = APP_STATE_MENU_REMAP_KEY;
-                                                slot_mode[s] = SLOT_WIDGET;
+                                                int idx = FindWidgetIndexById(gRemappingWidgetId);
+                                                gRemapAction = i;
+                                                KeyMenu_Open(idx != -1 ? gWidgets[idx].data.analog.keycode[i] : 0);
+                                                mt_slots[s].mode = SLOT_WIDGET;
                                                 break;
                                             }
                                         }
@@ -1659,68 +3616,68 @@ static void handle_evdev_event(const struct input_event *ev) {
                                 case APP_STATE_MENU_REMAP_KEY:
                                     {
                                         // Detect touch hit on key buttons using cached grid layout
-                                        for (int i = 0; i < gNumMappableKeys; ++i) {
-                                            int row = i / gKeyGridLayout.cols;
-                                            int col = i % gKeyGridLayout.cols;
-                                            float btnX = gKeyGridLayout.startX + col * (gKeyGridLayout.cellSize + gKeyGridLayout.cellSpacing);
-                                            float btnY = gKeyGridLayout.startY + row * (gKeyGridLayout.cellSize + gKeyGridLayout.cellSpacing);
-                                            if (p.x >= btnX && p.x <= btnX + gKeyGridLayout.cellSize &&
-                                                p.y >= btnY && p.y <= btnY + gKeyGridLayout.cellSize) {
-                                                D("Key Selection: Hit button %d ('%s')", i, gMappableKeys[i].label);
-                                                int idx = FindWidgetIndexById(gRemappingWidgetId);
-                                                if (idx != -1) {
-                                                    Widget* w = &gWidgets[idx];
-                                                    if (w->type == WIDGET_BUTTON) {
-                                                        w->data.button.keycode = gMappableKeys[i].keycode;
-                                                        w->data.button.mappedLabel = gMappableKeys[i].label;
-                                                    } else if (w->type == WIDGET_JOYSTICK || w->type == WIDGET_DPAD) {
-                                                        if (gRemapAction >= 0 && gRemapAction < numAnalogActions) {
-                                                            w->data.analog.keycode[gRemapAction] = gMappableKeys[i].keycode;
-                                                            w->data.analog.mappedLabel[gRemapAction] = gMappableKeys[i].label;
-                                                        }
+                                        const KeyPage *page = &kKeyPages[gKeyPage];
+                                        int hit = KeyGrid_Hit(&gKeyGridLayout, p);
+                                        if (hit == KEY_GRID_PREV || hit == KEY_GRID_NEXT) {
+                                            gKeyPage = (gKeyPage + (hit == KEY_GRID_NEXT ? 1 : KEY_PAGE_MAX - 1)) % KEY_PAGE_MAX;
+                                            D("Key Selection: page %d ('%s')", gKeyPage, kKeyPages[gKeyPage].name);
+                                            mt_slots[s].mode = SLOT_WIDGET;
+                                        } else if (hit >= 0 && hit < page->numKeys) {
+                                            int keycode = page->keys[hit];
+                                            const char *label = kKeyInfo[keycode].label;
+                                            D("Key Selection: Hit button %d ('%s')", hit, label);
+                                            int idx = FindWidgetIndexById(gRemappingWidgetId);
+                                            if (idx != -1) {
+                                                Widget* w = &gWidgets[idx];
+                                                if (w->type == WIDGET_BUTTON) {
+                                                    w->data.button.keycode = keycode;
+                                                    w->data.button.mappedLabel = label;
+                                                } else if (w->type == WIDGET_JOYSTICK || w->type == WIDGET_DPAD) {
+                                                    if (gRemapAction >= 0 && gRemapAction < numAnalogActions) {
+                                                        w->data.analog.keycode[gRemapAction] = keycode;
+                                                        w->data.analog.mappedLabel[gRemapAction] = label;
                                                     }
                                                 }
-                                                gRemappingWidgetId = 0; gRemapAction = -1;
-                                                gAppState = APP_STATE_EDIT_MODE;
-                                                D("State transition -> APP_STATE_EDIT_MODE (from remap_key)");
-                                                slot_mode[s] = SLOT_WIDGET;
-                                                break;
                                             }
+                                            gRemappingWidgetId = 0; gRemapAction = -1;
+                                            gAppState = APP_STATE_EDIT_MODE;
+                                            D("State transition -> APP_STATE_EDIT_MODE (from remap_key)");
+                                            mt_slots[s].mode = SLOT_WIDGET;
                                         }
-                                         }
-                                         break;
+                                    }
+                                    break;
                             } // end switch gAppState
                         } // end else !handled_by_ui_button
                         // Global catch: any tap outside active menu should cancel it
                         if (!handled_by_ui_button
-                            && slot_mode[s] == SLOT_IDLE
+                            && mt_slots[s].mode == SLOT_IDLE
                             && gAppState != APP_STATE_RUNNING
                             && gAppState != APP_STATE_EDIT_MODE)
                         {
                             D("Touch outside menu -> cancelling current menu");
                             gAppState = APP_STATE_EDIT_MODE;
-                            slot_mode[s] = SLOT_WIDGET; // consume this touch
+                            mt_slots[s].mode = SLOT_WIDGET; // consume this touch
                         }
                         slot->was_down = true; // Mark as processed for down state
                     }
                     // Motion Logic
                     else if (slot->active && slot->was_down) {
-                        if (slot_mode[s] == SLOT_WIDGET) {
+                        if (mt_slots[s].mode == SLOT_WIDGET) {
                             if (gAppState == APP_STATE_EDIT_MODE && gEditState.targetWidget && gEditState.action != EDIT_NONE) {
                                 HandleWidgetEditAction(p);
                             }
                             // In RUNNING state, widget_process called in main loop handles motion via controllingFinger
-                        } else if (slot_mode[s] == SLOT_TRACKPAD) {
+                        } else if (mt_slots[s].mode == SLOT_TRACKPAD) {
                             if (gAppState == APP_STATE_RUNNING) {
-                                double dx = p.x - track_last_x[s]; double dy = p.y - track_last_y[s];
+                                double dx = p.x - mt_slots[s].trackLastX; double dy = p.y - mt_slots[s].trackLastY;
                                 if (dx != 0 || dy != 0) {
-                                    track_last_x[s] = p.x; track_last_y[s] = p.y;
-                                    track_accum_x[s] += dx * kTrackpadSensitivity;
-                                    track_accum_y[s] += dy * kTrackpadSensitivity;
-                                    int mx = (int)track_accum_x[s], my = (int)track_accum_y[s];
+                                    mt_slots[s].trackLastX = p.x; mt_slots[s].trackLastY = p.y;
+                                    mt_slots[s].trackAccumX += dx * gTrackpadSensitivity;
+                                    mt_slots[s].trackAccumY += dy * gTrackpadSensitivity;
+                                    int mx = (int)mt_slots[s].trackAccumX, my = (int)mt_slots[s].trackAccumY;
                                     if (mx || my) {
-                                        track_moved[s] = true; uinput_move(mx, my);
-                                        track_accum_x[s] -= mx; track_accum_y[s] -= my;
+                                        mt_slots[s].trackMoved = true; uinput_move(mx, my);
+                                        mt_slots[s].trackAccumX -= mx; mt_slots[s].trackAccumY -= my;
                                     }
                                 }
                             }
@@ -1730,7 +3687,7 @@ static void handle_evdev_event(const struct input_event *ev) {
                     else if (!slot->active && slot->was_down) {
                         if (s == gLastUIFinger) gLastUIFinger = -1; // Debounce UI finger
 
-                        if (slot_mode[s] == SLOT_WIDGET) {
+                        if (mt_slots[s].mode == SLOT_WIDGET) {
                             D("Slot %d WIDGET release in state %d", s, gAppState);
                             if (gAppState == APP_STATE_EDIT_MODE) {
                                 if (gEditState.targetWidget && gEditState.action != EDIT_NONE) {
@@ -1744,24 +3701,24 @@ static void handle_evdev_event(const struct input_event *ev) {
                                 for (int i = 0; i < gNumWidgets; ++i) {
                                     if (gWidgets[i].controllingFinger == s) {
                                         D("Releasing finger from widget %d (slot %d)", gWidgets[i].id, s);
-                                        gWidgets[i].controllingFinger = INVALID_FINGER_ID;
+                                        Widget_SetFinger(i, INVALID_FINGER_ID);
                                         // Widget's _process or InputState_Update will handle state reset.
                                         break;
                                     }
                                 }
                             }
-                        } else if (slot_mode[s] == SLOT_TRACKPAD) {
+                        } else if (mt_slots[s].mode == SLOT_TRACKPAD) {
                             D("Slot %d TRACKPAD release in state %d", s, gAppState);
                             if (gAppState == APP_STATE_RUNNING) {
-                                if (!track_moved[s]) { // If no movement, it's a click
-                                    uinput_key(BTN_LEFT, true); uinput_key(BTN_LEFT, false);
+                                if (!mt_slots[s].trackMoved) { // If no movement, it's a click
+                                    Keys_Press(BTN_LEFT); Keys_Release(BTN_LEFT); // A widget on LMB keeps it held
                                     D("Trackpad click generated for slot %d", s);
                                 }
                             }
                         } else {
-                             D("Slot %d release in IDLE/unexpected mode (%d)", s, slot_mode[s]);
+                             D("Slot %d release in IDLE/unexpected mode (%d)", s, mt_slots[s].mode);
                         }
-                        slot_mode[s] = SLOT_IDLE; // Reset mode on release
+                        mt_slots[s].mode = SLOT_IDLE; // Reset mode on release
                         slot->was_down = false;   // Mark as processed for up state
                     }
                 } // end for each slot
@@ -1771,140 +3728,1658 @@ static void handle_evdev_event(const struct input_event *ev) {
 }
 
 
-// --- Wayland Setup and Callbacks ---
+// --- Profiles ---
+// Plain text, one widget per line, keycodes are Linux KEY_ codes:
+//   joystick|dpad <centerX> <centerY> <halfSize> <up> <down> <left> <right>
+//   button <centerX> <centerY> <halfSize> <key>
+//   opacity <0..1>
+//   sensitivity <factor>
+// Coordinates are normalized [0..1] like Widget.normCenter/normHalfSize.
 
-static const struct wl_registry_listener registry_listener = {
-    .global = registry_handle_global,
-    .global_remove = NULL,
+static const char *kWidgetTypeNames[WIDGET_MAX] = {
+  #define X(name, func) #func,
+    WIDGET_TYPE_LIST
+  #undef X
 };
 
-static void registry_handle_global(void *data, struct wl_registry *registry_ptr,
-                                   uint32_t name, const char *interface, uint32_t version) {
-    D("registry_handle_global: interface=%s", interface);
-    if (strcmp(interface, wl_compositor_interface.name) == 0) {
-        compositor = wl_registry_bind(registry_ptr, name, &wl_compositor_interface, 4);
-        D("Bound wl_compositor: %p", compositor);
-    } else if (strcmp(interface, zwlr_layer_shell_v1_interface.name) == 0) {
-        layer_shell = wl_registry_bind(registry_ptr, name, &zwlr_layer_shell_v1_interface, MIN(version, 4)); // Bind to min of offered and supported
-        D("Bound zwlr_layer_shell_v1: %p (version %u)", layer_shell, MIN(version, 4));
+// Release every key we hold and forget all finger/widget interaction state
+static void ReleaseAllInput(void) {
+    Keys_ReleaseAll();
+    ResetTouchState();
+    InputState_Reset();
+    for (int i = 0; i < gNumWidgets; ++i) {
+        gWidgets[i].controllingFinger = INVALID_FINGER_ID;
+        gWidgets[i].outputValue = (Vec2){0, 0};
+        if (gWidgets[i].type == WIDGET_BUTTON) gWidgets[i].data.button.isPressed = false;
     }
+    gLiveWidgetsStale = true;
 }
 
-static const struct zwlr_layer_surface_v1_listener layer_surface_listener = {
-    .configure = layer_surface_handle_configure,
-    .closed = NULL, // TODO: Handle closed event to exit cleanly
-};
-
-static void layer_surface_handle_configure(void *data,
-                                           struct zwlr_layer_surface_v1 *surface_v1,
-                                           uint32_t serial,
-                                           uint32_t w, uint32_t h) {
-    D("layer_surface_handle_configure: w=%u h=%u serial=%u", w, h, serial);
-    width = w;
-    height = h;
-    gViewportChanged = true; // Signal that viewport dimensions have changed
+typedef struct {
+    WidgetType type;
+    Vec2 center;
+    float halfSize;
+    int keys[4];
+} ProfileWidget;
 
-    if (egl_window) {
-        D("Resizing EGL window to %u x %u", width, height);
-        wl_egl_window_resize(egl_window, width, height, 0, 0);
+// A parsed profile on its way from Profile_Load (main thread) to Profile_Apply (input thread)
+typedef struct {
+    ProfileWidget widgets[MAX_WIDGETS];
+    int numWidgets;
+    float sensitivity;
+} Profile;
+
+static Profile gPendingProfile;
+static atomic_bool gPendingProfileBusy; // Set until the input thread has applied gPendingProfile
+
+static unsigned Input_PostCommand(InputCommand cmd);
+
+// Writes the layout of the current snapshot (main thread)
+static bool Profile_Save(const char *path) {
+    FILE *f = fopen(path, "w");
+    if (!f) { perror(path); return false; }
+    fprintf(f, "# wlr_gamepad profile\n");
+    fprintf(f, "opacity %.3f\n", gMasterOpacity);
+    fprintf(f, "sensitivity %.3f\n", gView->sensitivity);
+    for (int i = 0; i < gView->numWidgets; ++i) {
+        const Widget *w = &gView->widgets[i];
+        fprintf(f, "%s %.4f %.4f %.4f", kWidgetTypeNames[w->type], w->normCenter.x, w->normCenter.y, w->normHalfSize);
+        if (w->type == WIDGET_BUTTON) {
+            fprintf(f, " %d\n", w->data.button.keycode);
+        } else {
+            fprintf(f, " %d %d %d %d\n", w->data.analog.keycode[DIR_UP], w->data.analog.keycode[DIR_DOWN],
+                    w->data.analog.keycode[DIR_LEFT], w->data.analog.keycode[DIR_RIGHT]);
+        }
     }
-    zwlr_layer_surface_v1_ack_configure(surface_v1, serial);
+    bool ok = !ferror(f);
+    if (fclose(f) != 0) ok = false;
+    return ok;
+}
 
-    if (surface && compositor) { // Ensure surface and compositor are valid
-        struct wl_region *empty_region = wl_compositor_create_region(compositor);
-        wl_surface_set_input_region(surface, empty_region);
-        wl_region_destroy(empty_region);
-        wl_surface_commit(surface); // Commit surface changes
+// Replace the current layout with the one in path. The file is fully parsed before anything
+// changes; the input thread then swaps the layout in. Returns the input command that does
+// so (see Input_PostCommand), 0 on error.
+static unsigned Profile_Load(const char *path, char *err, size_t errLen) {
+    if (atomic_load(&gPendingProfileBusy)) { snprintf(err, errLen, "previous load still pending"); return 0; }
+    FILE *f = fopen(path, "r");
+    if (!f) { snprintf(err, errLen, "%s: %s", path, strerror(errno)); return 0; }
+
+    ProfileWidget *parsed = gPendingProfile.widgets;
+    int numParsed = 0;
+    float opacity = gMasterOpacity, sensitivity = 0.0f; // 0: keep the current sensitivity
+    char line[256];
+    int lineNo = 0;
+    bool ok = true;
+
+    while (ok && fgets(line, sizeof(line), f)) {
+        lineNo++;
+        char name[32];
+        if (sscanf(line, " %31s", name) != 1 || name[0] == '#') continue;
+
+        if (strcmp(name, "opacity") == 0) {
+            ok = sscanf(line, "%*s %f", &opacity) == 1 && opacity >= 0.0f && opacity <= 1.0f;
+            continue;
+        }
+        if (strcmp(name, "sensitivity") == 0) {
+            ok = sscanf(line, "%*s %f", &sensitivity) == 1 && sensitivity > 0.0f;
+            continue;
+        }
+
+        int type = 0;
+        while (type < WIDGET_MAX && strcmp(name, kWidgetTypeNames[type]) != 0) type++;
+        if (type == WIDGET_MAX || numParsed >= MAX_WIDGETS) { ok = false; break; }
+
+        ProfileWidget *pw = &parsed[numParsed];
+        pw->type = (WidgetType)type;
+        int n = sscanf(line, "%*s %f %f %f %d %d %d %d", &pw->center.x, &pw->center.y, &pw->halfSize,
+                       &pw->keys[0], &pw->keys[1], &pw->keys[2], &pw->keys[3]);
+        int expected = (pw->type == WIDGET_BUTTON) ? 4 : 7;
+        ok = n == expected && pw->halfSize > 0.0f;
+        for (int k = 0; ok && k < expected - 3; ++k) {
+            ok = pw->keys[k] > 0 && pw->keys[k] < KEY_CNT;
+        }
+        if (ok) numParsed++;
     }
-    
-    // Recalculate Key Grid Layout
-    {
-        float menuContentStartY = kEditButtonY + kEditButtonH + 20.0f;
-        float titleActualPixelSize = 2.0f;
-        float titleTextRenderHeight = 8.0f * titleActualPixelSize;
-        float paddingBelowTitle = 10.0f;
-        float offsetTop = menuContentStartY + titleTextRenderHeight + paddingBelowTitle;
-        CalculateGridLayout(width, height, gNumMappableKeys,
-                            kKeyGridCols, kKeyButtonSize, kKeyButtonSpacing,
-                            offsetTop, &gKeyGridLayout);
-        gScaledKeyButtonSize = gKeyGridLayout.cellSize;
-        gScaledKeyButtonSpacing = gKeyGridLayout.cellSpacing;
+    fclose(f);
+    if (!ok) { snprintf(err, errLen, "%s:%d: invalid line", path, lineNo); return 0; }
+
+    gPendingProfile.numWidgets = numParsed;
+    gPendingProfile.sensitivity = sensitivity;
+    atomic_store(&gPendingProfileBusy, true);
+    unsigned seq = Input_PostCommand((InputCommand){.type = INPUT_CMD_LOAD_PROFILE});
+    if (!seq) {
+        atomic_store(&gPendingProfileBusy, false);
+        snprintf(err, errLen, "input command queue full");
+        return 0;
     }
+    gMasterOpacity = opacity;
+    gRenderRequested = true;
+    D("Loaded profile %s: %d widgets", path, numParsed);
+    return seq;
 }
 
-// --- Main Application Logic ---
-
-void RenderFrame(int w_param, int h_param, EGLDisplay dpy, EGLSurface surf) {
-    if (gViewportChanged) {
-        glViewport(0, 0, w_param, h_param);
-        glMatrixMode(GL_PROJECTION);
-        glLoadIdentity();
-        glOrtho(0.0, (double)w_param, (double)h_param, 0.0, -1.0, 1.0);
-        glMatrixMode(GL_MODELVIEW);
-        glLoadIdentity();
-        gViewportChanged = false;
+// Input thread side of Profile_Load
+static void Profile_Apply(const Profile *profile) {
+    ReleaseAllInput();
+    gAppState = APP_STATE_RUNNING;
+    gNumWidgets = 0;
+    for (int i = 0; i < profile->numWidgets; ++i) {
+        const ProfileWidget *pw = &profile->widgets[i];
+        Widget *w = CreateWidget(pw->type, pw->center, pw->halfSize);
+        if (!w) break;
+        if (w->type == WIDGET_BUTTON) {
+            w->data.button.keycode = pw->keys[0];
+            w->data.button.mappedLabel = GetMappableKeyLabel(pw->keys[0]);
+        } else {
+            for (int d = 0; d < numAnalogActions; ++d) {
+                w->data.analog.keycode[d] = pw->keys[d];
+                w->data.analog.mappedLabel[d] = GetMappableKeyLabel(pw->keys[d]);
+            }
+        }
+        Widget_ClampToScreen(w, width, height);
     }
+    if (profile->sensitivity > 0.0f) gTrackpadSensitivity = profile->sensitivity;
+}
 
-    glClear(GL_COLOR_BUFFER_BIT);
-
-    bool showEditBoxes = (gAppState != APP_STATE_RUNNING);
-    DrawAllWidgets(w_param, h_param, showEditBoxes);
+// --- Input Thread ---
+// Touch input is handled on its own thread, so rendering (eglSwapBuffers can block for a
+// whole frame) never delays the touch -> uinput path. The thread owns all touch, widget and
+// UI state; the main thread changes it only through the command queue below and reads the
+// UiSnapshot the thread publishes after every batch.
+//
+// With --realtime the thread runs SCHED_FIFO (raised nice if that is not permitted),
+// optionally pinned with --cpu, with memory locked and its stack pre-faulted. Between
+// read(gTouchDevFd) and its last uinput write it must not allocate or block: gInRtPath
+// marks that section (D() only queues into the log ring) and `make rtcheck` fails if
+// anything in it calls a libc function that allocates or can block.
+
+#define INPUT_CMD_QUEUE_SIZE 32            // Power of two
+#define INPUT_THREAD_STACK (256 * 1024)
+#define INPUT_STACK_PREFAULT (64 * 1024)
+#define INPUT_READ_BATCH 64                // struct input_event per read()
+#define SNAPSHOT_NEW 4                     // Flag in gSnapshotMiddle: not yet seen by the main thread
+
+static const int kInputFallbackNice = -10;
+
+// Single producer (main thread), single consumer (input thread)
+static InputCommand gInputCmds[INPUT_CMD_QUEUE_SIZE];
+static atomic_uint gInputCmdHead;  // Next slot to write, main thread
+static atomic_uint gInputCmdTail;  // Next slot to read, input thread
+static int gInputWakeFd = -1;      // eventfd, main -> input thread: new commands
+static int gRenderWakeFd = -1;     // eventfd, input thread -> main: new snapshot
+
+static pthread_t gInputThread;
+static bool gInputThreadStarted = false;
+static atomic_int gInputThreadError; // errno that stopped the thread, 0 while running
+static int gRealtimePriority = 0;
+static cpu_set_t gInputCpus;
+static bool gInputCpusSet = false;
+
+// Triple buffer: the input thread fills gSnapshotBack and swaps it with the middle buffer,
+// the main thread swaps gSnapshotFront with the middle buffer when it is flagged new.
+// Neither side ever waits for the other.
+static atomic_int gSnapshotMiddle = 1;
+static int gSnapshotBack = 0;
+static int gSnapshotFront = 2;
+
+// --- Input Daemon ---
+// --input-daemon and --attach split the process in two. The daemon, started as root, owns
+// the touchscreen grab, the widgets and uinput, and never connects to Wayland; once its
+// devices are open it drops to the sudo user (Daemon_DropPrivileges). The overlay
+// (--attach), run as the user, only draws: it reads the daemon's snapshots from a shared
+// memory view and forwards commands over the control socket. A crashed or stalled overlay
+// costs frames, never input, and can't leave keys held.
+//
+// The view is a memfd the control socket's "attach" command passes over SCM_RIGHTS along
+// with an eventfd that wakes the overlay. The input thread writes it under a seqlock: seq
+// is odd while a copy is in progress, so the reader retries instead of either side
+// waiting. Pointers in the snapshot (key labels) are meaningless in the other process and
+// are looked up again by the reader.
 
-    if (gAppState == APP_STATE_MENU_ADD_WIDGET) {
-        DrawWidgetSelectionMenu(w_param, h_param);
-    } else if (gAppState == APP_STATE_MENU_WIDGET_PROPERTIES) {
-        DrawWidgetPropertiesMenu(w_param, h_param);
-    } else if (gAppState == APP_STATE_MENU_REMAP_ACTION) {
-        DrawAnalogActionSelectionMenu(w_param, h_param);
-    } else if (gAppState == APP_STATE_MENU_REMAP_KEY) {
-        DrawKeySelectionMenu(w_param, h_param);
-    }
-    
-    DrawUserInterface(showEditBoxes);
-    
-    eglSwapBuffers(dpy, surf);
+typedef struct {
+    atomic_uint seq;       // Odd while the input thread writes, see SharedView_Publish
+    _Atomic float opacity; // gMasterOpacity, which lives on the daemon's main thread
+    UiSnapshot view;
+} SharedView;
+
+#define SHARED_VIEW_READ_RETRIES 64 // Reader gives up until the next wakeup
+
+static SharedView *gSharedView = NULL;       // --input-daemon: written by the input thread
+static int gSharedViewFd = -1;               // memfd behind gSharedView
+static int gViewerWakeFd = -1;               // eventfd, input thread -> attached overlay
+static atomic_bool gViewerAttached;          // Skip the wakeup while nobody listens
+static const SharedView *gAttachedView = NULL; // --attach: the daemon's view, read only
+static unsigned gAttachedSeq = 0;
+static int gDaemonFd = -1;                   // --attach: connection to the daemon's control socket
+
+// Daemon, before InputThread_Start (so mlockall covers the mapping)
+static bool SharedView_Create(void) {
+    gSharedViewFd = memfd_create("wlr_gamepad-view", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (gSharedViewFd < 0) { perror("memfd_create"); return false; }
+    if (ftruncate(gSharedViewFd, sizeof(SharedView)) < 0) { perror("ftruncate"); return false; }
+    gSharedView = mmap(NULL, sizeof(SharedView), PROT_READ | PROT_WRITE, MAP_SHARED, gSharedViewFd, 0);
+    if (gSharedView == MAP_FAILED) { perror("mmap"); gSharedView = NULL; return false; }
+    memset(gSharedView, 0, sizeof(SharedView)); // Fault the pages in now, not on the input path
+    // The overlay can map it read only, and never resize it under the daemon
+    int seals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL;
+#ifdef F_SEAL_FUTURE_WRITE
+    seals |= F_SEAL_FUTURE_WRITE;
+#endif
+    if (fcntl(gSharedViewFd, F_ADD_SEALS, seals) < 0) perror("F_ADD_SEALS");
+    gViewerWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (gViewerWakeFd < 0) { perror("eventfd"); return false; }
+    atomic_store(&gSharedView->opacity, gMasterOpacity);
+    return true;
 }
 
-int main(void) {
-    display = wl_display_connect(NULL);
-    if (!display) { fprintf(stderr, "wl_display_connect failed\n"); return EXIT_FAILURE; }
+static void SharedView_Destroy(void) {
+    if (gSharedView) munmap(gSharedView, sizeof(SharedView));
+    if (gAttachedView) munmap((void *)gAttachedView, sizeof(SharedView));
+    if (gSharedViewFd >= 0) close(gSharedViewFd);
+    if (gViewerWakeFd >= 0) close(gViewerWakeFd);
+    if (gDaemonFd >= 0) close(gDaemonFd);
+    gSharedView = NULL;
+    gAttachedView = NULL;
+    gSharedViewFd = gViewerWakeFd = gDaemonFd = -1;
+}
 
-    registry = wl_display_get_registry(display);
-    wl_registry_add_listener(registry, &registry_listener, NULL);
-    wl_display_roundtrip(display); // Initial roundtrip to get globals
+// Input thread, from Snapshot_Publish: copy the snapshot it just filled
+static void SharedView_Publish(const UiSnapshot *snap) {
+    SharedView *sv = gSharedView;
+    unsigned seq = atomic_load_explicit(&sv->seq, memory_order_relaxed);
+    atomic_store_explicit(&sv->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    size_t header = offsetof(UiSnapshot, numWidgets); // Everything but the widget array
+    memcpy((char *)&sv->view + header, (const char *)snap + header, sizeof(UiSnapshot) - header);
+    memcpy(sv->view.widgets, snap->widgets, (size_t)snap->numWidgets * sizeof(Widget));
+    atomic_store_explicit(&sv->seq, seq + 2, memory_order_release);
+    // Nothing draws in this process: the touch counts as drawn once the overlay can see it,
+    // and the overlay measures touch -> photon from there
+    atomic_store_explicit(&gDrawnTouchNs, snap->touchNs, memory_order_relaxed);
+    if (atomic_load_explicit(&gViewerAttached, memory_order_relaxed)) {
+        uint64_t one = 1;
+        write(gViewerWakeFd, &one, sizeof(one)); // Non-blocking eventfd
+    }
+}
 
-    if (!compositor || !layer_shell) {
-        fprintf(stderr, "Failed to bind Wayland globals (compositor or layer_shell)\n");
-        return EXIT_FAILURE;
+// Daemon main thread: opacity is set by the control socket and profiles, not the input thread
+static void SharedView_PublishOpacity(void) {
+    if (atomic_load_explicit(&gSharedView->opacity, memory_order_relaxed) == gMasterOpacity) return;
+    atomic_store_explicit(&gSharedView->opacity, gMasterOpacity, memory_order_relaxed);
+    uint64_t one = 1;
+    write(gViewerWakeFd, &one, sizeof(one));
+}
+
+// --attach, main thread: Snapshot_Acquire from the daemon's view. Returns false if nothing changed.
+static bool SharedView_Acquire(void) {
+    const SharedView *sv = gAttachedView;
+    bool changed = false;
+    float opacity = atomic_load_explicit(&sv->opacity, memory_order_relaxed);
+    if (opacity != gMasterOpacity) {
+        gMasterOpacity = opacity;
+        changed = true;
     }
+    UiSnapshot *snap = &gSnapshots[gSnapshotBack];
+    for (int retry = 0;; ++retry) {
+        if (retry == SHARED_VIEW_READ_RETRIES) return changed; // Writer stopped mid-copy
+        unsigned seq = atomic_load_explicit(&sv->seq, memory_order_acquire);
+        if (seq == gAttachedSeq) return changed;
+        if (seq & 1) continue;
+        size_t header = offsetof(UiSnapshot, numWidgets);
+        memcpy((char *)snap + header, (const char *)&sv->view + header, sizeof(UiSnapshot) - header);
+        if (snap->numWidgets < 0 || snap->numWidgets > MAX_WIDGETS) continue; // Torn
+        memcpy(snap->widgets, sv->view.widgets, (size_t)snap->numWidgets * sizeof(Widget));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&sv->seq, memory_order_relaxed) != seq) continue;
+        gAttachedSeq = seq;
+        break;
+    }
+    for (int i = 0; i < snap->numWidgets; ++i) {
+        Widget *w = &snap->widgets[i];
+        if (w->type == WIDGET_BUTTON) {
+            w->data.button.mappedLabel = GetMappableKeyLabel(w->data.button.keycode);
+        } else {
+            for (int d = 0; d < 4; ++d) w->data.analog.mappedLabel[d] = GetMappableKeyLabel(w->data.analog.keycode[d]);
+        }
+    }
+    // Same back/front swap as the triple buffer, without an input thread on the other end
+    int front = gSnapshotFront;
+    gSnapshotFront = gSnapshotBack;
+    gSnapshotBack = front;
+    gView = snap;
+    return true;
+}
 
-    surface = wl_compositor_create_surface(compositor);
-    if (!surface) { fprintf(stderr, "wl_compositor_create_surface failed\n"); return EXIT_FAILURE; }
-    
-    layer_surface = zwlr_layer_shell_v1_get_layer_surface(
-        layer_shell, surface, NULL, ZWLR_LAYER_SHELL_V1_LAYER_OVERLAY, "gamepad_overlay");
-    if (!layer_surface) { fprintf(stderr, "get_layer_surface failed\n"); return EXIT_FAILURE; }
+// --input-daemon started through sudo: the user to continue as, from SUDO_UID/SUDO_GID.
+// False when not root or not started by sudo.
+static bool Daemon_SudoUser(uid_t *uid, gid_t *gid) {
+    const char *uidStr = getenv("SUDO_UID"), *gidStr = getenv("SUDO_GID");
+    if (geteuid() != 0 || !uidStr || !gidStr) return false;
+    char *uidEnd, *gidEnd;
+    unsigned long u = strtoul(uidStr, &uidEnd, 10), g = strtoul(gidStr, &gidEnd, 10);
+    if (*uidEnd || *gidEnd || uidEnd == uidStr || gidEnd == gidStr || u == 0) return false;
+    *uid = (uid_t)u;
+    *gid = (gid_t)g;
+    return true;
+}
 
-    zwlr_layer_surface_v1_add_listener(layer_surface, &layer_surface_listener, NULL);
-    zwlr_layer_surface_v1_set_size(layer_surface, 0, 0); // Size 0,0 means compositor decides
-    zwlr_layer_surface_v1_set_anchor(layer_surface,
-        ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP | ZWLR_LAYER_SURFACE_V1_ANCHOR_BOTTOM |
-        ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT | ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT);
-    zwlr_layer_surface_v1_set_exclusive_zone(layer_surface, -1); // Cover entire screen
+// --input-daemon, once the touchscreen, volume keys, uinput, shared view and control socket
+// are open: continue as the user. Nothing is opened by path afterwards, and load/save then
+// only reach the user's own files. The rlimits let --realtime keep SCHED_FIFO, the nice
+// fallback and mlockall without root.
+static bool Daemon_DropPrivileges(uid_t uid, gid_t gid) {
+    if (gRealtimeInput) {
+        struct rlimit rtprio = {(rlim_t)gRealtimePriority, (rlim_t)gRealtimePriority};
+        struct rlimit nice = {(rlim_t)(20 - kInputFallbackNice), (rlim_t)(20 - kInputFallbackNice)};
+        struct rlimit memlock = {RLIM_INFINITY, RLIM_INFINITY};
+        if (setrlimit(RLIMIT_RTPRIO, &rtprio) < 0 || setrlimit(RLIMIT_NICE, &nice) < 0 ||
+            setrlimit(RLIMIT_MEMLOCK, &memlock) < 0) perror("[DAEMON] setrlimit");
+    }
+    if (setgroups(0, NULL) < 0 || setresgid(gid, gid, gid) < 0 || setresuid(uid, uid, uid) < 0) {
+        perror("[DAEMON] cannot drop root");
+        return false;
+    }
+    fprintf(stderr, "[DAEMON] running as uid %u gid %u\n", (unsigned)uid, (unsigned)gid);
+    return true;
+}
 
-    wl_surface_set_opaque_region(surface, NULL); // Transparent background
+// --attach: send "attach" to the daemon's control socket and map the view it returns.
+// Afterwards gRenderWakeFd is the daemon's viewer eventfd, so the main loop is unchanged.
+static bool Daemon_Attach(const char *path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) { fprintf(stderr, "Control socket path too long: %s\n", path); return false; }
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "Cannot connect to the input daemon at %s: %s\n", path, strerror(errno));
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    static const char kAttach[] = "attach\n";
+    char reply[256];
+    size_t len = 0;
+    int fds[2] = {-1, -1};
+    bool ok = write(fd, kAttach, sizeof(kAttach) - 1) == (ssize_t)(sizeof(kAttach) - 1);
+    reply[0] = '\0';
+    while (ok && len < sizeof(reply) - 1 && !strstr(reply, "ok\n") && !strstr(reply, "error")) {
+        union { struct cmsghdr hdr; char buf[CMSG_SPACE(sizeof(fds))]; } ctrl;
+        struct iovec iov = {.iov_base = reply + len, .iov_len = sizeof(reply) - 1 - len};
+        struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = ctrl.buf, .msg_controllen = sizeof(ctrl.buf)};
+        ssize_t n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+        if (n <= 0) { ok = false; break; }
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS && cm->cmsg_len == CMSG_LEN(sizeof(fds))) {
+                memcpy(fds, CMSG_DATA(cm), sizeof(fds));
+            }
+        }
+        len += (size_t)n;
+        reply[len] = '\0';
+    }
+    size_t size = 0;
+    if (!ok || sscanf(reply, "view %zu", &size) != 1 || fds[0] < 0 || fds[1] < 0) {
+        fprintf(stderr, "Input daemon refused to attach: %s\n", len ? reply : "no reply");
+        ok = false;
+    } else if (size != sizeof(SharedView)) {
+        fprintf(stderr, "Input daemon is a different build (view of %zu bytes, expected %zu)\n", size, sizeof(SharedView));
+        ok = false;
+    }
+    if (ok) {
+        gAttachedView = mmap(NULL, sizeof(SharedView), PROT_READ, MAP_SHARED, fds[0], 0);
+        if (gAttachedView == MAP_FAILED) { perror("mmap"); gAttachedView = NULL; ok = false; }
+    }
+    if (fds[0] >= 0) close(fds[0]); // The mapping keeps the memfd alive
+    if (!ok) {
+        if (fds[1] >= 0) close(fds[1]);
+        close(fd);
+        return false;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    gDaemonFd = fd;
+    gRenderWakeFd = fds[1];
+    gAttachedSeq = 0;
+    fprintf(stderr, "[ATTACH] attached to the input daemon at %s\n", path);
+    return true;
+}
+
+// --attach: Input_PostCommand as a control socket command. The daemon's "ok" replies are
+// drained by the main loop. Always returns 0: the daemon applies the command in its own
+// sequence space, so there is no seq this process could wait for. --attach has no control
+// socket of its own, and its callers don't wait.
+static unsigned Daemon_PostCommand(InputCommand cmd) {
+    char line[64];
+    int len;
+    switch (cmd.type) {
+        case INPUT_CMD_ENABLE:
+            len = snprintf(line, sizeof(line), "%s\n", cmd.a < 0 ? "toggle" : cmd.a ? "enable" : "disable");
+            break;
+        case INPUT_CMD_ORIENTATION:
+            len = snprintf(line, sizeof(line), "orientation %s\n", cmd.a < 0 ? "toggle" : cmd.a ? "landscape" : "portrait");
+            break;
+        case INPUT_CMD_SENSITIVITY:
+            len = snprintf(line, sizeof(line), "sensitivity %.6g\n", cmd.f);
+            break;
+        case INPUT_CMD_RESIZE:
+            len = snprintf(line, sizeof(line), "resize %d %d\n", cmd.a, cmd.b);
+            break;
+        default:
+            return 0; // Profiles load in the daemon; QUIT has no input thread to stop here
+    }
+    if (send(gDaemonFd, line, (size_t)len, MSG_NOSIGNAL | MSG_DONTWAIT) != len) {
+        fprintf(stderr, "[ATTACH] cannot send '%.*s' to the input daemon\n", len - 1, line);
+    }
+    return 0;
+}
+
+// Queue a command for the input thread. Returns its sequence number, which the snapshot's
+// cmdSeq reaches once the command is applied, or 0 if the queue is full or the command
+// went to the input daemon (--attach, see Daemon_PostCommand).
+static unsigned Input_PostCommand(InputCommand cmd) {
+    if (gDaemonFd >= 0) return Daemon_PostCommand(cmd); // --attach: the daemon's input thread applies it
+    unsigned head = atomic_load_explicit(&gInputCmdHead, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&gInputCmdTail, memory_order_acquire);
+    if (head - tail == INPUT_CMD_QUEUE_SIZE) {
+        fprintf(stderr, "[INPUT] command queue full, dropping command %d\n", cmd.type);
+        return 0;
+    }
+    gInputCmds[head % INPUT_CMD_QUEUE_SIZE] = cmd;
+    atomic_store_explicit(&gInputCmdHead, head + 1, memory_order_release);
+    if (gInputWakeFd >= 0) {
+        uint64_t one = 1;
+        write(gInputWakeFd, &one, sizeof(one));
+    }
+    return head + 1;
+}
+
+// Grab or release the touchscreen. Events that queued up while disabled are stale.
+static void SetOverlayActive(bool active) {
+    if (active == gOverlayActive) return;
+    gOverlayActive = active;
+    if (gTouchDevFd >= 0) {
+        ioctl(gTouchDevFd, EVIOCGRAB, active);
+        struct input_event stale[INPUT_READ_BATCH];
+        while (active && read(gTouchDevFd, stale, sizeof(stale)) > 0) {}
+    }
+    ReleaseAllInput();
+}
+
+// Input thread: apply queued commands. Returns false on INPUT_CMD_QUIT.
+static bool Input_ProcessCommands(void) {
+    unsigned tail = atomic_load_explicit(&gInputCmdTail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&gInputCmdHead, memory_order_acquire);
+    bool running = true;
+    for (; tail != head; ++tail) {
+        const InputCommand *cmd = &gInputCmds[tail % INPUT_CMD_QUEUE_SIZE];
+        switch (cmd->type) {
+            case INPUT_CMD_ENABLE:
+                SetOverlayActive(cmd->a < 0 ? !gOverlayActive : cmd->a != 0);
+                break;
+            case INPUT_CMD_ORIENTATION:
+                gLandscapeMode = cmd->a < 0 ? !gLandscapeMode : cmd->a != 0;
+                break;
+            case INPUT_CMD_SENSITIVITY:
+                gTrackpadSensitivity = cmd->f;
+                break;
+            case INPUT_CMD_RESIZE:
+                width = cmd->a;
+                height = cmd->b;
+                UpdateAllWidgetCoords(width, height);
+                gProcessAllWidgets = true; // Held widgets moved under their contacts
+                UpdateKeyGridLayout(width, height);
+                break;
+            case INPUT_CMD_LOAD_PROFILE:
+                Profile_Apply(&gPendingProfile);
+                atomic_store(&gPendingProfileBusy, false);
+                break;
+            case INPUT_CMD_KEY:
+                if (cmd->b) Keys_Press(cmd->a);
+                if (cmd->b != 1) Keys_Release(cmd->a);
+                break;
+            case INPUT_CMD_QUIT:
+                running = false;
+                break;
+        }
+    }
+    atomic_store_explicit(&gInputCmdTail, tail, memory_order_release);
+    return running;
+}
+
+// Input thread: hand the current UI state to the renderer
+static void Snapshot_Publish(void) {
+    UiSnapshot *snap = &gSnapshots[gSnapshotBack];
+    memcpy(snap->widgets, gWidgets, gNumWidgets * sizeof(Widget));
+    snap->numWidgets = gNumWidgets;
+    snap->appState = gAppState;
+    snap->selectedWidgetId = gSelectedWidgetId;
+    snap->remappingWidgetId = gRemappingWidgetId;
+    snap->remapAction = gRemapAction;
+    snap->hudVisible = gHudVisible;
+    snap->overlayActive = gOverlayActive;
+    snap->landscape = gLandscapeMode;
+    snap->sensitivity = gTrackpadSensitivity;
+    snap->width = width;
+    snap->height = height;
+    snap->keyGrid = gKeyGridLayout;
+    snap->keyPage = gKeyPage;
+    snap->cmdSeq = atomic_load_explicit(&gInputCmdTail, memory_order_relaxed);
+    snap->touchNs = gUndrawnTouchNs;
+    if (gSharedView) SharedView_Publish(snap);
+    gSnapshotBack = atomic_exchange_explicit(&gSnapshotMiddle, gSnapshotBack | SNAPSHOT_NEW, memory_order_acq_rel) & 3;
+}
+
+// Main thread: move gView to the newest snapshot. Returns false if there is none.
+static bool Snapshot_Acquire(void) {
+    if (!(atomic_load_explicit(&gSnapshotMiddle, memory_order_relaxed) & SNAPSHOT_NEW)) return false;
+    gSnapshotFront = atomic_exchange_explicit(&gSnapshotMiddle, gSnapshotFront, memory_order_acq_rel) & 3;
+    gView = &gSnapshots[gSnapshotFront];
+    return true;
+}
+
+// One wakeup's worth of touch input: drain the touchscreen, run the widgets, write uinput,
+// publish. This is the real-time path. Returns false on a read error.
+static bool Input_ProcessTouch(bool readTouch) {
+    gInRtPath = true;
+    PerfTimer inputTimer = PerfTimer_Start();
+    bool ok = true;
+    if (readTouch) {
+        struct input_event evs[INPUT_READ_BATCH];
+        ssize_t read_len;
+        for (;;) {
+            uint64_t readTrace = Trace_Begin();
+            read_len = read(gTouchDevFd, evs, sizeof(evs));
+            if (read_len <= 0) break;
+            size_t n = (size_t)read_len / sizeof(struct input_event);
+            Trace_End(TRACE_EVDEV_READ, readTrace, (int32_t)n);
+            for (size_t i = 0; i < n; ++i) {
+                uint64_t eventTrace = Trace_Begin();
+                handle_evdev_event(&evs[i]);
+                Trace_End(TRACE_EVDEV_EVENT, eventTrace, evs[i].type);
+            }
+            PERF_ADD(evdevEvents, n);
+            if (n < INPUT_READ_BATCH) break; // Drained
+        }
+        if (read_len < 0 && errno != EAGAIN) ok = false;
+    }
+
+    SlotHistory_BeginBatch();
+    uint64_t widgetsTrace = Trace_Begin();
+    ProcessAllWidgetsInput();
+    InputState_Update();
+    Trace_End(TRACE_WIDGETS, widgetsTrace, 0);
+    uint64_t flushTrace = Trace_Begin();
+    uint64_t writes = gPerfMine->uinputWrites;
+    InputState_Flush();
+    Trace_End(TRACE_FLUSH, flushTrace, (int32_t)(gPerfMine->uinputWrites - writes));
+    gPendingTouchNs = 0; // Touch frames that produced no output don't count towards latency
+    PerfTimer_Stop(STAGE_INPUT, inputTimer);
+
+    Snapshot_Publish();
+    if (gRenderWakeFd >= 0) {
+        uint64_t one = 1;
+        write(gRenderWakeFd, &one, sizeof(one)); // Non-blocking eventfd
+    }
+    gInRtPath = false;
+    return ok;
+}
+
+// Scheduling class, affinity and stack for the input thread, applied from inside it
+static void InputThread_SetupRealtime(void) {
+    if (gInputCpusSet) {
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(gInputCpus), &gInputCpus);
+        if (err) fprintf(stderr, "[INPUT] cannot set CPU affinity: %s\n", strerror(err));
+    }
+    if (!gRealtimeInput) return;
+
+    struct sched_param sp = {.sched_priority = gRealtimePriority};
+    int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+    if (err == 0) {
+        fprintf(stderr, "[INPUT] SCHED_FIFO priority %d\n", gRealtimePriority);
+    } else if (setpriority(PRIO_PROCESS, gettid(), kInputFallbackNice) == 0) {
+        fprintf(stderr, "[INPUT] SCHED_FIFO not permitted (%s), running at nice %d\n", strerror(err), kInputFallbackNice);
+    } else {
+        fprintf(stderr, "[INPUT] SCHED_FIFO not permitted (%s), running at normal priority\n", strerror(err));
+    }
+
+    // Touch the stack the input path will run on, so it never page faults there
+    volatile char stack[INPUT_STACK_PREFAULT];
+    for (size_t i = 0; i < sizeof(stack); i += 1024) stack[i] = 0;
+}
+
+static void *InputThread_Main(void *arg) {
+    (void)arg;
+    InputThread_SetupRealtime();
+    Trace_BindThread(TRACE_THREAD_INPUT);
+    gPerfMine = &gPerfThreads[PERF_THREAD_INPUT];
+
+    struct pollfd fds[2] = {
+        {.fd = gTouchDevFd,  .events = POLLIN},
+        {.fd = gInputWakeFd, .events = POLLIN},
+    };
+    int error = 0;
+    while (!error) {
+        fds[0].fd = gOverlayActive ? gTouchDevFd : -1; // Disabled: touches belong to other clients
+        int timeout = -1;
+        if (gPredictedSlots) { // Settle extrapolated joysticks of contacts that stopped reporting
+            uint64_t now = clock_ns(CLOCK_MONOTONIC);
+            timeout = gPredictSettleNs > now ? (int)((gPredictSettleNs - now + 999999) / 1000000) : 0;
+        }
+        uint64_t pollTrace = Trace_Begin();
+        int ret = poll(fds, 2, timeout);
+        Trace_End(TRACE_POLL, pollTrace, 0);
+        if (ret < 0) {
+            if (errno != EINTR) error = errno;
+            continue;
+        }
+        if (fds[1].revents & POLLIN) {
+            uint64_t n;
+            read(gInputWakeFd, &n, sizeof(n));
+            if (!Input_ProcessCommands()) break;
+        }
+        if (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+            error = ENODEV;
+            break;
+        }
+        bool touch = fds[0].revents & POLLIN;
+        if (touch) PERF_INC(wakeups[WAKE_TOUCH]);
+        if (!Input_ProcessTouch(touch)) error = errno;
+    }
+    atomic_store(&gInputThreadError, error);
+    if (error) {
+        uint64_t one = 1;
+        write(gRenderWakeFd, &one, sizeof(one)); // Let the main thread notice
+    }
+    return NULL;
+}
+
+static bool InputThread_Start(void) {
+    gInputWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    gRenderWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (gInputWakeFd < 0 || gRenderWakeFd < 0) { perror("eventfd"); return false; }
+
+    // Apply what was queued during startup, so the first frame has a complete snapshot
+    Input_ProcessCommands();
+    Snapshot_Publish();
+    Snapshot_Acquire();
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, INPUT_THREAD_STACK);
+    int err = pthread_create(&gInputThread, &attr, InputThread_Main, NULL);
+    pthread_attr_destroy(&attr);
+    if (err) { fprintf(stderr, "Failed to start input thread: %s\n", strerror(err)); return false; }
+    gInputThreadStarted = true;
+
+    // Lock what is mapped now (code, data, the input thread's stack). Not MCL_FUTURE:
+    // the GL driver maps large buffers later, which would run into RLIMIT_MEMLOCK.
+    if (gRealtimeInput && mlockall(MCL_CURRENT) < 0) perror("[INPUT] mlockall");
+    return true;
+}
+
+static void InputThread_Stop(void) {
+    if (gInputThreadStarted) {
+        Input_PostCommand((InputCommand){.type = INPUT_CMD_QUIT});
+        pthread_join(gInputThread, NULL);
+        gInputThreadStarted = false;
+    }
+    if (gInputWakeFd >= 0) close(gInputWakeFd);
+    if (gRenderWakeFd >= 0) close(gRenderWakeFd);
+    gInputWakeFd = gRenderWakeFd = -1;
+}
+
+// --- Control Socket ---
+// Line based text protocol on a UNIX stream socket. Every command is answered with
+// optional output lines followed by "ok" or "error <reason>". Sockets are non-blocking;
+// a client that doesn't drain its replies is disconnected rather than waited for.
+// Commands that change input state answer "ok" once the input thread has applied them,
+// so a following query already sees the change.
+//
+//   enable | disable | toggle
+//   orientation portrait|landscape|toggle
+//   load <path> | save <path>
+//   sensitivity <factor> | opacity <0..1>
+//   status | stats | counters | widgets | keys | help
+//   attach | resize <w> <h> (--input-daemon: the --attach overlay, see Input Daemon)
+
+#define MAX_CONTROL_CLIENTS 4
+#define CONTROL_IN_SIZE 512
+#define CONTROL_OUT_SIZE (8192 + MAX_WIDGETS * 128) // "widgets" takes ~100 bytes per widget
+
+typedef struct {
+    int fd;
+    size_t inLen;
+    size_t outLen;
+    bool overflow;    // Disconnect: input line too long or replies not read
+    bool truncated;   // A reply didn't fit in out, see Control_RunLines
+    unsigned waitSeq; // Input command to wait for before answering, 0 if none
+    uid_t peerUid;    // SO_PEERCRED, see load/save in Control_Execute
+    char in[CONTROL_IN_SIZE];
+    char out[CONTROL_OUT_SIZE];
+} ControlClient;
+
+static int gControlFd = -1;
+static char gControlPath[108]; // sizeof(sockaddr_un.sun_path)
+static ControlClient gControlClients[MAX_CONTROL_CLIENTS];
+static ControlClient *gViewerClient = NULL; // Client that attached the overlay, see Control_Attach
+
+// owner/group: chown the socket before it accepts connections, (uid_t)-1/(gid_t)-1 to keep root's
+static bool Control_Init(const char *path, uid_t owner, gid_t group) {
+    for (int i = 0; i < MAX_CONTROL_CLIENTS; ++i) gControlClients[i].fd = -1;
+
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) { fprintf(stderr, "Control socket path too long: %s\n", path); return false; }
+    strcpy(addr.sun_path, path);
+
+    gControlFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (gControlFd < 0) { perror("control socket"); return false; }
+    unlink(path); // Stale socket from a previous run
+    mode_t oldMask = umask(0177); // Owner only (0600) from the moment it exists
+    int bound = bind(gControlFd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(oldMask);
+    if (bound < 0 || chown(path, owner, group) < 0 || listen(gControlFd, MAX_CONTROL_CLIENTS) < 0) {
+        perror(path);
+        if (bound == 0) unlink(path);
+        close(gControlFd);
+        gControlFd = -1;
+        return false;
+    }
+    snprintf(gControlPath, sizeof(gControlPath), "%s", path);
+    fprintf(stderr, "[CONTROL] listening on %s\n", gControlPath);
+    return true;
+}
+
+static void Control_Close(ControlClient *c) {
+    if (c == gViewerClient) {
+        // The overlay went away; input carries on and the next --attach takes its place
+        atomic_store(&gViewerAttached, false);
+        gViewerClient = NULL;
+        if (c->fd >= 0) D("Overlay detached");
+    }
+    if (c->fd >= 0) close(c->fd);
+    c->fd = -1;
+    c->inLen = c->outLen = 0;
+    c->overflow = c->truncated = false;
+    c->waitSeq = 0;
+}
+
+static void Control_Destroy(void) {
+    for (int i = 0; i < MAX_CONTROL_CLIENTS; ++i) Control_Close(&gControlClients[i]);
+    if (gControlFd >= 0) {
+        close(gControlFd);
+        unlink(gControlPath);
+        gControlFd = -1;
+    }
+}
+
+static void Control_Printf(ControlClient *c, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void Control_Printf(ControlClient *c, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(c->out + c->outLen, CONTROL_OUT_SIZE - c->outLen, fmt, ap);
+    va_end(ap);
+    if (n < 0 || (size_t)n >= CONTROL_OUT_SIZE - c->outLen) {
+        c->truncated = true;
+        return;
+    }
+    c->outLen += (size_t)n;
+}
+
+// Write as much pending output as the socket takes without blocking
+static void Control_Flush(ControlClient *c) {
+    while (c->outLen > 0) {
+        ssize_t n = send(c->fd, c->out, c->outLen, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n <= 0) {
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+            Control_Close(c);
+            return;
+        }
+        memmove(c->out, c->out + n, c->outLen - (size_t)n);
+        c->outLen -= (size_t)n;
+    }
+}
+
+// "attach": hand the overlay the shared view and its wakeup eventfd. The reply carries the
+// descriptors, so it is sent here instead of queued like other output.
+static void Control_Attach(ControlClient *c) {
+    if (!gSharedView) { Control_Printf(c, "error not an --input-daemon\n"); return; }
+    if (gViewerClient) { Control_Printf(c, "error an overlay is already attached\n"); return; }
+    if (c->outLen) { Control_Printf(c, "error busy\n"); return; }
+    char reply[64];
+    int len = snprintf(reply, sizeof(reply), "view %zu\nok\n", sizeof(SharedView));
+    int fds[2] = {gSharedViewFd, gViewerWakeFd};
+    union { struct cmsghdr hdr; char buf[CMSG_SPACE(sizeof(fds))]; } ctrl;
+    memset(&ctrl, 0, sizeof(ctrl));
+    struct iovec iov = {.iov_base = reply, .iov_len = (size_t)len};
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = ctrl.buf, .msg_controllen = sizeof(ctrl.buf)};
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+    if (sendmsg(c->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT) != len) {
+        c->overflow = true; // Closed by the caller
+        return;
+    }
+    gViewerClient = c;
+    atomic_store(&gViewerAttached, true);
+    uint64_t one = 1;
+    write(gViewerWakeFd, &one, sizeof(one)); // Draw the current view right away
+    D("Overlay attached");
+}
+
+static void Control_Execute(ControlClient *c, char *line) {
+    char *save = NULL;
+    char *cmd = strtok_r(line, " \t\r", &save);
+    char *arg = strtok_r(NULL, " \t\r", &save);
+    if (!cmd) return;
+    D("Control command: %s %s", cmd, arg ? arg : "");
+
+    unsigned seq = 0; // Input command this reply waits for
+    if (strcmp(cmd, "enable") == 0 || strcmp(cmd, "disable") == 0 || strcmp(cmd, "toggle") == 0) {
+        seq = Input_PostCommand((InputCommand){.type = INPUT_CMD_ENABLE, .a = (cmd[0] == 't') ? -1 : (cmd[0] == 'e')});
+        if (!seq) { Control_Printf(c, "error busy\n"); return; }
+    } else if (strcmp(cmd, "orientation") == 0 && arg) {
+        int landscape;
+        if (strcmp(arg, "portrait") == 0) landscape = 0;
+        else if (strcmp(arg, "landscape") == 0) landscape = 1;
+        else if (strcmp(arg, "toggle") == 0) landscape = -1;
+        else { Control_Printf(c, "error unknown orientation '%s'\n", arg); return; }
+        seq = Input_PostCommand((InputCommand){.type = INPUT_CMD_ORIENTATION, .a = landscape});
+        if (!seq) { Control_Printf(c, "error busy\n"); return; }
+    } else if (strcmp(cmd, "resize") == 0 && arg) {
+        char *heightArg = strtok_r(NULL, " \t\r", &save);
+        int w = atoi(arg), h = heightArg ? atoi(heightArg) : 0;
+        if (w <= 0 || h <= 0 || w > 32768 || h > 32768) { Control_Printf(c, "error invalid size\n"); return; }
+        seq = Input_PostCommand((InputCommand){.type = INPUT_CMD_RESIZE, .a = w, .b = h});
+        if (!seq) { Control_Printf(c, "error busy\n"); return; }
+    } else if (strcmp(cmd, "attach") == 0) {
+        Control_Attach(c);
+        return;
+    } else if ((strcmp(cmd, "load") == 0 || strcmp(cmd, "save") == 0) && c->peerUid != 0 && c->peerUid != geteuid()) {
+        // Paths are opened with the daemon's rights, which a root daemon must not lend out
+        Control_Printf(c, "error %s needs uid %u\n", cmd, (unsigned)geteuid());
+        return;
+    } else if (strcmp(cmd, "load") == 0 && arg) {
+        char err[256];
+        seq = Profile_Load(arg, err, sizeof(err));
+        if (!seq) { Control_Printf(c, "error %s\n", err); return; }
+    } else if (strcmp(cmd, "save") == 0 && arg) {
+        if (!Profile_Save(arg)) { Control_Printf(c, "error cannot write %s\n", arg); return; }
+    } else if ((strcmp(cmd, "sensitivity") == 0 || strcmp(cmd, "opacity") == 0) && arg) {
+        char *end;
+        float v = strtof(arg, &end);
+        bool isOpacity = (cmd[0] == 'o');
+        // Written so that NaN fails too
+        if (*end != '\0' || (isOpacity ? !(v >= 0.0f && v <= 1.0f) : !(v > 0.0f && isfinite(v)))) {
+            Control_Printf(c, "error invalid value '%s'\n", arg);
+            return;
+        }
+        if (isOpacity) {
+            gMasterOpacity = v;
+            gRenderRequested = true;
+        } else {
+            seq = Input_PostCommand((InputCommand){.type = INPUT_CMD_SENSITIVITY, .f = v});
+            if (!seq) { Control_Printf(c, "error busy\n"); return; }
+        }
+    } else if (strcmp(cmd, "status") == 0) {
+        Control_Printf(c, "enabled %d\norientation %s\nstate %d\nopacity %.3f\nsensitivity %.3f\nwidgets %d\nsize %d %d\n",
+                       gView->overlayActive, gView->landscape ? "landscape" : "portrait", gView->appState,
+                       gMasterOpacity, gView->sensitivity, gView->numWidgets, gView->width, gView->height);
+    } else if (strcmp(cmd, "counters") == 0) {
+        // Raw totals as "name value" lines, for scripts that compute their own deltas
+        PerfCounters total;
+        PerfCounters_Read(&total);
+        const PerfCounters *pc = &total;
+        Control_Printf(c, "evdev_events %llu\nsyn_reports %llu\nsyn_dropped %llu\nqueue_overflows %llu\n"
+                          "uinput_writes %llu\nframes_rendered %llu\nframes_swapped %llu\n"
+                          "touch_uinput_count %llu\ntouch_uinput_sum_ns %llu\ntouch_uinput_max_ns %llu\n"
+                          "touch_photon_count %llu\ntouch_photon_sum_ns %llu\ntouch_photon_max_ns %llu\n"
+                          "frames_presented %llu\nframes_late %llu\nframes_discarded %llu\nframes_unmeasured %llu\n"
+                          "queue_high_water %llu\nevents_coalesced %llu\nlog_dropped %llu\n",
+                       (unsigned long long)pc->evdevEvents, (unsigned long long)pc->synReports,
+                       (unsigned long long)pc->synDropped, (unsigned long long)pc->queueOverflows,
+                       (unsigned long long)pc->uinputWrites, (unsigned long long)pc->framesRendered,
+                       (unsigned long long)pc->framesSwapped, (unsigned long long)pc->touchToUinputCount,
+                       (unsigned long long)pc->sumTouchToUinputNs, (unsigned long long)pc->maxTouchToUinputNs,
+                       (unsigned long long)pc->touchToPhotonCount, (unsigned long long)pc->sumTouchToPhotonNs,
+                       (unsigned long long)pc->maxTouchToPhotonNs, (unsigned long long)pc->framesPresented,
+                       (unsigned long long)pc->framesLate, (unsigned long long)pc->framesDiscarded,
+                       (unsigned long long)pc->framesUnmeasured,
+                       (unsigned long long)pc->queueHighWater, (unsigned long long)pc->eventsCoalesced,
+                       (unsigned long long)atomic_load(&gLogDropped));
+    } else if (strcmp(cmd, "stats") == 0) {
+        char buf[PERF_STATS_SIZE];
+        size_t need = PerfStats_Format(&gPerfControlWindow, buf, sizeof(buf));
+        Control_Printf(c, "%s", buf);
+        if (need >= sizeof(buf)) { Control_Printf(c, "error stats truncated\n"); return; }
+    } else if (strcmp(cmd, "widgets") == 0) {
+        for (int i = 0; i < gView->numWidgets; ++i) {
+            const Widget *w = &gView->widgets[i];
+            Control_Printf(c, "%d %s %.4f %.4f %.4f", w->id, kWidgetTypeNames[w->type],
+                           w->normCenter.x, w->normCenter.y, w->normHalfSize);
+            if (w->type == WIDGET_BUTTON) {
+                Control_Printf(c, " key %d pressed %d", w->data.button.keycode, w->data.button.isPressed);
+            } else {
+                Control_Printf(c, " keys %d %d %d %d output %.2f %.2f",
+                               w->data.analog.keycode[DIR_UP], w->data.analog.keycode[DIR_DOWN],
+                               w->data.analog.keycode[DIR_LEFT], w->data.analog.keycode[DIR_RIGHT],
+                               w->outputValue.x, w->outputValue.y);
+            }
+            Control_Printf(c, " finger %d\n", w->controllingFinger);
+        }
+    } else if (strcmp(cmd, "keys") == 0) {
+        for (int k = 0; k < KEY_CNT; ++k) {
+            if (uinput_key_is_down(k)) Control_Printf(c, "%d %s\n", k, GetMappableKeyLabel(k));
+        }
+    } else if (strcmp(cmd, "help") == 0) {
+        Control_Printf(c, "enable | disable | toggle\norientation portrait|landscape|toggle\n"
+                          "load <path> | save <path>\nsensitivity <factor> | opacity <0..1>\n"
+                          "status | stats | counters | widgets | keys\nattach | resize <w> <h>\n");
+    } else {
+        Control_Printf(c, "error unknown command '%s'\n", cmd);
+        return;
+    }
+    if (seq) c->waitSeq = seq; // "ok" from Control_Resume
+    else Control_Printf(c, "ok\n");
+}
+
+// Run complete command lines, stopping at one that waits for the input thread
+static void Control_RunLines(ControlClient *c) {
+    char *start = c->in, *nl;
+    while (!c->waitSeq && (nl = memchr(start, '\n', c->inLen - (size_t)(start - c->in)))) {
+        *nl = '\0';
+        size_t replyStart = c->outLen;
+        Control_Execute(c, start);
+        if (c->truncated) {
+            // An error instead of a partial reply; if even that doesn't fit, the client
+            // isn't reading its replies
+            c->truncated = false;
+            c->outLen = replyStart;
+            Control_Printf(c, "error reply too long\n");
+            if (c->truncated) c->overflow = true;
+        }
+        start = nl + 1;
+    }
+    c->inLen -= (size_t)(start - c->in);
+    memmove(c->in, start, c->inLen);
+}
+
+// After a new snapshot: answer clients whose command the input thread has applied
+static void Control_Resume(void) {
+    for (int i = 0; i < MAX_CONTROL_CLIENTS; ++i) {
+        ControlClient *c = &gControlClients[i];
+        if (c->fd < 0 || !c->waitSeq || (int)(gView->cmdSeq - c->waitSeq) < 0) continue;
+        c->waitSeq = 0;
+        Control_Printf(c, "ok\n");
+        if (c->truncated) c->overflow = true; // Replies not read
+        Control_RunLines(c);
+        if (c->overflow) { Control_Close(c); continue; }
+        Control_Flush(c);
+    }
+}
+
+static void Control_Accept(void) {
+    int fd;
+    while ((fd = accept4(gControlFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        ControlClient *slot = NULL;
+        for (int i = 0; i < MAX_CONTROL_CLIENTS && !slot; ++i) {
+            if (gControlClients[i].fd < 0) slot = &gControlClients[i];
+        }
+        if (!slot) {
+            close(fd); // Too many clients
+            continue;
+        }
+        Control_Close(slot);
+        slot->fd = fd;
+        struct ucred cred;
+        socklen_t credLen = sizeof(cred);
+        slot->peerUid = getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &credLen) == 0 ? cred.uid : (uid_t)-1;
+    }
+}
+
+static void Control_HandleClient(ControlClient *c, short revents) {
+    if (revents & POLLIN) {
+        ssize_t n = read(c->fd, c->in + c->inLen, CONTROL_IN_SIZE - c->inLen);
+        if (n == 0 || (n < 0 && errno != EAGAIN)) {
+            Control_Close(c);
+            return;
+        }
+        if (n > 0) c->inLen += (size_t)n;
+
+        Control_RunLines(c);
+        if (c->inLen == CONTROL_IN_SIZE) c->overflow = true; // Line too long or too much queued
+    } else if (revents & (POLLERR | POLLHUP)) {
+        Control_Close(c);
+        return;
+    }
+    if (c->overflow) {
+        Control_Close(c);
+        return;
+    }
+    Control_Flush(c);
+}
+
+#ifndef WLR_GAMEPAD_HEADLESS
+// --- Wayland Setup and Callbacks ---
+
+// Presentation feedback: every committed frame asks wp_presentation when it reached the
+// screen. A frame that carries a new touch (UiSnapshot.touchNs) turns that into the
+// touch -> photon latency; every frame counts as presented, late or discarded.
+#define PRESENT_FEEDBACK_MAX 4 // Outstanding requests; frame callbacks keep it to one or two
+
+typedef struct {
+    struct wp_presentation_feedback *feedback; // NULL while the entry is free
+    uint64_t touchNs;  // Touch frame this frame is the first to show, 0 if none
+    uint64_t commitNs;
+} PresentFeedback;
+
+static PresentFeedback gPresentFeedback[PRESENT_FEEDBACK_MAX];
+
+static void presentation_handle_clock_id(void *data, struct wp_presentation *presentation, uint32_t clk_id) {
+    gPresentationClock = (clockid_t)clk_id;
+    if (gPresentationClock != CLOCK_MONOTONIC) {
+        fprintf(stderr, "wp_presentation clock %u is not CLOCK_MONOTONIC, touch->photon latency disabled\n", clk_id);
+    }
+}
+
+static const struct wp_presentation_listener presentation_listener = {
+    .clock_id = presentation_handle_clock_id,
+};
+
+static void PresentFeedback_Release(PresentFeedback *pf) {
+    wp_presentation_feedback_destroy(pf->feedback);
+    pf->feedback = NULL;
+}
+
+static void presentation_feedback_handle_sync_output(void *data, struct wp_presentation_feedback *feedback,
+                                                     struct wl_output *output) {
+}
+
+static void presentation_feedback_handle_presented(void *data, struct wp_presentation_feedback *feedback,
+                                                   uint32_t tv_sec_hi, uint32_t tv_sec_lo, uint32_t tv_nsec,
+                                                   uint32_t refresh, uint32_t seq_hi, uint32_t seq_lo, uint32_t flags) {
+    PresentFeedback *pf = data;
+    uint64_t shownNs = (((uint64_t)tv_sec_hi << 32) | tv_sec_lo) * 1000000000ULL + tv_nsec;
+    PERF_INC(framesPresented);
+    if (gPresentationClock == CLOCK_MONOTONIC) {
+        // A frame committed right after the compositor's repaint is shown one refresh later;
+        // beyond two it waited for a vblank it should have made
+        if (refresh && shownNs > pf->commitNs + 2ULL * refresh) PERF_INC(framesLate);
+        if (pf->touchNs && shownNs > pf->touchNs) {
+            uint64_t latency = shownNs - pf->touchNs;
+            PERF_SET(lastTouchToPhotonNs, latency);
+            PERF_ADD(sumTouchToPhotonNs, latency);
+            PERF_INC(touchToPhotonCount);
+            PERF_MAX(maxTouchToPhotonNs, latency);
+        }
+    }
+    PresentFeedback_Release(pf);
+}
+
+static void presentation_feedback_handle_discarded(void *data, struct wp_presentation_feedback *feedback) {
+    PERF_INC(framesDiscarded);
+    PresentFeedback_Release(data);
+}
+
+static const struct wp_presentation_feedback_listener presentation_feedback_listener = {
+    .sync_output = presentation_feedback_handle_sync_output,
+    .presented = presentation_feedback_handle_presented,
+    .discarded = presentation_feedback_handle_discarded,
+};
+
+// The touch in gView is answered by the frame being committed, or needs no new frame.
+// Returns its timestamp the first time, 0 after that.
+static uint64_t Presentation_TakeTouch(void) {
+    uint64_t touchNs = gView->touchNs;
+    if (!touchNs || touchNs <= atomic_load_explicit(&gDrawnTouchNs, memory_order_relaxed)) return 0;
+    atomic_store_explicit(&gDrawnTouchNs, touchNs, memory_order_relaxed);
+    return touchNs;
+}
+
+// Request feedback for the commit that follows on the layer surface
+static void Presentation_Request(void) {
+    if (!gPresentation) {
+        Presentation_TakeTouch(); // Nothing to measure with
+        return;
+    }
+    for (int i = 0; i < PRESENT_FEEDBACK_MAX; ++i) {
+        PresentFeedback *pf = &gPresentFeedback[i];
+        if (pf->feedback) continue;
+        pf->feedback = wp_presentation_feedback(gPresentation, surface);
+        pf->touchNs = Presentation_TakeTouch();
+        pf->commitNs = clock_ns(CLOCK_MONOTONIC);
+        wp_presentation_feedback_add_listener(pf->feedback, &presentation_feedback_listener, pf);
+        return;
+    }
+    // Pool full: the touch stays undrawn and is measured with the next frame that gets feedback
+    PERF_INC(framesUnmeasured);
+}
+
+static void Presentation_Destroy(void) {
+    for (int i = 0; i < PRESENT_FEEDBACK_MAX; ++i) {
+        if (gPresentFeedback[i].feedback) PresentFeedback_Release(&gPresentFeedback[i]);
+    }
+    if (gPresentation) wp_presentation_destroy(gPresentation);
+    gPresentation = NULL;
+}
+
+static const struct wl_registry_listener registry_listener = {
+    .global = registry_handle_global,
+    .global_remove = NULL,
+};
+
+static void registry_handle_global(void *data, struct wl_registry *registry_ptr,
+                                   uint32_t name, const char *interface, uint32_t version) {
+    D("registry_handle_global: interface=%s", interface);
+    if (strcmp(interface, wl_compositor_interface.name) == 0) {
+        compositor = wl_registry_bind(registry_ptr, name, &wl_compositor_interface, 4);
+        D("Bound wl_compositor: %p", (void *)compositor);
+    } else if (strcmp(interface, zwlr_layer_shell_v1_interface.name) == 0) {
+        layer_shell = wl_registry_bind(registry_ptr, name, &zwlr_layer_shell_v1_interface, MIN(version, 4)); // Bind to min of offered and supported
+        D("Bound zwlr_layer_shell_v1: %p (version %u)", (void *)layer_shell, MIN(version, 4));
+    } else if (strcmp(interface, wl_shm_interface.name) == 0 && gRenderer == RENDERER_SHM) {
+        gShm = wl_registry_bind(registry_ptr, name, &wl_shm_interface, 1);
+        D("Bound wl_shm: %p", (void *)gShm);
+    } else if (strcmp(interface, wl_subcompositor_interface.name) == 0 && gSurfaceMode == SURFACES_WIDGET) {
+        gSubcompositor = wl_registry_bind(registry_ptr, name, &wl_subcompositor_interface, 1);
+        D("Bound wl_subcompositor: %p", (void *)gSubcompositor);
+    } else if (strcmp(interface, wp_viewporter_interface.name) == 0 && gRenderScale < 1.0f) {
+        gViewporter = wl_registry_bind(registry_ptr, name, &wp_viewporter_interface, 1);
+        D("Bound wp_viewporter: %p", (void *)gViewporter);
+    } else if (strcmp(interface, wp_presentation_interface.name) == 0) {
+        gPresentation = wl_registry_bind(registry_ptr, name, &wp_presentation_interface, 1);
+        wp_presentation_add_listener(gPresentation, &presentation_listener, NULL);
+        D("Bound wp_presentation: %p", (void *)gPresentation);
+    }
+}
+
+static const struct zwlr_layer_surface_v1_listener layer_surface_listener = {
+    .configure = layer_surface_handle_configure,
+    .closed = NULL, // TODO: Handle closed event to exit cleanly
+};
+
+static void layer_surface_handle_configure(void *data,
+                                           struct zwlr_layer_surface_v1 *surface_v1,
+                                           uint32_t serial,
+                                           uint32_t w, uint32_t h) {
+    D("layer_surface_handle_configure: w=%u h=%u serial=%u", w, h, serial);
+    gSurfaceWidth = w;
+    gSurfaceHeight = h;
+    gViewportChanged = true; // Signal that viewport dimensions have changed
+    Input_PostCommand((InputCommand){.type = INPUT_CMD_RESIZE, .a = (int)w, .b = (int)h});
+
+    if (egl_window && gSurfaceMode == SURFACES_OVERLAY) {
+        D("Resizing EGL window to %d x %d", Scale_ToBuffer(gSurfaceWidth), Scale_ToBuffer(gSurfaceHeight));
+        wl_egl_window_resize(egl_window, Scale_ToBuffer(gSurfaceWidth), Scale_ToBuffer(gSurfaceHeight), 0, 0);
+    }
+    if (gViewport && w > 0 && h > 0) wp_viewport_set_destination(gViewport, (int32_t)w, (int32_t)h); // Buffer scaled up to the surface
+    zwlr_layer_surface_v1_ack_configure(surface_v1, serial);
+
+    if (surface && compositor) { // Ensure surface and compositor are valid
+        struct wl_region *empty_region = wl_compositor_create_region(compositor);
+        wl_surface_set_input_region(surface, empty_region);
+        wl_region_destroy(empty_region);
+        wl_surface_commit(surface); // Commit surface changes
+    }
+}
+
+static void frame_handle_done(void *data, struct wl_callback *callback, uint32_t time) {
+    wl_callback_destroy(callback);
+    gFrameCallback = NULL;
+}
+
+static const struct wl_callback_listener frame_listener = {
+    .done = frame_handle_done,
+};
+
+// --- Shared-Memory Buffers ---
+// The shm renderer's double buffer. A buffer is busy from its commit until the
+// compositor's wl_buffer.release; RenderFrame draws into whichever is free. Each buffer
+// remembers the frame it last showed, which gives the same age RenderFrame uses with
+// EGL_EXT_buffer_age, so only the damage since then is repainted.
+
+#define SHM_BUFFERS 2
+
+typedef struct {
+    struct wl_buffer *buffer;
+    uint32_t *pixels;
+    size_t size;
+    int width, height;
+    bool busy;           // Attached, waiting for wl_buffer.release
+    unsigned shownFrame; // gShmFrame of its last commit, 0 if never shown
+} ShmBuffer;
+
+static ShmBuffer gShmBuffers[SHM_BUFFERS]; // The layer surface's
+static unsigned gShmFrame = 0;             // Buffers committed so far
+
+static void shm_buffer_handle_release(void *data, struct wl_buffer *buffer) {
+    ((ShmBuffer *)data)->busy = false;
+}
+
+static const struct wl_buffer_listener shm_buffer_listener = {
+    .release = shm_buffer_handle_release,
+};
+
+static void Shm_DestroyBuffer(ShmBuffer *b) {
+    if (b->buffer) wl_buffer_destroy(b->buffer);
+    if (b->pixels) munmap(b->pixels, b->size);
+    *b = (ShmBuffer){0};
+}
+
+static bool Shm_CreateBuffer(ShmBuffer *b, int w, int h) {
+    size_t size = (size_t)w * h * sizeof(uint32_t);
+    int fd = memfd_create("wlr_gamepad-shm", MFD_CLOEXEC);
+    if (fd < 0) { perror("memfd_create"); return false; }
+    if (ftruncate(fd, (off_t)size) < 0) { perror("ftruncate"); close(fd); return false; }
+    void *pixels = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (pixels == MAP_FAILED) { perror("mmap"); close(fd); return false; }
+    struct wl_shm_pool *pool = wl_shm_create_pool(gShm, fd, (int32_t)size);
+    b->buffer = wl_shm_pool_create_buffer(pool, 0, w, h, w * (int)sizeof(uint32_t), WL_SHM_FORMAT_ARGB8888);
+    wl_shm_pool_destroy(pool);
+    close(fd);
+    wl_buffer_add_listener(b->buffer, &shm_buffer_listener, b);
+    b->pixels = pixels; // Zero-filled by ftruncate, i.e. transparent
+    b->size = size;
+    b->width = w;
+    b->height = h;
+    D("Created %dx%d shm buffer", w, h);
+    return true;
+}
+
+// A free buffer of the current size, or NULL while both are held by the compositor.
+// Buffers of an old size are replaced once released.
+static ShmBuffer *Shm_Acquire(ShmBuffer buffers[SHM_BUFFERS], int w, int h) {
+    for (int i = 0; i < SHM_BUFFERS; ++i) {
+        ShmBuffer *b = &buffers[i];
+        if (b->busy) continue;
+        if (b->buffer && (b->width != w || b->height != h)) Shm_DestroyBuffer(b);
+        if (!b->buffer && !Shm_CreateBuffer(b, w, h)) return NULL;
+        return b;
+    }
+    return NULL;
+}
+
+// Frames since the buffer was shown, 0 if its contents are undefined
+static int Shm_BufferAge(const ShmBuffer *b) {
+    return b->shownFrame ? (int)(gShmFrame + 1 - b->shownFrame) : 0;
+}
+
+// damage is in buffer pixels
+static void Shm_Commit(struct wl_surface *target, ShmBuffer *b, DamageRect damage) {
+    wl_surface_attach(target, b->buffer, 0, 0);
+    wl_surface_damage_buffer(target, (int32_t)damage.x0, (int32_t)damage.y0,
+                             (int32_t)(damage.x1 - damage.x0), (int32_t)(damage.y1 - damage.y0));
+    wl_surface_commit(target);
+    b->busy = true;
+    b->shownFrame = ++gShmFrame;
+}
+
+static void Shm_Destroy(void) {
+    for (int i = 0; i < SHM_BUFFERS; ++i) Shm_DestroyBuffer(&gShmBuffers[i]);
+}
+
+// --- Widget Surfaces ---
+// --surfaces widget: instead of one full-screen translucent buffer, every widget gets a
+// subsurface just large enough for Widget_DrawBounds, and the menus, edit buttons and HUD
+// get one more (gChromeSurface) sized to what is shown. The layer surface itself only
+// holds a 1x1 transparent buffer. The compositor then blends the widgets' area rather
+// than the screen, a widget that didn't change commits nothing, and moving one in edit
+// mode is a wl_subsurface.set_position. The subsurfaces stay synchronized, so the frame
+// is applied at once by the layer surface's commit.
+
+typedef struct {
+    struct wl_surface *surface;
+    struct wl_subsurface *subsurface;
+    int x, y, w, h;                  // Placement on the overlay, pixels
+    int bufW, bufH;                  // Buffer size at gRenderScale
+    struct wp_viewport *viewport;    // Scales the buffer up to w x h (render scale below 1)
+    bool mapped;                     // Has a buffer attached
+    bool dirty;                      // Contents must be redrawn
+    struct wl_egl_window *eglWindow; // GL renderer
+    EGLSurface eglSurface;
+    ShmBuffer buffers[SHM_BUFFERS];  // shm renderer
+} Subsurface;
+
+static Subsurface gWidgetSurfaces[MAX_WIDGETS]; // Same index as gView->widgets
+static Subsurface gChromeSurface;
+static ShmBuffer gParentBuffer;                 // The layer surface's 1x1 buffer (shm renderer)
+static bool gParentMapped = false;
+
+static void Subsurface_Create(Subsurface *s) {
+    s->surface = wl_compositor_create_surface(compositor);
+    s->subsurface = wl_subcompositor_get_subsurface(gSubcompositor, s->surface, surface);
+    struct wl_region *empty_region = wl_compositor_create_region(compositor);
+    wl_surface_set_input_region(s->surface, empty_region); // Touches stay with the game, we read evdev
+    wl_region_destroy(empty_region);
+    if (gViewporter) s->viewport = wp_viewporter_get_viewport(gViewporter, s->surface);
+    // New subsurfaces stack on top; keep the menus and buttons above every widget
+    if (s != &gChromeSurface && gChromeSurface.subsurface) {
+        wl_subsurface_place_above(gChromeSurface.subsurface, s->surface);
+    }
+    s->dirty = true;
+}
+
+static void Subsurface_Destroy(Subsurface *s) {
+    if (s->eglSurface != EGL_NO_SURFACE) eglDestroySurface(egl_display, s->eglSurface);
+    if (s->eglWindow) wl_egl_window_destroy(s->eglWindow);
+    for (int i = 0; i < SHM_BUFFERS; ++i) Shm_DestroyBuffer(&s->buffers[i]);
+    if (s->viewport) wp_viewport_destroy(s->viewport);
+    if (s->subsurface) wl_subsurface_destroy(s->subsurface);
+    if (s->surface) wl_surface_destroy(s->surface);
+    *s = (Subsurface){0};
+}
+
+// Moves s over r (screen pixels); a new size needs new contents. Returns whether the
+// placement changed, which takes effect with the next commit of the layer surface.
+static bool Subsurface_Place(Subsurface *s, DamageRect r) {
+    if (!s->surface) Subsurface_Create(s);
+    int x = (int)floorf(r.x0), y = (int)floorf(r.y0);
+    int w = MAX(1, (int)ceilf(r.x1) - x), h = MAX(1, (int)ceilf(r.y1) - y);
+    bool moved = x != s->x || y != s->y, resized = w != s->w || h != s->h;
+    if (moved || resized) wl_subsurface_set_position(s->subsurface, x, y);
+    s->x = x; s->y = y; s->w = w; s->h = h;
+    if (resized) {
+        s->bufW = Scale_ToBuffer(w);
+        s->bufH = Scale_ToBuffer(h);
+        if (s->eglWindow) wl_egl_window_resize(s->eglWindow, s->bufW, s->bufH, 0, 0);
+        if (s->viewport) wp_viewport_set_destination(s->viewport, w, h);
+        s->dirty = true;
+    }
+    return moved || resized;
+}
+
+// Clears s and makes it the target of the Draw functions, in screen coordinates.
+// False while all its buffers are still held by the compositor.
+static bool Subsurface_Begin(Subsurface *s, ShmBuffer **shm) {
+    DamageRect area = {(float)s->x, (float)s->y, (float)(s->x + s->w), (float)(s->y + s->h)};
+    *shm = NULL;
+    if (gRenderer == RENDERER_SHM) {
+        *shm = Shm_Acquire(s->buffers, s->bufW, s->bufH);
+        if (!*shm) return false;
+        gCanvas = (SwCanvas){.pixels = (*shm)->pixels, .width = s->bufW, .height = s->bufH, .stride = s->bufW,
+                             .ox = (float)s->x, .oy = (float)s->y, .scale = gRenderScale};
+        Sw_SetClip(&gCanvas, area);
+        Sw_Clear(&gCanvas);
+        return true;
+    }
+    bool created = false;
+    if (!s->eglWindow) {
+        s->eglWindow = wl_egl_window_create(s->surface, s->bufW, s->bufH);
+        s->eglSurface = eglCreateWindowSurface(egl_display, egl_config, (EGLNativeWindowType)s->eglWindow, NULL);
+        if (s->eglSurface == EGL_NO_SURFACE) { fprintf(stderr, "eglCreateWindowSurface failed for a widget surface\n"); return false; }
+        created = true;
+    }
+    if (!eglMakeCurrent(egl_display, s->eglSurface, s->eglSurface, egl_context)) return false;
+    if (created) eglSwapInterval(egl_display, 0); // Per surface; paced by the layer surface's frame callback
+    glViewport(0, 0, s->bufW, s->bufH);
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    glOrtho(area.x0, area.x1, area.y1, area.y0, -1.0, 1.0);
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+    glClear(GL_COLOR_BUFFER_BIT);
+    return true;
+}
+
+static void Subsurface_End(Subsurface *s, ShmBuffer *shm) {
+    if (shm) {
+        Shm_Commit(s->surface, shm, (DamageRect){0, 0, (float)s->bufW, (float)s->bufH});
+    } else {
+        eglSwapBuffers(egl_display, s->eglSurface);
+    }
+    s->mapped = true;
+    s->dirty = false;
+    PERF_ADD(damagePixels, (uint64_t)s->bufW * (uint64_t)s->bufH);
+}
+
+static bool Subsurface_Unmap(Subsurface *s) {
+    if (!s->mapped) return false;
+    wl_surface_attach(s->surface, NULL, 0, 0);
+    wl_surface_commit(s->surface);
+    s->mapped = false;
+    s->dirty = true;
+    return true;
+}
+
+// The open menu dims the whole screen; otherwise only the edit buttons and the HUD
+static DamageRect Chrome_Bounds(int screenW, int screenH) {
+    ApplicationState appState = gView->appState;
+    if (appState != APP_STATE_RUNNING && appState != APP_STATE_EDIT_MODE) {
+        return (DamageRect){0, 0, (float)screenW, (float)screenH};
+    }
+    DamageRect r = {0};
+    if (appState == APP_STATE_EDIT_MODE) {
+        r = (DamageRect){kEditButtonX, kEditButtonY, kHudButtonX + kHudButtonW, kEditButtonY + kEditButtonH};
+    }
+    if (gView->hudVisible) r = Damage_Union(r, PerfHud_Bounds(screenW));
+    if (Damage_IsEmpty(r)) return r;
+    return (DamageRect){r.x0 - kOutlineThickness, r.y0 - kOutlineThickness, r.x1 + kOutlineThickness, r.y1 + kOutlineThickness};
+}
+
+// Gives the layer surface its 1x1 transparent buffer, committed with the first frame
+static void WidgetSurfaces_MapParent(void) {
+    if (gRenderer == RENDERER_SHM) {
+        if (!gParentBuffer.buffer && !Shm_CreateBuffer(&gParentBuffer, 1, 1)) return;
+        wl_surface_attach(surface, gParentBuffer.buffer, 0, 0);
+        wl_surface_damage_buffer(surface, 0, 0, 1, 1);
+    } else {
+        eglMakeCurrent(egl_display, egl_surface, egl_surface, egl_context);
+        glClear(GL_COLOR_BUFFER_BIT);
+        eglSwapBuffers(egl_display, egl_surface); // Attaches and commits
+    }
+    gParentMapped = true;
+}
+
+// RenderFrame for --surfaces widget: redraws only the subsurfaces whose contents changed,
+// moves the ones that only moved, then commits the layer surface to apply them together.
+static void WidgetSurfaces_Render(int screenW, int screenH) {
+    PerfTimer renderTimer = PerfTimer_Start();
+    const UiSnapshot *prev = &gLastDrawn, *cur = gView;
+    bool editMode = cur->appState != APP_STATE_RUNNING;
+    // Changes that restyle every widget (edit boxes, opacity)
+    bool restyle = gForceFullDamage || prev->appState != cur->appState || prev->selectedWidgetId != cur->selectedWidgetId ||
+                   prev->overlayActive != cur->overlayActive || gLastDrawnOpacity != gMasterOpacity;
+    bool changed = !gParentMapped, pending = false;
+    if (!gParentMapped) WidgetSurfaces_MapParent();
+
+    int numShown = cur->overlayActive ? cur->numWidgets : 0;
+    for (int i = 0; i < numShown; ++i) {
+        const Widget *w = &cur->widgets[i];
+        Subsurface *s = &gWidgetSurfaces[i];
+        changed |= Subsurface_Place(s, Widget_DrawBounds(w));
+        if (restyle || i >= prev->numWidgets) {
+            s->dirty = true;
+        } else { // The same drawing at a new place is only a move
+            Widget moved = prev->widgets[i];
+            moved.absCenter = w->absCenter;
+            moved.absTopLeft = w->absTopLeft;
+            if (!Widget_DrawsSame(&moved, w)) s->dirty = true;
+        }
+        if (!s->dirty) continue;
+        ShmBuffer *shm;
+        if (!Subsurface_Begin(s, &shm)) { pending = true; continue; }
+        DrawWidget(w, editMode);
+        Subsurface_End(s, shm);
+        changed = true;
+    }
+    for (int i = numShown; i < MAX_WIDGETS && gWidgetSurfaces[i].surface; ++i) { // Removed widgets, or disabled
+        Subsurface_Destroy(&gWidgetSurfaces[i]);
+        changed = true;
+    }
+
+    DamageRect chrome = cur->overlayActive ? Chrome_Bounds(screenW, screenH) : (DamageRect){0};
+    if (Damage_IsEmpty(chrome)) {
+        changed |= Subsurface_Unmap(&gChromeSurface);
+    } else {
+        changed |= Subsurface_Place(&gChromeSurface, chrome);
+        if (restyle || cur->hudVisible || prev->hudVisible != cur->hudVisible ||
+            prev->remappingWidgetId != cur->remappingWidgetId || prev->remapAction != cur->remapAction ||
+            prev->keyPage != cur->keyPage) {
+            gChromeSurface.dirty = true;
+        }
+        ShmBuffer *shm;
+        if (gChromeSurface.dirty) {
+            if (Subsurface_Begin(&gChromeSurface, &shm)) {
+                DrawMenusAndInterface(screenW, screenH);
+                Subsurface_End(&gChromeSurface, shm);
+                changed = true;
+            } else {
+                pending = true;
+            }
+        }
+    }
+    if (pending) gRenderRequested = true; // Retried after a wl_buffer.release
+    PerfTimer_Stop(STAGE_RENDER, renderTimer);
+
+    gLastDrawn = *cur;
+    gLastDrawnOpacity = gMasterOpacity;
+    gForceFullDamage = false;
+    if (!changed) {
+        Presentation_TakeTouch();
+        return;
+    }
+
+    PERF_INC(framesRendered);
+    for (int i = 0; i < numShown; ++i) PERF_ADD(surfacePixels, (uint64_t)gWidgetSurfaces[i].bufW * (uint64_t)gWidgetSurfaces[i].bufH);
+    if (gChromeSurface.mapped) PERF_ADD(surfacePixels, (uint64_t)gChromeSurface.bufW * (uint64_t)gChromeSurface.bufH);
+    gFrameCallback = wl_surface_frame(surface);
+    wl_callback_add_listener(gFrameCallback, &frame_listener, NULL);
+    Presentation_Request();
+    PerfTimer swapTimer = PerfTimer_Start();
+    uint64_t swapTrace = Trace_Begin();
     wl_surface_commit(surface);
-    wl_display_roundtrip(display); // Second roundtrip for configure event
+    PERF_INC(framesSwapped);
+    Trace_End(TRACE_SWAP, swapTrace, 0);
+    PerfTimer_Stop(STAGE_SWAP, swapTimer);
+}
+
+static void WidgetSurfaces_Destroy(void) {
+    for (int i = 0; i < MAX_WIDGETS; ++i) Subsurface_Destroy(&gWidgetSurfaces[i]);
+    Subsurface_Destroy(&gChromeSurface);
+    Shm_DestroyBuffer(&gParentBuffer);
+}
+
+// --- Main Application Logic ---
+
+// Draws gView and swaps (GL) or commits an shm buffer. Each frame asks the compositor for
+// a frame callback first; the main loop doesn't render again until it arrives, so drawing
+// is paced by the compositor instead of by a blocking eglSwapBuffers (swap interval is 0).
+void RenderFrame(int w_param, int h_param, EGLDisplay dpy, EGLSurface surf) {
+    if (gSurfaceMode == SURFACES_WIDGET) {
+        if (gViewportChanged) {
+            gViewportChanged = false;
+            gForceFullDamage = true;
+        }
+        WidgetSurfaces_Render(w_param, h_param);
+        return;
+    }
+    PerfTimer renderTimer = PerfTimer_Start();
+    int bufW = Scale_ToBuffer(w_param), bufH = Scale_ToBuffer(h_param);
+    if (gViewportChanged) {
+        if (gRenderer == RENDERER_GL) {
+            glViewport(0, 0, bufW, bufH); // Projection stays in surface coordinates
+            glMatrixMode(GL_PROJECTION);
+            glLoadIdentity();
+            glOrtho(0.0, (double)w_param, (double)h_param, 0.0, -1.0, 1.0);
+            glMatrixMode(GL_MODELVIEW);
+            glLoadIdentity();
+        }
+        gViewportChanged = false;
+        gForceFullDamage = true;
+    }
 
-    egl_window = wl_egl_window_create(surface, width, height);
-    if (!egl_window) { fprintf(stderr, "wl_egl_window_create failed\n"); return EXIT_FAILURE; }
+    DamageRect full = {0, 0, (float)w_param, (float)h_param};
+    DamageRect damage = Damage_Clip(Damage_Compute(w_param, h_param), w_param, h_param);
+    if (Damage_IsEmpty(damage)) { // Nothing visible changed (e.g. a finger landed on empty space)
+        Presentation_TakeTouch();
+        PerfTimer_Stop(STAGE_RENDER, renderTimer);
+        return;
+    }
+
+    // Repaint this frame's damage plus whatever the reused back buffer missed since it was shown
+    EGLint age = 0;
+    ShmBuffer *shm = NULL;
+    if (gRenderer == RENDERER_SHM) {
+        shm = Shm_Acquire(gShmBuffers, bufW, bufH);
+        if (!shm) { // Both buffers still on screen, retried after a wl_buffer.release
+            gRenderRequested = true;
+            PerfTimer_Stop(STAGE_RENDER, renderTimer);
+            return;
+        }
+        age = Shm_BufferAge(shm);
+    } else if (gHasBufferAge) {
+        eglQuerySurface(dpy, surf, EGL_BUFFER_AGE_EXT, &age);
+    }
+    gRedrawRect = damage;
+    if (age < 1 || age > DAMAGE_HISTORY + 1) {
+        gRedrawRect = full;
+    } else {
+        for (int i = 0; i < age - 1; ++i) gRedrawRect = Damage_Union(gRedrawRect, gDamageHistory[i]);
+    }
+    memmove(&gDamageHistory[1], &gDamageHistory[0], (DAMAGE_HISTORY - 1) * sizeof(DamageRect));
+    gDamageHistory[0] = damage;
+
+    bool partial = gRedrawRect.x0 > 0 || gRedrawRect.y0 > 0 || gRedrawRect.x1 < full.x1 || gRedrawRect.y1 < full.y1;
+    if (shm) {
+        gCanvas = (SwCanvas){.pixels = shm->pixels, .width = bufW, .height = bufH, .stride = bufW, .scale = gRenderScale};
+        Sw_SetClip(&gCanvas, gRedrawRect);
+        Sw_Clear(&gCanvas);
+    } else if (partial) {
+        Gl_Scissor(gRedrawRect, bufH);
+    }
 
+    bool cached = !shm && StaticLayer_Usable() && StaticLayer_Draw(w_param, h_param, bufW, bufH, partial);
+    if (!cached) {
+        if (!shm) glClear(GL_COLOR_BUFFER_BIT);
+        // Disabled overlay: leave the surface cleared
+        if (gView->overlayActive) {
+            DrawAllWidgets(w_param, h_param, gView->appState != APP_STATE_RUNNING);
+            DrawMenusAndInterface(w_param, h_param);
+        }
+    }
+    if (partial && !shm) glDisable(GL_SCISSOR_TEST);
+    DamageRect bufDamage = Damage_ToBuffer(damage);
+    PERF_INC(framesRendered);
+    PERF_ADD(damagePixels, (uint64_t)((bufDamage.x1 - bufDamage.x0) * (bufDamage.y1 - bufDamage.y0)));
+    PERF_ADD(surfacePixels, (uint64_t)bufW * (uint64_t)bufH);
+    PerfTimer_Stop(STAGE_RENDER, renderTimer);
+
+    gFrameCallback = wl_surface_frame(surface); // Committed by eglSwapBuffers or Shm_Commit
+    wl_callback_add_listener(gFrameCallback, &frame_listener, NULL);
+    Presentation_Request();
+    PerfTimer swapTimer = PerfTimer_Start();
+    uint64_t swapTrace = Trace_Begin();
+    EGLBoolean swapped;
+    if (shm) {
+        Shm_Commit(surface, shm, bufDamage);
+        swapped = EGL_TRUE;
+    } else if (gSwapBuffersWithDamage) {
+        EGLint rect[4] = {(EGLint)bufDamage.x0, (EGLint)(bufH - bufDamage.y1),
+                          (EGLint)(bufDamage.x1 - bufDamage.x0), (EGLint)(bufDamage.y1 - bufDamage.y0)};
+        swapped = gSwapBuffersWithDamage(dpy, surf, rect, 1);
+    } else {
+        swapped = eglSwapBuffers(dpy, surf);
+    }
+    if (swapped) PERF_INC(framesSwapped);
+    Trace_End(TRACE_SWAP, swapTrace, 0);
+    PerfTimer_Stop(STAGE_SWAP, swapTimer);
+
+    gLastDrawn = *gView;
+    gLastDrawnOpacity = gMasterOpacity;
+    gForceFullDamage = false;
+}
+
+// EGL display and config, kept from the first enable until exit: initializing loads the
+// driver, by far the slowest part of bringing the overlay up
+static bool Egl_InitDisplay(void) {
+    if (egl_display != EGL_NO_DISPLAY) return true;
     egl_display = eglGetDisplay((EGLNativeDisplayType)display);
-    if (egl_display == EGL_NO_DISPLAY) { fprintf(stderr, "eglGetDisplay failed\n"); return EXIT_FAILURE; }
-    if (!eglInitialize(egl_display, &egl_major, &egl_minor)) { fprintf(stderr, "eglInitialize failed\n"); return EXIT_FAILURE; }
-    
+    if (egl_display == EGL_NO_DISPLAY) { fprintf(stderr, "eglGetDisplay failed\n"); return false; }
+    if (!eglInitialize(egl_display, &egl_major, &egl_minor)) {
+        fprintf(stderr, "eglInitialize failed\n");
+        egl_display = EGL_NO_DISPLAY;
+        return false;
+    }
+
     eglBindAPI(EGL_OPENGL_API); // For desktop GL immediate mode
-    EGLConfig egl_config;
     EGLint num_config;
     const EGLint config_attribs[] = {
         EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
@@ -1913,84 +5388,374 @@ int main(void) {
         EGL_NONE
     };
     if (!eglChooseConfig(egl_display, config_attribs, &egl_config, 1, &num_config) || num_config == 0) {
-        fprintf(stderr, "eglChooseConfig failed\n"); return EXIT_FAILURE;
+        fprintf(stderr, "eglChooseConfig failed\n");
+        eglTerminate(egl_display);
+        egl_display = EGL_NO_DISPLAY;
+        return false;
     }
+    Damage_InitEGL(egl_display);
+    return true;
+}
+
+// EGL window, context and GL state for the default renderer
+static bool Gl_Init(void) {
+    if (!Egl_InitDisplay()) return false;
+    bool tiny = gSurfaceMode == SURFACES_WIDGET; // Only the 1x1 parent of the widget surfaces
+    egl_window = wl_egl_window_create(surface, tiny ? 1 : Scale_ToBuffer(gSurfaceWidth), tiny ? 1 : Scale_ToBuffer(gSurfaceHeight));
+    if (!egl_window) { fprintf(stderr, "wl_egl_window_create failed\n"); return false; }
 
     egl_context = eglCreateContext(egl_display, egl_config, EGL_NO_CONTEXT, NULL); // No specific attributes for compatibility profile
-    if (egl_context == EGL_NO_CONTEXT) { fprintf(stderr, "eglCreateContext failed\n"); return EXIT_FAILURE; }
-    
+    if (egl_context == EGL_NO_CONTEXT) { fprintf(stderr, "eglCreateContext failed\n"); return false; }
+
     egl_surface = eglCreateWindowSurface(egl_display, egl_config, (EGLNativeWindowType)egl_window, NULL);
-    if (egl_surface == EGL_NO_SURFACE) { fprintf(stderr, "eglCreateWindowSurface failed\n"); return EXIT_FAILURE; }
+    if (egl_surface == EGL_NO_SURFACE) { fprintf(stderr, "eglCreateWindowSurface failed\n"); return false; }
 
     if (!eglMakeCurrent(egl_display, egl_surface, egl_surface, egl_context)) {
-        fprintf(stderr, "eglMakeCurrent failed\n"); return EXIT_FAILURE;
+        fprintf(stderr, "eglMakeCurrent failed\n"); return false;
     }
-    
-    eglSwapInterval(egl_display, 1); // Enable vsync
+    StaticLayer_InitGL();
+
+    eglSwapInterval(egl_display, 0); // Paced by frame callbacks, never wait for vblank in EGL
 
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glDisable(GL_DEPTH_TEST);
+    return true;
+}
 
-    UpdateAllWidgetCoords(width, height); // Initial widget coordinate calculation
-    
-    if (!uinput_init()) {
-        fprintf(stderr, "uinput_init failed\n");
-        // Proper cleanup would be needed here
-        return EXIT_FAILURE;
+// Everything Gl_Init created except the display; frees the GPU memory
+static void Gl_Destroy(void) {
+    if (egl_display == EGL_NO_DISPLAY) return;
+    if (gStaticAvailable && egl_context != EGL_NO_CONTEXT) StaticLayer_Destroy(); // Needs the context still current
+    eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (egl_surface != EGL_NO_SURFACE) eglDestroySurface(egl_display, egl_surface);
+    if (egl_context != EGL_NO_CONTEXT) eglDestroyContext(egl_display, egl_context);
+    if (egl_window) wl_egl_window_destroy(egl_window);
+    egl_surface = EGL_NO_SURFACE;
+    egl_context = EGL_NO_CONTEXT;
+    egl_window = NULL;
+}
+
+static void Egl_Terminate(void) {
+    if (egl_display == EGL_NO_DISPLAY) return;
+    eglTerminate(egl_display);
+    egl_display = EGL_NO_DISPLAY;
+}
+
+// --- Overlay Surface ---
+// The layer surface and everything drawn into it exist only while the overlay is enabled.
+// Disabling destroys them, so the compositor unmaps the overlay and EGL frees the window
+// buffers and the context (or the shm buffers are unmapped); enabling creates them again.
+// Only the EGL display survives, which keeps re-enabling to a roundtrip plus a new context.
+
+static bool gOverlayShown = false; // Main thread: surface and renderer exist
+
+static void Overlay_Hide(void) {
+    if (gFrameCallback) {
+        wl_callback_destroy(gFrameCallback);
+        gFrameCallback = NULL;
     }
+    WidgetSurfaces_Destroy();
+    gParentMapped = false;
+    Gl_Destroy();
+    Shm_Destroy();
+    if (gViewport) wp_viewport_destroy(gViewport);
+    if (layer_surface) zwlr_layer_surface_v1_destroy(layer_surface);
+    if (surface) wl_surface_destroy(surface);
+    gViewport = NULL;
+    layer_surface = NULL;
+    surface = NULL;
+    if (gOverlayShown) D("Overlay hidden");
+    gOverlayShown = false;
+}
 
-    const char *touch_path = find_touchscreen_device();
-    if (!touch_path) {
-        fprintf(stderr, "No touchscreen found, exiting.\n");
-        return EXIT_FAILURE;
-    } else {
-        init_touch_device(touch_path);
+// Creates the layer surface, waits for its first configure and sets up the renderer
+static bool Overlay_Show(void) {
+    if (gOverlayShown) return true;
+    uint64_t startNs = clock_ns(CLOCK_MONOTONIC);
+    surface = wl_compositor_create_surface(compositor);
+    if (!surface) { fprintf(stderr, "wl_compositor_create_surface failed\n"); return false; }
+
+    layer_surface = zwlr_layer_shell_v1_get_layer_surface(
+        layer_shell, surface, NULL, ZWLR_LAYER_SHELL_V1_LAYER_OVERLAY, "gamepad_overlay");
+    if (!layer_surface) { fprintf(stderr, "get_layer_surface failed\n"); Overlay_Hide(); return false; }
+
+    if (gViewporter && gSurfaceMode == SURFACES_OVERLAY) gViewport = wp_viewporter_get_viewport(gViewporter, surface);
+    zwlr_layer_surface_v1_add_listener(layer_surface, &layer_surface_listener, NULL);
+    zwlr_layer_surface_v1_set_size(layer_surface, 0, 0); // Size 0,0 means compositor decides
+    zwlr_layer_surface_v1_set_anchor(layer_surface,
+        ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP | ZWLR_LAYER_SURFACE_V1_ANCHOR_BOTTOM |
+        ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT | ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT);
+    zwlr_layer_surface_v1_set_exclusive_zone(layer_surface, -1); // Cover entire screen
+
+    wl_surface_set_opaque_region(surface, NULL); // Transparent background
+    wl_surface_commit(surface);
+    wl_display_roundtrip(display); // Roundtrip for the configure event
+
+    if (gRenderer == RENDERER_GL && !Gl_Init()) {
+        Overlay_Hide();
+        return false;
     }
+    gOverlayShown = true;
+    gForceFullDamage = true;
+    gRenderRequested = true;
+    D("Overlay shown in %.2f ms", (clock_ns(CLOCK_MONOTONIC) - startNs) / 1e6);
+    return true;
+}
 
-    // Find and grab volume-down device for toggle
-    gVolDevFd = find_input_device(EV_KEY, KEY_VOLUMEDOWN);
-    if (gVolDevFd < 0) {
-        fprintf(stderr, "No volume-down device found\n");
-        return EXIT_FAILURE;
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -s, --socket PATH    control socket (default $XDG_RUNTIME_DIR/wlr_gamepad.sock)\n"
+            "  -p, --profile PATH   load a widget profile at startup\n"
+            "  -t, --touch PATH     touchscreen evdev device (default: first multitouch device)\n"
+            "  -r, --realtime[=PRIO] run the input thread SCHED_FIFO (default priority 50) with locked memory\n"
+            "  -c, --cpu LIST       pin the input thread to CPUs, e.g. 3 or 2,3\n"
+            "  -R, --renderer NAME  gl (default) or shm: draw on the CPU into shared memory, no GPU\n"
+            "  -S, --surfaces MODE  overlay (default): one full-screen surface, or widget: one small surface per widget\n"
+            "  -x, --render-scale F render at F (0.25-1) of the screen resolution, scaled up by the compositor\n"
+            "  -d, --disabled       start with the overlay disabled; no surface or GPU context until enabled\n"
+            "  -P, --predict MS     resample joysticks to touch timestamps and extrapolate MS (0-20) ahead\n"
+            "  -T, --trace PATH     record a timeline of both loops, written to PATH as Chrome trace JSON on SIGUSR2 and exit\n"
+            "  -D, --input-daemon   only the input half: touchscreen, widgets and uinput, no Wayland (run as root)\n"
+            "  -A, --attach         only the overlay: draw the --input-daemon's state, found at --socket (run as the user)\n"
+            "  -h, --help           show this help\n", argv0);
+}
+
+// "2,3" -> gInputCpus
+static bool ParseCpuList(const char *list) {
+    CPU_ZERO(&gInputCpus);
+    const char *p = list;
+    while (*p) {
+        char *end;
+        long cpu = strtol(p, &end, 10);
+        if (end == p || cpu < 0 || cpu >= CPU_SETSIZE || (*end != ',' && *end != '\0')) return false;
+        CPU_SET((int)cpu, &gInputCpus);
+        p = (*end == ',') ? end + 1 : end;
     }
-    ioctl(gVolDevFd, EVIOCGRAB, 1);
+    gInputCpusSet = CPU_COUNT(&gInputCpus) > 0;
+    return gInputCpusSet;
+}
 
-    // Find and grab volume-up device for landscape toggle
-    gVolUpDevFd = find_input_device(EV_KEY, KEY_VOLUMEUP);
-    if (gVolUpDevFd >= 0) {
-        ioctl(gVolUpDevFd, EVIOCGRAB, 1);
+int main(int argc, char **argv) {
+    char socketPath[108];
+    const char *runtimeDir = getenv("XDG_RUNTIME_DIR");
+    snprintf(socketPath, sizeof(socketPath), "%s/wlr_gamepad.sock", runtimeDir ? runtimeDir : "/tmp");
+    const char *profilePath = NULL;
+    const char *touchPath = NULL;
+    bool startDisabled = false;
+    const char *tracePath = NULL;
+    bool inputDaemon = false, attach = false;
+
+    static const struct option longOptions[] = {
+        {"socket",  required_argument, NULL, 's'},
+        {"profile", required_argument, NULL, 'p'},
+        {"touch",    required_argument, NULL, 't'},
+        {"realtime", optional_argument, NULL, 'r'},
+        {"cpu",      required_argument, NULL, 'c'},
+        {"renderer", required_argument, NULL, 'R'},
+        {"surfaces", required_argument, NULL, 'S'},
+        {"render-scale", required_argument, NULL, 'x'},
+        {"disabled", no_argument,       NULL, 'd'},
+        {"trace",    required_argument, NULL, 'T'},
+        {"predict",  required_argument, NULL, 'P'},
+        {"input-daemon", no_argument,   NULL, 'D'},
+        {"attach",   no_argument,       NULL, 'A'},
+        {"help",     no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "s:p:t:r::c:R:S:x:dT:P:DAh", longOptions, NULL)) != -1) {
+        switch (opt) {
+            case 's': snprintf(socketPath, sizeof(socketPath), "%s", optarg); break;
+            case 'p': profilePath = optarg; break;
+            case 't': touchPath = optarg; break;
+            case 'r':
+                gRealtimeInput = true;
+                gRealtimePriority = optarg ? atoi(optarg) : 50;
+                if (gRealtimePriority < sched_get_priority_min(SCHED_FIFO) || gRealtimePriority > sched_get_priority_max(SCHED_FIFO)) {
+                    fprintf(stderr, "Invalid SCHED_FIFO priority: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'c':
+                if (!ParseCpuList(optarg)) { fprintf(stderr, "Invalid CPU list: %s\n", optarg); return EXIT_FAILURE; }
+                break;
+            case 'R':
+                if (strcmp(optarg, "gl") == 0) gRenderer = RENDERER_GL;
+                else if (strcmp(optarg, "shm") == 0) gRenderer = RENDERER_SHM;
+                else { fprintf(stderr, "Unknown renderer: %s\n", optarg); return EXIT_FAILURE; }
+                break;
+            case 'S':
+                if (strcmp(optarg, "overlay") == 0) gSurfaceMode = SURFACES_OVERLAY;
+                else if (strcmp(optarg, "widget") == 0) gSurfaceMode = SURFACES_WIDGET;
+                else { fprintf(stderr, "Unknown surface mode: %s\n", optarg); return EXIT_FAILURE; }
+                break;
+            case 'x':
+                gRenderScale = strtof(optarg, NULL);
+                if (!(gRenderScale >= 0.25f && gRenderScale <= 1.0f)) {
+                    fprintf(stderr, "Invalid render scale: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'd': startDisabled = true; break;
+            case 'T': tracePath = optarg; break;
+            case 'P': {
+                char *end;
+                long ms = strtol(optarg, &end, 10);
+                if (*end || ms < 0 || ms > PREDICT_MAX_MS) {
+                    fprintf(stderr, "Invalid prediction horizon (0-%d ms): %s\n", PREDICT_MAX_MS, optarg);
+                    return EXIT_FAILURE;
+                }
+                gPredictNs = (uint64_t)ms * 1000000ULL;
+                break;
+            }
+            case 'D': inputDaemon = true; break;
+            case 'A': attach = true; break;
+            case 'h': usage(argv[0]); return EXIT_SUCCESS;
+            default:  usage(argv[0]); return EXIT_FAILURE;
+        }
     }
 
-    int wl_fd = wl_display_get_fd(display);
-    struct pollfd fds[4];  // Expanded to include volume-up
-    int nfds = 0;
-    // Watch Wayland, touch, and volume-down fds
-    fds[nfds++] = (struct pollfd){.fd = wl_fd,      .events = POLLIN};
-    if (gTouchDevFd >= 0) {
-        fds[nfds++] = (struct pollfd){.fd = gTouchDevFd, .events = POLLIN};
+    if (Log_Start()) atexit(Log_Stop); // Flushes D() output on every exit path
+    if (tracePath && !Trace_Init(tracePath)) return EXIT_FAILURE;
+    Trace_BindThread(TRACE_THREAD_MAIN);
+    if (inputDaemon && attach) {
+        fprintf(stderr, "--input-daemon and --attach are the two halves of one overlay, use one per process\n");
+        return EXIT_FAILURE;
     }
-    if (gVolDevFd >= 0) {
-        fds[nfds++] = (struct pollfd){.fd = gVolDevFd,   .events = POLLIN};
+
+    // The input daemon never talks to the compositor: display stays NULL
+    if (!inputDaemon) {
+        display = wl_display_connect(NULL);
+        if (!display) { fprintf(stderr, "wl_display_connect failed\n"); return EXIT_FAILURE; }
+
+        registry = wl_display_get_registry(display);
+        wl_registry_add_listener(registry, &registry_listener, NULL);
+        wl_display_roundtrip(display); // Initial roundtrip to get globals
+
+        if (!compositor || !layer_shell) {
+            fprintf(stderr, "Failed to bind Wayland globals (compositor or layer_shell)\n");
+            return EXIT_FAILURE;
+        }
+
+        if (gRenderScale < 1.0f && !gViewporter) {
+            fprintf(stderr, "Compositor has no wp_viewporter, rendering at full resolution\n");
+            gRenderScale = 1.0f;
+        }
+
+        if (gSurfaceMode == SURFACES_WIDGET && !gSubcompositor) {
+            fprintf(stderr, "Compositor has no wl_subcompositor\n"); return EXIT_FAILURE;
+        }
+        if (gRenderer == RENDERER_SHM && !gShm) {
+            fprintf(stderr, "Compositor has no wl_shm\n"); return EXIT_FAILURE;
+        }
     }
-    if (gVolUpDevFd >= 0) {
-        fds[nfds++] = (struct pollfd){.fd = gVolUpDevFd, .events = POLLIN};
+    // The overlay shows what the daemon has; its surface size reaches the daemon as "resize"
+    if (attach) {
+        if (!Daemon_Attach(socketPath)) return EXIT_FAILURE;
+        SharedView_Acquire();
+        startDisabled = !gView->overlayActive;
     }
+    // Disabled: nothing is created until the first enable
+    if (display && !startDisabled && !Overlay_Show()) return EXIT_FAILURE;
+
+    if (!attach) {
+        // Queued for the input thread, applied by InputThread_Start
+        if (profilePath) {
+            char err[256];
+            if (!Profile_Load(profilePath, err, sizeof(err))) fprintf(stderr, "Failed to load profile: %s\n", err);
+        }
+
+        if (!uinput_init()) {
+            fprintf(stderr, "uinput_init failed\n");
+            // Proper cleanup would be needed here
+            return EXIT_FAILURE;
+        }
+        uinput_install_crash_handler();
+
+        const char *touch_path = touchPath ? touchPath : find_touchscreen_device();
+        if (!touch_path) {
+            fprintf(stderr, "No touchscreen found, exiting.\n");
+            return EXIT_FAILURE;
+        } else {
+            init_touch_device(touch_path);
+        }
+        if (startDisabled) SetOverlayActive(false); // Input thread not started yet
+
+        // Find and grab volume-down device for toggle
+        gVolDevFd = find_input_device(EV_KEY, KEY_VOLUMEDOWN);
+        if (gVolDevFd < 0) {
+            fprintf(stderr, "No volume-down device found\n");
+            return EXIT_FAILURE;
+        }
+        ioctl(gVolDevFd, EVIOCGRAB, 1);
+
+        // Find and grab volume-up device for landscape toggle
+        gVolUpDevFd = find_input_device(EV_KEY, KEY_VOLUMEUP);
+        if (gVolUpDevFd >= 0) {
+            ioctl(gVolUpDevFd, EVIOCGRAB, 1);
+        }
+    }
+
+    // SIGUSR1 dumps performance counters, SIGUSR2 writes the --trace file, SIGTERM/SIGINT exit through the cleanup below
+    // (which releases held keys); delivered through the poll set
+    sigset_t sigmask;
+    sigemptyset(&sigmask);
+    sigaddset(&sigmask, SIGUSR1);
+    sigaddset(&sigmask, SIGUSR2);
+    sigaddset(&sigmask, SIGTERM);
+    sigaddset(&sigmask, SIGINT);
+    sigprocmask(SIG_BLOCK, &sigmask, NULL);
+    int signal_fd = signalfd(-1, &sigmask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd < 0) perror("signalfd");
+
+    if (!attach) {
+        // The input daemon hands its socket to the user who ran sudo, for the overlay and
+        // scripts, and then becomes that user
+        uid_t userUid = (uid_t)-1;
+        gid_t userGid = (gid_t)-1;
+        bool dropRoot = inputDaemon && Daemon_SudoUser(&userUid, &userGid);
+        // Runtime commands from launcher scripts; the overlay works without it. The input
+        // daemon also needs it for --attach.
+        if (!Control_Init(socketPath, userUid, userGid) && inputDaemon) return EXIT_FAILURE;
+        if (inputDaemon && !SharedView_Create()) return EXIT_FAILURE;
+        if (dropRoot && !Daemon_DropPrivileges(userUid, userGid)) return EXIT_FAILURE;
+        if (!InputThread_Start()) return EXIT_FAILURE;
+    }
+
+    // Watch Wayland, new input snapshots, volume keys, signals, the input daemon (--attach)
+    // and the control socket with its clients. Missing devices keep fd -1, which poll ignores;
+    // so do the parts the --input-daemon or --attach half doesn't have.
+    enum { FD_WAYLAND, FD_INPUT, FD_VOLDOWN, FD_VOLUP, FD_SIGNAL, FD_DAEMON, FD_CONTROL, FD_CLIENT0, FD_COUNT = FD_CLIENT0 + MAX_CONTROL_CLIENTS };
+    struct pollfd fds[FD_COUNT] = {
+        [FD_WAYLAND] = {.fd = display ? wl_display_get_fd(display) : -1, .events = POLLIN},
+        [FD_INPUT]   = {.fd = gRenderWakeFd,              .events = POLLIN},
+        [FD_VOLDOWN] = {.fd = gVolDevFd,                  .events = POLLIN},
+        [FD_VOLUP]   = {.fd = gVolUpDevFd,                .events = POLLIN},
+        [FD_SIGNAL]  = {.fd = signal_fd,                  .events = POLLIN},
+        [FD_DAEMON]  = {.fd = gDaemonFd,                  .events = POLLIN},
+        [FD_CONTROL] = {.fd = gControlFd,                 .events = POLLIN},
+    };
+    const int nfds = FD_COUNT;
+    gPerfStartNs = gPerfLastTickNs = clock_ns(CLOCK_MONOTONIC);
+    gPerfDumpWindow.lastNs = gPerfControlWindow.lastNs = gPerfStartNs;
     
     // Initial render before loop
-    RenderFrame(width, height, egl_display, egl_surface);
+    if (gOverlayShown) RenderFrame(gSurfaceWidth, gSurfaceHeight, egl_display, egl_surface);
+    gRenderRequested = false;
 
     bool running = true;
     while (running) {
         // Dispatch pending Wayland events without blocking
-        while (wl_display_prepare_read(display) != 0) {
+        while (display && wl_display_prepare_read(display) != 0) {
             if (wl_display_dispatch_pending(display) == -1) {
                 running = false; break; // Error in dispatch
             }
         }
         if (!running) break;
 
-        if (wl_display_flush(display) == -1) { // Flush outstanding Wayland requests
+        if (display && wl_display_flush(display) == -1) { // Flush outstanding Wayland requests
              running = false; break; // Error in flush
         }
         
@@ -2004,20 +5769,100 @@ int main(void) {
             if (rem_ns < 0) rem_ns = 0;
             timeout_ms = (int)(rem_ns / 1000000L);
         }
+        for (int i = 0; i < MAX_CONTROL_CLIENTS; ++i) {
+            const ControlClient *c = &gControlClients[i];
+            fds[FD_CLIENT0 + i] = (struct pollfd){.fd = c->fd, .events = POLLIN | (c->outLen ? POLLOUT : 0)};
+        }
+        uint64_t pollTrace = Trace_Begin();
         int ret = poll(fds, nfds, timeout_ms); // Block until event or timeout
+        Trace_End(TRACE_POLL, pollTrace, 0);
         if (ret < 0) {
             perror("poll");
             running = false; // Error in poll
-            wl_display_cancel_read(display); // Cancel the read intent
+            if (display) wl_display_cancel_read(display); // Cancel the read intent
             break;
         }
 
-        if (wl_display_read_events(display) == -1) { // Process Wayland events
+        PERF_INC(loopIterations);
+        if (ret == 0) PERF_INC(wakeups[WAKE_TIMEOUT]);
+        if (fds[FD_WAYLAND].revents) PERF_INC(wakeups[WAKE_WAYLAND]);
+        if (fds[FD_INPUT].revents)   PERF_INC(wakeups[WAKE_INPUT]);
+        if (fds[FD_VOLDOWN].revents) PERF_INC(wakeups[WAKE_VOLDOWN]);
+        if (fds[FD_VOLUP].revents)   PERF_INC(wakeups[WAKE_VOLUP]);
+        if (fds[FD_SIGNAL].revents)  PERF_INC(wakeups[WAKE_SIGNAL]);
+        for (int i = FD_DAEMON; i < FD_COUNT; ++i) {
+            if (fds[i].revents) { PERF_INC(wakeups[WAKE_CONTROL]); break; }
+        }
+        PerfStats_Tick();
+
+        uint64_t dispatchTrace = Trace_Begin();
+        if (display && wl_display_read_events(display) == -1) { // Process Wayland events
             running = false; break; // Error reading events
         }
+        if (display && wl_display_dispatch_pending(display) == -1) { // Frame callbacks before deciding to render
+            running = false; break;
+        }
+        Trace_End(TRACE_DISPATCH, dispatchTrace, 0);
+
+        // Newest state from the input thread
+        if (fds[FD_INPUT].revents & POLLIN) {
+            uint64_t n;
+            read(gRenderWakeFd, &n, sizeof(n));
+        }
+        bool viewChanged = gAttachedView ? SharedView_Acquire() : Snapshot_Acquire();
+        int inputError = atomic_load(&gInputThreadError);
+        if (inputError) {
+            fprintf(stderr, "read touch device: %s\n", strerror(inputError));
+            running = false; break;
+        }
+        if (viewChanged) Control_Resume();
+        if (display && viewChanged && gView->overlayActive != gOverlayShown) {
+            if (gView->overlayActive) {
+                Overlay_Show(); // Retried on the next snapshot if it failed
+            } else {
+                Overlay_Hide();
+            }
+        }
+
+        if (fds[FD_SIGNAL].revents & POLLIN) {
+            struct signalfd_siginfo si;
+            while (read(signal_fd, &si, sizeof(si)) == sizeof(si)) {
+                if (si.ssi_signo == SIGUSR1) PerfStats_Dump();
+                if (si.ssi_signo == SIGUSR2) Trace_Write();
+                if (si.ssi_signo == SIGTERM || si.ssi_signo == SIGINT) running = false;
+            }
+        }
+
+        // --attach: the daemon's replies to forwarded commands. Only errors are of interest;
+        // the daemon closing the socket (exit, crash) ends the overlay too.
+        if (fds[FD_DAEMON].revents) {
+            char reply[CONTROL_IN_SIZE];
+            ssize_t n = read(gDaemonFd, reply, sizeof(reply) - 1);
+            if (n == 0 || (n < 0 && errno != EAGAIN)) {
+                fprintf(stderr, "Input daemon closed the connection\n");
+                running = false; break;
+            }
+            if (n > 0) {
+                reply[n] = '\0';
+                const char *err = strstr(reply, "error");
+                if (err) fprintf(stderr, "[ATTACH] input daemon: %s", err);
+            }
+        }
+
+        // Control socket: accept new clients, then run complete command lines
+        if (fds[FD_CONTROL].revents & POLLIN) {
+            Control_Accept();
+        }
+        for (int i = 0; i < MAX_CONTROL_CLIENTS; ++i) {
+            short revents = fds[FD_CLIENT0 + i].revents;
+            if (revents && gControlClients[i].fd == fds[FD_CLIENT0 + i].fd) {
+                Control_HandleClient(&gControlClients[i], revents);
+            }
+        }
+        if (gSharedView) SharedView_PublishOpacity();
 
         // Handle volume-down press/release for long-press toggle
-        if (gVolDevFd >= 0 && fds[2].revents & POLLIN) {
+        if (gVolDevFd >= 0 && fds[FD_VOLDOWN].revents & POLLIN) {
             struct input_event ev;
             while (read(gVolDevFd, &ev, sizeof(ev)) == sizeof(ev)) {
                 if (ev.type == EV_KEY && ev.code == KEY_VOLUMEDOWN) {
@@ -2031,8 +5876,7 @@ int main(void) {
                         clock_gettime(CLOCK_MONOTONIC, &now);
                         long dt = (now.tv_sec - gVolTs.tv_sec) * 1000000000L + (now.tv_nsec - gVolTs.tv_nsec);
                         if (dt < LONG_PRESS_NS && !gVolToggled) {
-                            uinput_key(KEY_VOLUMEDOWN, true);
-                            uinput_key(KEY_VOLUMEDOWN, false);
+                            Input_PostCommand((InputCommand){.type = INPUT_CMD_KEY, .a = KEY_VOLUMEDOWN, .b = 2});
                         }
                         gVolDown = false;
                         gVolToggled = false;
@@ -2041,13 +5885,15 @@ int main(void) {
             }
         }
         // Handle volume-up press for landscape toggle
-        if (gVolUpDevFd >= 0 && fds[3].revents & POLLIN) {
+        if (gVolUpDevFd >= 0 && fds[FD_VOLUP].revents & POLLIN) {
             struct input_event ev;
             while (read(gVolUpDevFd, &ev, sizeof(ev)) == sizeof(ev)) {
                 if (ev.type == EV_KEY && ev.code == KEY_VOLUMEUP) {
-                    if (!gOverlayActive) {
-                        // overlay hidden: just forward the event
-                        uinput_key(KEY_VOLUMEUP, ev.value == 1);
+                    if (!gView->overlayActive) {
+                        // overlay hidden: just forward the event (not autorepeat)
+                        if (ev.value == 0 || ev.value == 1) {
+                            Input_PostCommand((InputCommand){.type = INPUT_CMD_KEY, .a = KEY_VOLUMEUP, .b = ev.value});
+                        }
                     } else {
                         if (ev.value == 1) {
                             // record press time
@@ -2060,11 +5906,10 @@ int main(void) {
                             long dt = (now.tv_sec - gVolUpTs.tv_sec) * 1000000000L + (now.tv_nsec - gVolUpTs.tv_nsec);
                             if (dt < LONG_PRESS_NS) {
                                 // quick tap: forward volume-up
-                                uinput_key(KEY_VOLUMEUP, true);
-                                uinput_key(KEY_VOLUMEUP, false);
+                                Input_PostCommand((InputCommand){.type = INPUT_CMD_KEY, .a = KEY_VOLUMEUP, .b = 2});
                             } else {
                                 // hold: toggle landscape
-                                gLandscapeMode = !gLandscapeMode;
+                                Input_PostCommand((InputCommand){.type = INPUT_CMD_ORIENTATION, .a = -1});
                             }
                             gVolUpDown = false;
                         }
@@ -2078,45 +5923,39 @@ int main(void) {
             clock_gettime(CLOCK_MONOTONIC, &now);
             long dt = (now.tv_sec - gVolTs.tv_sec)*1000000000L + (now.tv_nsec - gVolTs.tv_nsec);
             if (dt >= LONG_PRESS_NS) {
-                toggle_overlay();
+                Input_PostCommand((InputCommand){.type = INPUT_CMD_ENABLE, .a = -1});
                 gVolToggled = true;
             }
         }
-        // Skip all input/render when overlay is off
-        if (!gOverlayActive) {
-            continue;
+        // At most one frame per compositor frame, always from the newest snapshot: while a
+        // frame callback is outstanding changes only accumulate, so a burst of touch
+        // events collapses into one render. A disabled overlay has no surface to draw.
+        if (viewChanged || gViewportChanged) gRenderRequested = true;
+        if (gRenderRequested && !gFrameCallback && gOverlayShown) {
+            gRenderRequested = false;
+            uint64_t renderTrace = Trace_Begin();
+            RenderFrame(gSurfaceWidth, gSurfaceHeight, egl_display, egl_surface);
+            Trace_End(TRACE_RENDER, renderTrace, 0);
         }
-
-        if (gTouchDevFd >= 0 && fds[1].revents & POLLIN) {
-            struct input_event ev;
-            ssize_t read_len;
-            while ((read_len = read(gTouchDevFd, &ev, sizeof(ev))) == sizeof(ev)) {
-                handle_evdev_event(&ev);
-            }
-            if (read_len < 0 && errno != EAGAIN) {
-                 perror("read touch device"); running = false; break;
-            }
-        }
-        
-        UpdateAllWidgetCoords(width, height);
-        ProcessAllWidgetsInput();
-        InputState_Update();
-        InputState_Flush();
-        RenderFrame(width, height, egl_display, egl_surface);
     }
 
     // Cleanup
+    InputThread_Stop();
+    Trace_Write();
     uinput_destroy();
     if (gTouchDevFd >= 0) close(gTouchDevFd);
-    eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
-    if (egl_surface != EGL_NO_SURFACE) eglDestroySurface(egl_display, egl_surface);
-    if (egl_context != EGL_NO_CONTEXT) eglDestroyContext(egl_display, egl_context);
-    if (egl_window) wl_egl_window_destroy(egl_window);
-    eglTerminate(egl_display);
-    if (layer_surface) zwlr_layer_surface_v1_destroy(layer_surface);
-    if (surface) wl_surface_destroy(surface);
+    if (signal_fd >= 0) close(signal_fd);
+    Control_Destroy();
+    Overlay_Hide();
+    Egl_Terminate();
+    if (gSubcompositor) wl_subcompositor_destroy(gSubcompositor);
+    if (gViewporter) wp_viewporter_destroy(gViewporter);
+    Presentation_Destroy();
+    SharedView_Destroy();
+    if (gShm) wl_shm_destroy(gShm);
     if (registry) wl_registry_destroy(registry);
     if (display) wl_display_disconnect(display);
 
     return EXIT_SUCCESS;
 }
+#endif // !WLR_GAMEPAD_HEADLESS